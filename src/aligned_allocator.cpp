@@ -0,0 +1,181 @@
+#include "aligned_allocator.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Mapped is a mapping of its own whose huge-page advice the kernel refused.
+enum class Backing : uint32_t { Heap, Mapped, Advised, HugePages };
+
+// Kept in the kArrayAlignment bytes in front of every block, so freeing needs no size
+// and no lookup.
+struct BlockHeader {
+    void* base;
+    std::size_t reservedBytes;
+    Backing backing;
+};
+static_assert(sizeof(BlockHeader) <= kArrayAlignment, "block header must fit in front of the payload");
+
+#if defined(MADV_HUGEPAGE)
+static constexpr bool kTransparentHugePagesSupported = true;
+#else
+static constexpr bool kTransparentHugePagesSupported = false;
+#endif
+
+static std::atomic<HugePageMode> configuredMode{ HugePageMode::Transparent };
+static std::atomic<std::size_t> liveBytes{ 0 };
+static std::atomic<std::size_t> liveAdvisedBytes{ 0 };
+static std::atomic<std::size_t> liveHugePages{ 0 };
+static std::atomic<std::size_t> fallbackCount{ 0 };
+
+static std::size_t roundUp(std::size_t value, std::size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+void setHugePageMode(HugePageMode mode) {
+    configuredMode.store(mode, std::memory_order_relaxed);
+}
+
+HugePageMode hugePageMode() {
+    return configuredMode.load(std::memory_order_relaxed);
+}
+
+// Reserved huge pages; null when the system has none to give.
+static void* mapHugePages(std::size_t bytes) {
+#if defined(_WIN32)
+    // Needs the "Lock pages in memory" privilege, which most accounts lack.
+    if (GetLargePageMinimum() == 0 || bytes % GetLargePageMinimum() != 0) return nullptr;
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#elif defined(MAP_HUGETLB)
+    void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return address == MAP_FAILED ? nullptr : address;
+#else
+    (void)bytes;
+    return nullptr;
+#endif
+}
+
+// An anonymous mapping starting on a huge-page boundary, advised for transparent huge
+// pages; null where that does not exist.
+static void* mapAdvised(std::size_t bytes, bool& advised) {
+#if defined(MADV_HUGEPAGE)
+    // Over-map by one huge page and trim, since mmap only guarantees 4 KiB alignment.
+    const std::size_t span = bytes + kHugePageSize;
+    void* address = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED) return nullptr;
+    const std::uintptr_t start = (std::uintptr_t)address;
+    const std::uintptr_t aligned = roundUp(start, kHugePageSize);
+    if (aligned > start) munmap(address, aligned - start);
+    const std::uintptr_t end = start + span;
+    if (end > aligned + bytes) munmap((void*)(aligned + bytes), end - (aligned + bytes));
+    advised = madvise((void*)aligned, bytes, MADV_HUGEPAGE) == 0;
+    return (void*)aligned;
+#else
+    (void)bytes;
+    advised = false;
+    return nullptr;
+#endif
+}
+
+static void unmap(void* base, std::size_t bytes, Backing backing) {
+#if defined(_WIN32)
+    (void)bytes;
+    if (backing == Backing::HugePages) VirtualFree(base, 0, MEM_RELEASE);
+#else
+    (void)backing;
+    munmap(base, bytes);
+#endif
+}
+
+void* allocateAligned(std::size_t bytes) {
+    const std::size_t payload = roundUp(bytes > 0 ? bytes : 1, kArrayAlignment);
+    const std::size_t total = payload + kArrayAlignment;
+    const HugePageMode mode = hugePageMode();
+
+    BlockHeader header{ nullptr, total, Backing::Heap };
+    if (mode != HugePageMode::Off && payload >= kHugePageSize) {
+        const std::size_t mapped = roundUp(total, kHugePageSize);
+        if (mode == HugePageMode::Explicit) {
+            header.base = mapHugePages(mapped);
+            if (header.base) {
+                header.reservedBytes = mapped;
+                header.backing = Backing::HugePages;
+                liveHugePages.fetch_add(mapped / kHugePageSize, std::memory_order_relaxed);
+            } else {
+                fallbackCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (!header.base && kTransparentHugePagesSupported) {
+            bool advised = false;
+            header.base = mapAdvised(mapped, advised);
+            if (header.base) {
+                header.reservedBytes = mapped;
+                header.backing = advised ? Backing::Advised : Backing::Mapped;
+                if (advised) liveAdvisedBytes.fetch_add(mapped, std::memory_order_relaxed);
+            }
+            // A failed explicit request was counted above already.
+            if (!advised && mode == HugePageMode::Transparent) fallbackCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (!header.base) header.base = ::operator new(total, std::align_val_t(kArrayAlignment));
+
+    liveBytes.fetch_add(header.reservedBytes, std::memory_order_relaxed);
+    std::memcpy(header.base, &header, sizeof(header));
+    return (char*)header.base + kArrayAlignment;
+}
+
+void freeAligned(void* pointer) noexcept {
+    if (!pointer) return;
+    BlockHeader header;
+    std::memcpy(&header, (char*)pointer - kArrayAlignment, sizeof(header));
+
+    liveBytes.fetch_sub(header.reservedBytes, std::memory_order_relaxed);
+    if (header.backing == Backing::Heap) {
+        ::operator delete(header.base, std::align_val_t(kArrayAlignment));
+        return;
+    }
+    if (header.backing == Backing::HugePages) {
+        liveHugePages.fetch_sub(header.reservedBytes / kHugePageSize, std::memory_order_relaxed);
+    } else if (header.backing == Backing::Advised) {
+        liveAdvisedBytes.fetch_sub(header.reservedBytes, std::memory_order_relaxed);
+    }
+    unmap(header.base, header.reservedBytes, header.backing);
+}
+
+MemoryStatistics memoryStatistics() {
+    MemoryStatistics out;
+    out.alignedBytes = liveBytes.load(std::memory_order_relaxed);
+    out.advisedBytes = liveAdvisedBytes.load(std::memory_order_relaxed);
+    out.explicitHugePages = liveHugePages.load(std::memory_order_relaxed);
+    out.fallbacks = fallbackCount.load(std::memory_order_relaxed);
+    out.transparentHugePagesSupported = kTransparentHugePagesSupported;
+
+#if defined(__linux__)
+    if (std::FILE* file = std::fopen("/proc/self/smaps_rollup", "r")) {
+        char line[256];
+        while (std::fgets(line, sizeof(line), file)) {
+            unsigned long long kilobytes = 0;
+            if (std::sscanf(line, "AnonHugePages: %llu kB", &kilobytes) == 1) {
+                out.transparentHugePagesKnown = true;
+                out.transparentHugePages = (std::size_t)(kilobytes * 1024 / kHugePageSize);
+                break;
+            }
+        }
+        std::fclose(file);
+    }
+#endif
+    return out;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Arrays the force walk streams through (particle columns, accelerations, tree nodes)
+// start on a 64-byte boundary and are padded to a multiple of 64 bytes, so a SIMD loop
+// may load a full vector past size(). Blocks of at least kHugePageSize can also be
+// backed by 2 MiB pages, which saves TLB misses once there are millions of particles.
+inline constexpr std::size_t kArrayAlignment = 64;
+inline constexpr std::size_t kHugePageSize = std::size_t(2) << 20;
+
+enum class HugePageMode {
+    Off,
+    // Large blocks are mapped on their own and advised with MADV_HUGEPAGE; the kernel
+    // backs them with huge pages when it has them. Linux only.
+    Transparent,
+    // Reserved huge pages (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows). Falls back
+    // to Transparent, then to ordinary pages, when none are available.
+    Explicit
+};
+
+// Applies to blocks allocated afterwards; existing ones keep their pages.
+void setHugePageMode(HugePageMode mode);
+HugePageMode hugePageMode();
+
+struct MemoryStatistics {
+    // Bytes reserved for live aligned blocks, headers and padding included.
+    std::size_t alignedBytes = 0;
+    // Of those, bytes in blocks advised for transparent huge pages, and the reserved
+    // huge pages held.
+    std::size_t advisedBytes = 0;
+    std::size_t explicitHugePages = 0;
+    // False where the platform has no transparent huge pages (no MADV_HUGEPAGE); the
+    // Transparent mode then keeps ordinary pages and counts no fallbacks.
+    bool transparentHugePagesSupported = false;
+    // Transparent huge pages backing the whole process (AnonHugePages); known only where
+    // /proc/self/smaps_rollup exists.
+    bool transparentHugePagesKnown = false;
+    std::size_t transparentHugePages = 0;
+    // Huge-page requests so far that had to fall back to smaller pages, each counted once.
+    std::size_t fallbacks = 0;
+};
+
+MemoryStatistics memoryStatistics();
+
+// Throws std::bad_alloc like operator new; freeAligned accepts null.
+void* allocateAligned(std::size_t bytes);
+void freeAligned(void* pointer) noexcept;
+
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t count) { return static_cast<T*>(allocateAligned(count * sizeof(T))); }
+    void deallocate(T* pointer, std::size_t) noexcept { freeAligned(pointer); }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
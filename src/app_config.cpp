@@ -1,57 +1,218 @@
-#include "app_config.h"
-#include <algorithm>
-#include <cstdlib>
-#include <cstdint>
-#include <string>
-
-static int clampInt(int v, int lo, int hi) {
-    if (v < lo) return lo;
-    if (v > hi) return hi;
-    return v;
-}
-
-static bool readEnvString(const char* name, std::string& outValue) {
-#if defined(_WIN32)
-    char* buffer = nullptr;
-    size_t length = 0;
-    if (_dupenv_s(&buffer, &length, name) != 0 || !buffer) return false;
-    outValue.assign(buffer);
-    std::free(buffer);
-    return !outValue.empty();
-#else
-    const char* v = std::getenv(name);
-    if (!v) return false;
-    outValue = v;
-    return !outValue.empty();
-#endif
-}
-
-static int readEnvInt(const char* name, int fallback) {
-    std::string value;
-    if (!readEnvString(name, value)) return fallback;
-
-    int x = std::atoi(value.c_str());
-    return (x > 0) ? x : fallback;
-}
-
-static uint32_t readEnvU32(const char* name, uint32_t fallback) {
-    std::string value;
-    if (!readEnvString(name, value)) return fallback;
-
-    unsigned long long x = std::strtoull(value.c_str(), nullptr, 10);
-    if (x == 0ull) return fallback;
-    return (uint32_t)x;
-}
-
-AppConfig buildAppConfig(const SystemInfo& systemInfo) {
-    AppConfig config;
-
-    config.workerThreads = chooseWorkerThreadCount(systemInfo);
-
-    config.particleCount = readEnvInt("GRAVITY_PARTICLES", 25000);
-    config.particleCount = clampInt(config.particleCount, 1000, 150000);
-
-    config.deterministicSeed = readEnvU32("GRAVITY_SEED", 13371337u);
-
-    return config;
-}
+#include "app_config.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+
+static int clampInt(int v, int lo, int hi) {
+    if (v < lo) return lo;
+    if (v > hi) return hi;
+    return v;
+}
+
+static bool readEnvString(const char* name, std::string& outValue) {
+#if defined(_WIN32)
+    char* buffer = nullptr;
+    size_t length = 0;
+    if (_dupenv_s(&buffer, &length, name) != 0 || !buffer) return false;
+    outValue.assign(buffer);
+    std::free(buffer);
+    return !outValue.empty();
+#else
+    const char* v = std::getenv(name);
+    if (!v) return false;
+    outValue = v;
+    return !outValue.empty();
+#endif
+}
+
+static int readEnvInt(const char* name, int fallback) {
+    std::string value;
+    if (!readEnvString(name, value)) return fallback;
+
+    int x = std::atoi(value.c_str());
+    return (x > 0) ? x : fallback;
+}
+
+static float readEnvFloat(const char* name, float fallback) {
+    std::string value;
+    if (!readEnvString(name, value)) return fallback;
+
+    float x = std::strtof(value.c_str(), nullptr);
+    return (x > 0.0f) ? x : fallback;
+}
+
+static uint32_t readEnvU32(const char* name, uint32_t fallback) {
+    std::string value;
+    if (!readEnvString(name, value)) return fallback;
+
+    unsigned long long x = std::strtoull(value.c_str(), nullptr, 10);
+    if (x == 0ull) return fallback;
+    return (uint32_t)x;
+}
+
+static std::vector<std::string> readEnvList(const char* name) {
+    std::vector<std::string> items;
+    std::string value;
+    if (!readEnvString(name, value)) return items;
+
+    std::size_t start = 0;
+    while (start <= value.size()) {
+        std::size_t comma = value.find(',', start);
+        if (comma == std::string::npos) comma = value.size();
+        if (comma > start) items.push_back(value.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+static std::vector<float> readEnvFloatList(const char* name) {
+    std::vector<float> values;
+    for (const std::string& item : readEnvList(name)) {
+        float x = std::strtof(item.c_str(), nullptr);
+        if (x > 0.0f) values.push_back(x);
+    }
+    return values;
+}
+
+static std::vector<int> readEnvIntList(const char* name) {
+    std::vector<int> values;
+    for (const std::string& item : readEnvList(name)) {
+        int x = std::atoi(item.c_str());
+        if (x > 0) values.push_back(x);
+    }
+    return values;
+}
+
+// Accepts single seeds and inclusive ranges, e.g. "1-100,777".
+static std::vector<uint32_t> readEnvSeedList(const char* name) {
+    std::vector<uint32_t> values;
+    for (const std::string& item : readEnvList(name)) {
+        std::size_t dash = item.find('-');
+        unsigned long long first = std::strtoull(item.c_str(), nullptr, 10);
+        unsigned long long last = (dash == std::string::npos) ? first : std::strtoull(item.c_str() + dash + 1, nullptr, 10);
+        for (unsigned long long s = first; s <= last; s++) {
+            if (s != 0ull) values.push_back((uint32_t)s);
+        }
+    }
+    return values;
+}
+
+AppConfig buildAppConfig(const SystemInfo& systemInfo) {
+    AppConfig config;
+
+    config.workerThreads = chooseWorkerThreadCount(systemInfo);
+    std::string threads;
+    config.workerThreadsFixed = readEnvString("GRAVITY_THREADS", threads);
+    config.particleGrain = (std::size_t)clampInt(readEnvInt("GRAVITY_GRAIN", 16384), 64, 1 << 20);
+    config.treeBucketSize = clampInt(readEnvInt("GRAVITY_TREE_BUCKET", 8), 1, 64);
+
+    // 1 reuses a cached calibration when there is one, 2 always calibrates again.
+    const int autotune = readEnvInt("GRAVITY_AUTOTUNE", 0);
+    config.autotune = autotune > 0;
+    config.autotuneRecalibrate = autotune > 1;
+    readEnvString("GRAVITY_AUTOTUNE_CACHE", config.autotuneCachePath);
+
+    config.dimensions = (readEnvInt("GRAVITY_DIMENSIONS", 2) == 3) ? 3 : 2;
+
+    config.deterministicSeed = readEnvU32("GRAVITY_SEED", 13371337u);
+
+    std::string preset;
+    if (readEnvString("GRAVITY_PRESET", preset)) {
+        parseGalaxyPreset(preset, config.galaxyPreset);
+    }
+    readEnvString("GRAVITY_IC_FILE", config.initialConditionsPath);
+
+    std::string opening;
+    if (readEnvString("GRAVITY_OPENING", opening) && opening == "relative") {
+        config.openingCriterion = OpeningCriterion::RelativeAcceleration;
+    }
+
+    std::string solver;
+    if (readEnvString("GRAVITY_SOLVER", solver)) {
+        if (solver == "pm") config.forceSolver = ForceSolver::ParticleMesh;
+        else if (solver == "treepm") config.forceSolver = ForceSolver::TreePM;
+    }
+    std::string tree;
+    if (readEnvString("GRAVITY_TREE", tree) && tree == "kd") {
+        config.treeType = TreeType::KdTree;
+    }
+    std::string hugePages;
+    if (readEnvString("GRAVITY_HUGE_PAGES", hugePages)) {
+        if (hugePages == "off") config.hugePages = HugePageMode::Off;
+        else if (hugePages == "explicit") config.hugePages = HugePageMode::Explicit;
+    }
+    std::string integrator;
+    if (readEnvString("GRAVITY_INTEGRATOR", integrator)) {
+        if (integrator == "leapfrog") config.integrator = Integrator::Leapfrog;
+        else if (integrator == "forest-ruth") config.integrator = Integrator::ForestRuth;
+    }
+    std::string precision;
+    if (readEnvString("GRAVITY_PRECISION", precision) && precision == "double") {
+        config.positionPrecision = PositionPrecision::Double;
+    }
+    config.timeStep.adaptive = readEnvInt("GRAVITY_ADAPTIVE_DT", 0) != 0;
+    config.timeStep.accelerationFactor = readEnvFloat("GRAVITY_DT_ACCURACY", config.timeStep.accelerationFactor);
+    config.timeStep.velocityFactor = 8.0f * config.timeStep.accelerationFactor;
+    config.timeStep.energyTolerance = readEnvFloat("GRAVITY_ENERGY_TOLERANCE", 0.0f);
+    std::string assignment;
+    if (readEnvString("GRAVITY_MASS_ASSIGNMENT", assignment) && assignment == "tsc") {
+        config.massAssignment = MassAssignment::TriangularShapedCloud;
+    }
+    config.meshSize = clampInt(readEnvInt("GRAVITY_MESH", 256), 16, 4096);
+    config.residentWorkers = readEnvInt("GRAVITY_RESIDENT_WORKERS", 0) != 0;
+    config.interactionLists = readEnvInt("GRAVITY_INTERACTION_LISTS", 0) != 0;
+    config.interactionListMargin = std::min(readEnvFloat("GRAVITY_LIST_MARGIN", 0.1f), 0.9f);
+
+    config.focus = readEnvInt("GRAVITY_FOCUS", 0) != 0;
+    config.focusTheta = std::min(readEnvFloat("GRAVITY_FOCUS_THETA", 0.5f), 2.0f);
+
+    std::string pointSprites;
+    if (readEnvString("GRAVITY_POINT_SPRITES", pointSprites) && pointSprites == "0") config.pointSprites = false;
+
+    config.metricsPort = clampInt(readEnvInt("GRAVITY_METRICS_PORT", 0), 0, 65535);
+
+    config.headlessSteps = readEnvInt("GRAVITY_HEADLESS_STEPS", 0);
+
+    // The viewer stays interactive up to about 150k particles; headless runs are only
+    // limited by memory.
+    const int requestedParticles = readEnvInt("GRAVITY_PARTICLES", 25000);
+    const int maxParticles = config.headlessSteps > 0 ? 64000000 : 150000;
+    config.particleCount = clampInt(requestedParticles, 1000, maxParticles);
+    if (config.particleCount != requestedParticles) {
+        std::fprintf(stderr, "GRAVITY_PARTICLES=%d is out of range, using %d\n", requestedParticles,
+                     config.particleCount);
+    }
+    config.diagnosticsInterval = readEnvInt("GRAVITY_DIAGNOSTICS_INTERVAL", 0);
+
+    readEnvString("GRAVITY_HASH_LOG", config.hashLogPath);
+    readEnvString("GRAVITY_HASH_VERIFY", config.hashVerifyPath);
+    bool hashRequested = !config.hashLogPath.empty() || !config.hashVerifyPath.empty();
+    config.hashIntervalSteps = readEnvInt("GRAVITY_HASH_INTERVAL", hashRequested ? 60 : 0);
+
+    readEnvString("GRAVITY_FRAME_DIR", config.frames.directory);
+    readEnvString("GRAVITY_FRAME_PIPE", config.frames.pipeCommand);
+    std::string frameSize;
+    if (readEnvString("GRAVITY_FRAME_SIZE", frameSize)) {
+        int w = 0, h = 0;
+        if (std::sscanf(frameSize.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+            config.frames.width = clampInt(w, 64, 7680);
+            config.frames.height = clampInt(h, 64, 4320);
+        }
+    }
+    config.frames.intervalSteps = readEnvInt("GRAVITY_FRAME_INTERVAL", 1);
+    config.frames.qualityPreset = readEnvInt("GRAVITY_FRAME_QUALITY", 2);
+    config.frames.viewWidth = (float)readEnvInt("GRAVITY_FRAME_VIEW", 1600);
+
+    readEnvString("GRAVITY_SWEEP", config.sweep.resultsPath);
+    config.sweep.seeds = readEnvSeedList("GRAVITY_SWEEP_SEEDS");
+    config.sweep.thetas = readEnvFloatList("GRAVITY_SWEEP_THETAS");
+    config.sweep.softeningLengths = readEnvFloatList("GRAVITY_SWEEP_SOFTENINGS");
+    config.sweep.particleCounts = readEnvIntList("GRAVITY_SWEEP_PARTICLES");
+    config.sweep.steps = readEnvInt("GRAVITY_SWEEP_STEPS", 600);
+    // Nothing is rendered during a sweep, so by default it uses every hardware thread.
+    config.sweep.workerThreads = readEnvInt("GRAVITY_THREADS", (int)systemInfo.detectedHardwareThreads);
+
+    return config;
+}
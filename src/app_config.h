@@ -1,11 +1,86 @@
-#pragma once
-#include <cstdint>
-#include "system_info.h"
-
-struct AppConfig {
-    uint32_t deterministicSeed = 13371337u;
-    int particleCount = 25000;
-    unsigned int workerThreads = 1;
-};
-
-AppConfig buildAppConfig(const SystemInfo& systemInfo);
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "aligned_allocator.h"
+#include "system_info.h"
+#include "simulation_params.h"
+#include "initial_conditions.h"
+
+// Parameter grid for ensemble runs. Every combination of the lists is one run; an
+// empty list means "the single value from AppConfig / SimulationParams".
+struct SweepConfig {
+    std::string resultsPath;
+    std::vector<uint32_t> seeds;
+    std::vector<float> thetas;
+    std::vector<float> softeningLengths;
+    std::vector<int> particleCounts;
+    int steps = 600;
+    unsigned int workerThreads = 1;
+};
+
+// Headless frame output through the CPU renderer. Enabled by a directory (numbered PPM
+// files) or a pipe command that receives raw rgb24 frames.
+struct FrameOutputConfig {
+    std::string directory;
+    std::string pipeCommand;
+    int width = 1920;
+    int height = 1080;
+    int intervalSteps = 1;
+    int qualityPreset = 2;
+    float viewWidth = 1600.0f;
+
+    bool enabled() const { return !directory.empty() || !pipeCommand.empty(); }
+};
+
+struct AppConfig {
+    uint32_t deterministicSeed = 13371337u;
+    int particleCount = 25000;
+    int dimensions = 2;
+    GalaxyPreset galaxyPreset = GalaxyPreset::Disc;
+    // External initial conditions replacing the preset (see importParticles); empty
+    // keeps the preset.
+    std::string initialConditionsPath;
+    unsigned int workerThreads = 1;
+    // GRAVITY_THREADS was given, so the autotuner keeps workerThreads.
+    bool workerThreadsFixed = false;
+    std::size_t particleGrain = 16384;
+    int treeBucketSize = 8;
+    // Calibrate workerThreads, particleGrain and treeBucketSize at startup, or reuse the
+    // result cached for this machine and size in autotuneCachePath (see autotune.h).
+    bool autotune = false;
+    bool autotuneRecalibrate = false;
+    std::string autotuneCachePath = "gravity_autotune.txt";
+    OpeningCriterion openingCriterion = OpeningCriterion::Geometric;
+    ForceSolver forceSolver = ForceSolver::BarnesHut;
+    TreeType treeType = TreeType::Octree;
+    // Pages behind the particle and tree arrays; set before the simulation allocates.
+    HugePageMode hugePages = HugePageMode::Transparent;
+    Integrator integrator = Integrator::SymplecticEuler;
+    PositionPrecision positionPrecision = PositionPrecision::Single;
+    TimeStepControl timeStep;
+    MassAssignment massAssignment = MassAssignment::CloudInCell;
+    int meshSize = 256;
+    bool pointSprites = true;
+    bool focus = false;
+    float focusTheta = 0.5f;
+    bool residentWorkers = false;
+    bool interactionLists = false;
+    float interactionListMargin = 0.1f;
+
+    // Serves Prometheus metrics on 127.0.0.1 at this port; 0 disables the exporter.
+    int metricsPort = 0;
+
+    int headlessSteps = 0;
+    int diagnosticsInterval = 0;
+
+    int hashIntervalSteps = 0;
+    std::string hashLogPath;
+    std::string hashVerifyPath;
+
+    SweepConfig sweep;
+    FrameOutputConfig frames;
+};
+
+AppConfig buildAppConfig(const SystemInfo& systemInfo);
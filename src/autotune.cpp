@@ -0,0 +1,224 @@
+#include "autotune.h"
+#include "gravity_simulation.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static constexpr int kTimedSteps = 4;
+static constexpr std::size_t kMinGrain = 256;
+static constexpr std::size_t kMaxGrain = 65536;
+
+static const char* solverName(ForceSolver solver) {
+    switch (solver) {
+    case ForceSolver::ParticleMesh: return "pm";
+    case ForceSolver::TreePM: return "treepm";
+    default: return "bh";
+    }
+}
+
+std::string autotuneKey(const AppConfig& config, const SystemInfo& systemInfo) {
+    // Brand strings come padded with spaces.
+    std::string brand = systemInfo.cpuBrandString;
+    brand.erase(0, brand.find_first_not_of(' '));
+    brand.erase(brand.find_last_not_of(' ') + 1);
+    std::replace(brand.begin(), brand.end(), '\t', ' ');
+
+    int sizeBucket = 0;
+    while ((2 << sizeBucket) <= config.particleCount) sizeBucket++;
+
+    // A calibration restricted to a GRAVITY_THREADS count tunes the grain for that count
+    // only, so it must not be picked up by runs that are free to choose.
+    char workers[32] = "";
+    if (config.workerThreadsFixed) std::snprintf(workers, sizeof(workers), "|workers=fixed:%u", config.workerThreads);
+
+    char key[512];
+    std::snprintf(key, sizeof(key), "%s|threads=%u%s|%dD|n=2^%d|%s|%s%s", brand.c_str(),
+                  systemInfo.detectedHardwareThreads, workers, config.dimensions, sizeBucket,
+                  solverName(config.forceSolver), config.treeType == TreeType::KdTree ? "kd" : "octree",
+                  config.interactionLists ? "|lists" : "");
+    return key;
+}
+
+bool readTunedSettings(const std::string& path, const std::string& key, TunedSettings& outSettings) {
+    std::FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    bool found = false;
+    char line[1024];
+    while (std::fgets(line, sizeof(line), file)) {
+        const std::string entry(line);
+        if (entry.compare(0, key.size() + 1, key + "\t") != 0) continue;
+
+        unsigned int threads = 0;
+        unsigned long long grain = 0;
+        int bucket = 0;
+        const int fields = std::sscanf(entry.c_str() + key.size() + 1, "%u %llu %d", &threads, &grain, &bucket);
+        if (fields == 3 && threads > 0 && grain > 0 && bucket > 0) {
+            outSettings.workerThreads = threads;
+            outSettings.particleGrain = (std::size_t)grain;
+            outSettings.treeBucketSize = bucket;
+            found = true;
+        }
+    }
+    std::fclose(file);
+    return found;
+}
+
+bool writeTunedSettings(const std::string& path, const std::string& key, const TunedSettings& settings) {
+    // Keeps the other machines' and sizes' entries.
+    std::vector<std::string> lines;
+    if (std::FILE* existing = std::fopen(path.c_str(), "r")) {
+        char line[1024];
+        while (std::fgets(line, sizeof(line), existing)) {
+            std::string entry(line);
+            if (entry.compare(0, key.size() + 1, key + "\t") == 0) continue;
+            if (!entry.empty() && entry.back() != '\n') entry += '\n';
+            lines.push_back(entry);
+        }
+        std::fclose(existing);
+    }
+
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        std::fprintf(stderr, "autotune: cannot write '%s'\n", path.c_str());
+        return false;
+    }
+    for (const std::string& entry : lines) std::fputs(entry.c_str(), file);
+    std::fprintf(file, "%s\t%u %llu %d\n", key.c_str(), settings.workerThreads,
+                 (unsigned long long)settings.particleGrain, settings.treeBucketSize);
+    std::fclose(file);
+    return true;
+}
+
+template <int Dim>
+static void configureSimulation(GravitySimulation<Dim>& simulation, const AppConfig& config) {
+    simulation.params().openingCriterion = config.openingCriterion;
+    simulation.params().forceSolver = config.forceSolver;
+    simulation.params().treeType = config.treeType;
+    simulation.params().integrator = config.integrator;
+    simulation.params().positionPrecision = config.positionPrecision;
+    simulation.params().massAssignment = config.massAssignment;
+    simulation.params().meshSize = config.meshSize;
+    simulation.params().residentWorkers = config.residentWorkers;
+    simulation.params().interactionLists = config.interactionLists;
+    simulation.params().interactionListMargin = config.interactionListMargin;
+}
+
+// Median wall time of a few steps with the given settings. The first step is left out:
+// it pays for allocations and for rebuilding anything the settings invalidate.
+template <int Dim>
+static double stepSeconds(GravitySimulation<Dim>& simulation, const TunedSettings& settings) {
+    simulation.params().particleGrain = settings.particleGrain;
+    simulation.params().treeBucketSize = settings.treeBucketSize;
+    const double dt = simulation.params().fixedTimeStep;
+    simulation.stepFixed(dt);
+
+    std::vector<double> seconds;
+    for (int s = 0; s < kTimedSteps; s++) {
+        simulation.stepFixed(dt);
+        seconds.push_back(simulation.lastStepStatistics().totalSeconds);
+    }
+    std::sort(seconds.begin(), seconds.end());
+    const double median = seconds[seconds.size() / 2];
+    std::fprintf(stderr, "autotune: threads=%u grain=%zu bucket=%d %.2f ms/step\n", settings.workerThreads,
+                 settings.particleGrain, settings.treeBucketSize, median * 1000.0);
+    return median;
+}
+
+template <int Dim>
+static TunedSettings calibrateDimension(const AppConfig& config, const SystemInfo& systemInfo) {
+    const std::size_t n = (std::size_t)config.particleCount;
+
+    TunedSettings best;
+    best.workerThreads = config.workerThreads;
+    best.particleGrain = config.particleGrain;
+    best.treeBucketSize = config.treeBucketSize;
+
+    std::vector<unsigned int> threadCounts;
+    if (config.workerThreadsFixed) {
+        threadCounts.push_back(config.workerThreads);
+    } else {
+        const unsigned int hardware = std::max(1u, systemInfo.detectedHardwareThreads);
+        for (unsigned int t = 1; t < hardware; t *= 2) threadCounts.push_back(t);
+        if (hardware > 2) threadCounts.push_back(hardware - 1);
+        threadCounts.push_back(hardware);
+        std::sort(threadCounts.begin(), threadCounts.end());
+        threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+    }
+
+    // Worker counts are compared at a grain that gives each worker about four ranges, so
+    // the default grain cannot hide them by running small passes inline.
+    double bestSeconds = 0.0;
+    for (unsigned int threads : threadCounts) {
+        ThreadPool pool(threads);
+        GravitySimulation<Dim> simulation(pool, config.particleCount, config.deterministicSeed, config.galaxyPreset);
+        configureSimulation(simulation, config);
+
+        TunedSettings candidate = best;
+        candidate.workerThreads = threads;
+        candidate.particleGrain = kMinGrain;
+        while (candidate.particleGrain * 2 <= kMaxGrain && candidate.particleGrain * 2 * 4 * threads <= n) {
+            candidate.particleGrain *= 2;
+        }
+        const double seconds = stepSeconds(simulation, candidate);
+        if (bestSeconds == 0.0 || seconds < bestSeconds) {
+            bestSeconds = seconds;
+            best = candidate;
+        }
+    }
+
+    ThreadPool pool(best.workerThreads);
+    GravitySimulation<Dim> simulation(pool, config.particleCount, config.deterministicSeed, config.galaxyPreset);
+    configureSimulation(simulation, config);
+    bestSeconds = stepSeconds(simulation, best);
+
+    std::vector<std::size_t> grains;
+    for (std::size_t grain = kMinGrain; grain <= kMaxGrain && grain <= n; grain *= 2) grains.push_back(grain);
+    for (std::size_t grain : grains) {
+        if (grain == best.particleGrain) continue;
+        TunedSettings candidate = best;
+        candidate.particleGrain = grain;
+        const double seconds = stepSeconds(simulation, candidate);
+        if (seconds < bestSeconds) {
+            bestSeconds = seconds;
+            best = candidate;
+        }
+    }
+
+    if (config.treeType == TreeType::KdTree && config.forceSolver != ForceSolver::ParticleMesh) {
+        for (int bucket : { 1, 2, 4, 8, 16, 32 }) {
+            if (bucket == best.treeBucketSize) continue;
+            TunedSettings candidate = best;
+            candidate.treeBucketSize = bucket;
+            const double seconds = stepSeconds(simulation, candidate);
+            if (seconds < bestSeconds) {
+                bestSeconds = seconds;
+                best = candidate;
+            }
+        }
+    }
+    return best;
+}
+
+TunedSettings calibrate(const AppConfig& config, const SystemInfo& systemInfo) {
+    if (config.dimensions == 3) return calibrateDimension<3>(config, systemInfo);
+    return calibrateDimension<2>(config, systemInfo);
+}
+
+void applyAutotune(AppConfig& config, const SystemInfo& systemInfo) {
+    if (!config.autotune) return;
+
+    const std::string key = autotuneKey(config, systemInfo);
+    TunedSettings settings;
+    if (config.autotuneRecalibrate || !readTunedSettings(config.autotuneCachePath, key, settings)) {
+        std::fprintf(stderr, "autotune: calibrating %s\n", key.c_str());
+        settings = calibrate(config, systemInfo);
+        writeTunedSettings(config.autotuneCachePath, key, settings);
+    }
+
+    if (!config.workerThreadsFixed) config.workerThreads = settings.workerThreads;
+    config.particleGrain = settings.particleGrain;
+    config.treeBucketSize = settings.treeBucketSize;
+    std::fprintf(stderr, "autotune: threads=%u grain=%zu bucket=%d\n", config.workerThreads, config.particleGrain,
+                 config.treeBucketSize);
+}
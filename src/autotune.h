@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "app_config.h"
+#include "system_info.h"
+
+// Execution settings the startup calibration picks for one machine and problem size.
+struct TunedSettings {
+    unsigned int workerThreads = 1;
+    std::size_t particleGrain = 16384;
+    int treeBucketSize = 8;
+};
+
+// Identifies a calibration: CPU brand, hardware threads, a thread count pinned with
+// GRAVITY_THREADS, dimensions, the particle count rounded down to a power of two, and
+// the solver and tree, which all move the optimum.
+std::string autotuneKey(const AppConfig& config, const SystemInfo& systemInfo);
+
+// The cache is a text file with one "key<TAB>threads grain bucket" line per calibration.
+bool readTunedSettings(const std::string& path, const std::string& key, TunedSettings& outSettings);
+bool writeTunedSettings(const std::string& path, const std::string& key, const TunedSettings& settings);
+
+// Times a few steps of the configured preset at config.particleCount for each candidate:
+// first the worker count, then the grain at the best count, then the bucket size when the
+// k-d tree is selected. Takes a few seconds.
+TunedSettings calibrate(const AppConfig& config, const SystemInfo& systemInfo);
+
+// With config.autotune set, takes the cached settings for this machine and size (or
+// calibrates and caches them) and applies them to config.
+void applyAutotune(AppConfig& config, const SystemInfo& systemInfo);
@@ -1,223 +1,512 @@
-#include "barnes_hut.h"
-#include <algorithm>
-#include <cmath>
-
-bool BarnesHutNode::isLeaf() const {
-    return childIndex0 < 0 && childIndex1 < 0 && childIndex2 < 0 && childIndex3 < 0;
-}
-
-const std::vector<BarnesHutNode>& BarnesHutTree::nodes() const {
-    return treeNodes;
-}
-
-int BarnesHutTree::createNode(float cx, float cy, float halfSize) {
-    BarnesHutNode node;
-    node.centerX = cx;
-    node.centerY = cy;
-    node.halfSize = halfSize;
-    treeNodes.push_back(node);
-    return (int)treeNodes.size() - 1;
-}
-
-int BarnesHutTree::selectQuadrant(const BarnesHutNode& node, float x, float y) const {
-    bool east = x >= node.centerX;
-    bool south = y >= node.centerY;
-    if (!east && !south) return 0;
-    if ( east && !south) return 1;
-    if (!east &&  south) return 2;
-    return 3;
-}
-
-void BarnesHutTree::childBounds(const BarnesHutNode& node, int quadrant, float& outCenterX, float& outCenterY, float& outHalfSize) const {
-    outHalfSize = node.halfSize * 0.5f;
-    float dx = (quadrant == 1 || quadrant == 3) ? outHalfSize : -outHalfSize;
-    float dy = (quadrant == 2 || quadrant == 3) ? outHalfSize : -outHalfSize;
-    outCenterX = node.centerX + dx;
-    outCenterY = node.centerY + dy;
-}
-
-void BarnesHutTree::accumulateIntoLeaf(int nodeIndex, const Particles& particles, int particleIndex) {
-    BarnesHutNode& node = treeNodes[nodeIndex];
-
-    float px = particles.positionX[particleIndex];
-    float py = particles.positionY[particleIndex];
-    float pm = particles.mass[particleIndex];
-
-    if (node.particleIndex == -1) {
-        node.particleIndex = particleIndex;
-        return;
-    }
-
-    if (node.particleIndex >= 0) {
-        int existing = node.particleIndex;
-        float ex = particles.positionX[existing];
-        float ey = particles.positionY[existing];
-        float em = particles.mass[existing];
-
-        node.totalMass = em;
-        node.centerOfMassX = ex;
-        node.centerOfMassY = ey;
-        node.particleIndex = -2;
-    }
-
-    float oldMass = node.totalMass;
-    float newMass = oldMass + pm;
-
-    node.centerOfMassX = (node.centerOfMassX * oldMass + px * pm) / newMass;
-    node.centerOfMassY = (node.centerOfMassY * oldMass + py * pm) / newMass;
-    node.totalMass = newMass;
-}
-
-void BarnesHutTree::build(const Particles& particles) {
-    treeNodes.clear();
-    treeNodes.reserve(particles.count() * 3 + 64);
-    if (particles.count() == 0) return;
-
-    float minX = particles.positionX[0];
-    float maxX = particles.positionX[0];
-    float minY = particles.positionY[0];
-    float maxY = particles.positionY[0];
-
-    for (std::size_t i = 1; i < particles.count(); i++) {
-        minX = std::min(minX, particles.positionX[i]);
-        maxX = std::max(maxX, particles.positionX[i]);
-        minY = std::min(minY, particles.positionY[i]);
-        maxY = std::max(maxY, particles.positionY[i]);
-    }
-
-    float centerX = 0.5f * (minX + maxX);
-    float centerY = 0.5f * (minY + maxY);
-    float span = std::max(maxX - minX, maxY - minY);
-    float halfSize = std::max(512.0f, 0.75f * span + 128.0f);
-
-    int rootIndex = createNode(centerX, centerY, halfSize);
-
-    for (int i = 0; i < (int)particles.count(); i++) {
-        insertParticle(rootIndex, particles, i, 0);
-    }
-
-    computeMassProperties(rootIndex, particles);
-}
-
-void BarnesHutTree::insertParticle(int nodeIndex, const Particles& particles, int particleIndex, int depth) {
-    while (true) {
-        BarnesHutNode& node = treeNodes[nodeIndex];
-
-        if (depth >= kMaxDepth || node.halfSize <= kMinHalfSize) {
-            accumulateIntoLeaf(nodeIndex, particles, particleIndex);
-            return;
-        }
-
-        if (node.isLeaf() && node.particleIndex < 0) {
-            node.particleIndex = particleIndex;
-            return;
-        }
-
-        if (node.isLeaf() && node.particleIndex == -2) {
-            accumulateIntoLeaf(nodeIndex, particles, particleIndex);
-            return;
-        }
-
-        if (node.isLeaf() && node.particleIndex >= 0) {
-            int existingParticle = node.particleIndex;
-            node.particleIndex = -1;
-
-            BarnesHutNode nodeCopy = node;
-
-            float c0x, c0y, c0h;
-            float c1x, c1y, c1h;
-            float c2x, c2y, c2h;
-            float c3x, c3y, c3h;
-
-            childBounds(nodeCopy, 0, c0x, c0y, c0h);
-            childBounds(nodeCopy, 1, c1x, c1y, c1h);
-            childBounds(nodeCopy, 2, c2x, c2y, c2h);
-            childBounds(nodeCopy, 3, c3x, c3y, c3h);
-
-            int child0 = createNode(c0x, c0y, c0h);
-            int child1 = createNode(c1x, c1y, c1h);
-            int child2 = createNode(c2x, c2y, c2h);
-            int child3 = createNode(c3x, c3y, c3h);
-
-            treeNodes[nodeIndex].childIndex0 = child0;
-            treeNodes[nodeIndex].childIndex1 = child1;
-            treeNodes[nodeIndex].childIndex2 = child2;
-            treeNodes[nodeIndex].childIndex3 = child3;
-
-            int qExisting = selectQuadrant(treeNodes[nodeIndex], particles.positionX[existingParticle], particles.positionY[existingParticle]);
-            int qNew = selectQuadrant(treeNodes[nodeIndex], particles.positionX[particleIndex], particles.positionY[particleIndex]);
-
-            int existingChild =
-                (qExisting == 0) ? treeNodes[nodeIndex].childIndex0 :
-                (qExisting == 1) ? treeNodes[nodeIndex].childIndex1 :
-                (qExisting == 2) ? treeNodes[nodeIndex].childIndex2 :
-                                   treeNodes[nodeIndex].childIndex3;
-
-            int newChild =
-                (qNew == 0) ? treeNodes[nodeIndex].childIndex0 :
-                (qNew == 1) ? treeNodes[nodeIndex].childIndex1 :
-                (qNew == 2) ? treeNodes[nodeIndex].childIndex2 :
-                              treeNodes[nodeIndex].childIndex3;
-
-            insertParticle(existingChild, particles, existingParticle, depth + 1);
-            nodeIndex = newChild;
-            depth = depth + 1;
-            continue;
-        }
-
-        int q = selectQuadrant(node, particles.positionX[particleIndex], particles.positionY[particleIndex]);
-        int nextChild =
-            (q == 0) ? node.childIndex0 :
-            (q == 1) ? node.childIndex1 :
-            (q == 2) ? node.childIndex2 :
-                       node.childIndex3;
-
-        nodeIndex = nextChild;
-        depth = depth + 1;
-    }
-}
-
-void BarnesHutTree::computeMassProperties(int nodeIndex, const Particles& particles) {
-    BarnesHutNode& node = treeNodes[nodeIndex];
-
-    if (node.isLeaf()) {
-        if (node.particleIndex == -2) {
-            return;
-        }
-
-        if (node.particleIndex >= 0) {
-            int i = node.particleIndex;
-            node.totalMass = particles.mass[i];
-            node.centerOfMassX = particles.positionX[i];
-            node.centerOfMassY = particles.positionY[i];
-        } else {
-            node.totalMass = 0.0f;
-            node.centerOfMassX = node.centerX;
-            node.centerOfMassY = node.centerY;
-        }
-        return;
-    }
-
-    float massSum = 0.0f;
-    float weightedX = 0.0f;
-    float weightedY = 0.0f;
-
-    int children[4] = { node.childIndex0, node.childIndex1, node.childIndex2, node.childIndex3 };
-    for (int c : children) {
-        if (c < 0) continue;
-        computeMassProperties(c, particles);
-        float m = treeNodes[c].totalMass;
-        massSum += m;
-        weightedX += m * treeNodes[c].centerOfMassX;
-        weightedY += m * treeNodes[c].centerOfMassY;
-    }
-
-    node.totalMass = massSum;
-    if (massSum > 0.0f) {
-        node.centerOfMassX = weightedX / massSum;
-        node.centerOfMassY = weightedY / massSum;
-    } else {
-        node.centerOfMassX = node.centerX;
-        node.centerOfMassY = node.centerY;
-    }
-}
+#include "barnes_hut.h"
+#include <algorithm>
+#include <cmath>
+
+template <int Dim>
+bool BarnesHutNode<Dim>::isLeaf() const {
+    // Children are always created together, so the first one decides.
+    return childIndex[0] < 0;
+}
+
+template <int Dim>
+const AlignedVector<BarnesHutNode<Dim>>& BarnesHutTree<Dim>::nodes() const {
+    return treeNodes;
+}
+
+template <int Dim>
+const std::vector<int>& BarnesHutTree<Dim>::particleOrder() const {
+    return orderedParticles;
+}
+
+template <int Dim>
+const std::vector<int>& BarnesHutTree<Dim>::particleLeaves() const {
+    return particleLeaf;
+}
+
+template <int Dim>
+int BarnesHutTree<Dim>::depth() const {
+    return deepestLevel;
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::statistics(TreeStatistics& out) const {
+    out.nodes = treeNodes.size();
+    out.leaves = 0;
+    out.emptyLeaves = 0;
+    out.aggregatedLeaves = 0;
+    out.aggregatedParticles = 0;
+    out.bucketLeaves = 0;
+    out.nodesPerDepth.clear();
+    out.particlesPerDepth.clear();
+    out.bytesUsed = treeNodes.size() * sizeof(Node);
+    out.bytesReserved = treeNodes.capacity() * sizeof(Node);
+    if (treeNodes.empty()) return;
+
+    // Both builds create children after their parent, so one forward pass settles every
+    // node's level before its children are reached.
+    std::vector<int> level(treeNodes.size(), 0);
+    for (std::size_t n = 0; n < treeNodes.size(); n++) {
+        const Node& node = treeNodes[n];
+        const std::size_t l = (std::size_t)level[n];
+        if (out.nodesPerDepth.size() <= l) {
+            out.nodesPerDepth.resize(l + 1, 0);
+            out.particlesPerDepth.resize(l + 1, 0);
+        }
+        out.nodesPerDepth[l]++;
+
+        if (!node.isLeaf()) {
+            for (int c : node.childIndex) {
+                if (c >= 0) level[(std::size_t)c] = level[n] + 1;
+            }
+            continue;
+        }
+        out.leaves++;
+        out.particlesPerDepth[l] += (std::size_t)node.particleCount;
+        if (node.particleCount == 0) out.emptyLeaves++;
+        if (node.particleIndex == -2) {
+            out.aggregatedLeaves++;
+            out.aggregatedParticles += (std::size_t)node.particleCount;
+        } else if (node.particleIndex == -3) {
+            out.bucketLeaves++;
+        }
+    }
+}
+
+template <int Dim>
+int BarnesHutTree<Dim>::createNode(const std::array<float, Dim>& center, float halfSize) {
+    Node node;
+    node.center = center;
+    node.halfSize = halfSize;
+    treeNodes.push_back(node);
+    return (int)treeNodes.size() - 1;
+}
+
+template <int Dim>
+int BarnesHutTree<Dim>::selectChild(const Node& node, const Particles<Dim>& particles, int particleIndex) const {
+    int child = 0;
+    for (int d = 0; d < Dim; d++) {
+        if (particles.position[d][particleIndex] >= node.center[d]) child |= (1 << d);
+    }
+    return child;
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::childBounds(const Node& node, int child, std::array<float, Dim>& outCenter, float& outHalfSize) const {
+    outHalfSize = node.halfSize * 0.5f;
+    for (int d = 0; d < Dim; d++) {
+        outCenter[d] = node.center[d] + ((child & (1 << d)) ? outHalfSize : -outHalfSize);
+    }
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::accumulateIntoLeaf(int nodeIndex, const Particles<Dim>& particles, int particleIndex) {
+    Node& node = treeNodes[nodeIndex];
+
+    float pm = particles.mass[particleIndex];
+    particleLeaf[particleIndex] = nodeIndex;
+    node.particleCount++;
+
+    if (node.particleIndex == -1) {
+        node.particleIndex = particleIndex;
+        return;
+    }
+
+    if (node.particleIndex >= 0) {
+        int existing = node.particleIndex;
+
+        node.totalMass = particles.mass[existing];
+        for (int d = 0; d < Dim; d++) node.centerOfMass[d] = particles.position[d][existing];
+        node.particleIndex = -2;
+    }
+
+    float oldMass = node.totalMass;
+    float newMass = oldMass + pm;
+
+    // Despawned particles are massless; until a massive one arrives the centre of mass
+    // stays where the first member put it.
+    if (newMass <= 0.0f) return;
+
+    for (int d = 0; d < Dim; d++) {
+        node.centerOfMass[d] = (node.centerOfMass[d] * oldMass + particles.position[d][particleIndex] * pm) / newMass;
+    }
+    node.totalMass = newMass;
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::build(const Particles<Dim>& particles) {
+    treeNodes.clear();
+    treeNodes.reserve(particles.count() * (Dim == 2 ? 3 : 5) + 64);
+    orderedParticles.resize(particles.count());
+    particleLeaf.resize(particles.count());
+    deepestLevel = 0;
+    if (particles.count() == 0) return;
+
+    std::array<float, Dim> minBound;
+    std::array<float, Dim> maxBound;
+    for (int d = 0; d < Dim; d++) {
+        minBound[d] = particles.position[d][0];
+        maxBound[d] = particles.position[d][0];
+    }
+
+    for (std::size_t i = 1; i < particles.count(); i++) {
+        for (int d = 0; d < Dim; d++) {
+            minBound[d] = std::min(minBound[d], particles.position[d][i]);
+            maxBound[d] = std::max(maxBound[d], particles.position[d][i]);
+        }
+    }
+
+    std::array<float, Dim> center;
+    float span = 0.0f;
+    for (int d = 0; d < Dim; d++) {
+        center[d] = 0.5f * (minBound[d] + maxBound[d]);
+        span = std::max(span, maxBound[d] - minBound[d]);
+    }
+    float halfSize = std::max(512.0f, 0.75f * span + 128.0f);
+
+    int rootIndex = createNode(center, halfSize);
+
+    for (int i = 0; i < (int)particles.count(); i++) {
+        insertParticle(rootIndex, particles, i, 0);
+    }
+
+    int nextParticle = 0;
+    computeMassProperties(rootIndex, particles, nextParticle);
+
+    // Leaves received their ranges in depth-first order above; scatter the particles
+    // into them. Walking indices in order keeps each leaf's members ascending.
+    std::vector<int> leafCursor(treeNodes.size());
+    for (std::size_t n = 0; n < treeNodes.size(); n++) leafCursor[n] = treeNodes[n].firstParticle;
+    for (int i = 0; i < (int)particles.count(); i++) {
+        orderedParticles[(std::size_t)leafCursor[(std::size_t)particleLeaf[(std::size_t)i]]++] = i;
+    }
+
+    linkSkipIndices();
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::linkSkipIndices() {
+    // Parents come before their children, so a forward pass knows where every parent
+    // skips to before threading its children. Siblings keep the order of the stack walk.
+    treeNodes[0].skipIndex = (int)treeNodes.size();
+    for (const Node& node : treeNodes) {
+        if (node.isLeaf()) continue;
+        for (int c = 0; c < Node::kChildCount; c++) {
+            treeNodes[(std::size_t)node.childIndex[c]].skipIndex =
+                c + 1 < Node::kChildCount ? node.childIndex[c + 1] : node.skipIndex;
+        }
+    }
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::insertParticle(int nodeIndex, const Particles<Dim>& particles, int particleIndex, int depth) {
+    while (true) {
+        Node& node = treeNodes[nodeIndex];
+
+        if (depth >= kMaxDepth || node.halfSize <= kMinHalfSize) {
+            accumulateIntoLeaf(nodeIndex, particles, particleIndex);
+            deepestLevel = std::max(deepestLevel, depth);
+            return;
+        }
+
+        if (node.isLeaf() && node.particleIndex < 0) {
+            node.particleIndex = particleIndex;
+            node.particleCount = 1;
+            particleLeaf[particleIndex] = nodeIndex;
+            deepestLevel = std::max(deepestLevel, depth);
+            return;
+        }
+
+        if (node.isLeaf() && node.particleIndex == -2) {
+            accumulateIntoLeaf(nodeIndex, particles, particleIndex);
+            deepestLevel = std::max(deepestLevel, depth);
+            return;
+        }
+
+        if (node.isLeaf() && node.particleIndex >= 0) {
+            int existingParticle = node.particleIndex;
+            node.particleIndex = -1;
+            node.particleCount = 0;
+
+            Node nodeCopy = node;
+
+            for (int c = 0; c < Node::kChildCount; c++) {
+                std::array<float, Dim> childCenter;
+                float childHalfSize;
+                childBounds(nodeCopy, c, childCenter, childHalfSize);
+                int child = createNode(childCenter, childHalfSize);
+                treeNodes[nodeIndex].childIndex[c] = child;
+            }
+
+            int existingChild = treeNodes[nodeIndex].childIndex[selectChild(treeNodes[nodeIndex], particles, existingParticle)];
+            int newChild = treeNodes[nodeIndex].childIndex[selectChild(treeNodes[nodeIndex], particles, particleIndex)];
+
+            insertParticle(existingChild, particles, existingParticle, depth + 1);
+            nodeIndex = newChild;
+            depth = depth + 1;
+            continue;
+        }
+
+        nodeIndex = node.childIndex[selectChild(node, particles, particleIndex)];
+        depth = depth + 1;
+    }
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::computeMassProperties(int nodeIndex, const Particles<Dim>& particles, int& nextParticle) {
+    Node& node = treeNodes[nodeIndex];
+    node.firstParticle = nextParticle;
+
+    if (node.isLeaf()) {
+        nextParticle += node.particleCount;
+
+        if (node.particleIndex == -2) {
+            return;
+        }
+
+        if (node.particleIndex >= 0) {
+            int i = node.particleIndex;
+            node.totalMass = particles.mass[i];
+            for (int d = 0; d < Dim; d++) node.centerOfMass[d] = particles.position[d][i];
+        } else {
+            node.totalMass = 0.0f;
+            node.centerOfMass = node.center;
+        }
+        return;
+    }
+
+    float massSum = 0.0f;
+    std::array<float, Dim> weighted{};
+
+    const std::array<int, Node::kChildCount> children = node.childIndex;
+    for (int c : children) {
+        if (c < 0) continue;
+        computeMassProperties(c, particles, nextParticle);
+        const Node& child = treeNodes[c];
+        float m = child.totalMass;
+        massSum += m;
+        for (int d = 0; d < Dim; d++) weighted[d] += m * child.centerOfMass[d];
+    }
+
+    Node& parent = treeNodes[nodeIndex];
+    parent.particleCount = nextParticle - parent.firstParticle;
+    parent.totalMass = massSum;
+    if (massSum > 0.0f) {
+        for (int d = 0; d < Dim; d++) parent.centerOfMass[d] = weighted[d] / massSum;
+    } else {
+        parent.centerOfMass = parent.center;
+    }
+}
+
+// Nodes of a balanced subtree over count particles, f(c) = 1 for c <= bucketSize and
+// 1 + f(c / 2) + f(c - c / 2) above. Also returns f(count + 1): both only need the same
+// pair for count / 2, so this takes log2(count) calls.
+static void balancedNodeCounts(int count, int bucketSize, int& atCount, int& atNext) {
+    if (count + 1 <= bucketSize) {
+        atCount = 1;
+        atNext = 1;
+        return;
+    }
+    int half = 0;
+    int halfNext = 0;
+    balancedNodeCounts(count / 2, bucketSize, half, halfNext);
+    if (count % 2 == 0) {
+        atCount = count <= bucketSize ? 1 : 1 + 2 * half;
+        atNext = 1 + half + halfNext;
+    } else {
+        atCount = count <= bucketSize ? 1 : 1 + half + halfNext;
+        atNext = 1 + 2 * halfNext;
+    }
+}
+
+static int balancedNodeCount(int count, int bucketSize) {
+    int atCount = 0;
+    int atNext = 0;
+    balancedNodeCounts(count, bucketSize, atCount, atNext);
+    return atCount;
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::buildBalanced(const Particles<Dim>& particles, ThreadPool& pool, int bucketSize) {
+    const int count = (int)particles.count();
+    bucketCapacity = std::max(1, bucketSize);
+    treeNodes.assign(count > 0 ? (std::size_t)balancedNodeCount(count, bucketCapacity) : 0, Node());
+    orderedParticles.resize(particles.count());
+    particleLeaf.resize(particles.count());
+    deepestLevel = 0;
+    if (count == 0) return;
+    for (int largest = count; largest > bucketCapacity; largest -= largest / 2) deepestLevel++;
+    for (int i = 0; i < count; i++) orderedParticles[(std::size_t)i] = i;
+
+    // Node n with c members has its left child at n + 1 and its right one right after
+    // the left subtree, whose size only depends on c / 2. Every subtree thus owns a fixed
+    // slice of the node array and the tasks below never touch each other's nodes.
+    struct Pending {
+        int node;
+        int first;
+        int count;
+    };
+    // The top levels split one node per task until there are enough subtrees to keep
+    // every worker busy; each subtree is then finished by a single task.
+    const std::size_t subtreeTarget = 4 * (std::size_t)std::max(1u, pool.workerCount());
+    std::vector<Pending> frontier{ { 0, 0, count } };
+    std::vector<int> splitNodes;
+    while (frontier.size() < subtreeTarget && (std::size_t)count >= 2 * (std::size_t)bucketCapacity * subtreeTarget) {
+        std::vector<Pending> next(frontier.size() * 2);
+        pool.runTasks(frontier.size(), [&](std::size_t k) {
+            const Pending& item = frontier[k];
+            splitBalanced(item.node, item.first, item.count, particles, false);
+            const int leftCount = item.count / 2;
+            next[2 * k] = { item.node + 1, item.first, leftCount };
+            next[2 * k + 1] = { treeNodes[(std::size_t)item.node].childIndex[1], item.first + leftCount,
+                                item.count - leftCount };
+        });
+        for (const Pending& item : frontier) splitNodes.push_back(item.node);
+        frontier.swap(next);
+    }
+    pool.runTasks(frontier.size(), [&](std::size_t k) {
+        splitBalanced(frontier[k].node, frontier[k].first, frontier[k].count, particles, true);
+    });
+
+    // Parents were recorded before their children, so going backwards merges every node
+    // after both of its children are complete.
+    for (std::size_t k = splitNodes.size(); k-- > 0;) mergeChildren(splitNodes[k]);
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::splitBalanced(int nodeIndex, int first, int count, const Particles<Dim>& particles,
+                                       bool recurse) {
+    Node& node = treeNodes[(std::size_t)nodeIndex];
+    node.firstParticle = first;
+    node.particleCount = count;
+    node.skipIndex = nodeIndex + balancedNodeCount(count, bucketCapacity);
+
+    int* members = orderedParticles.data() + first;
+    std::array<float, Dim> lo;
+    std::array<float, Dim> hi;
+    for (int d = 0; d < Dim; d++) {
+        lo[d] = hi[d] = particles.position[d][(std::size_t)members[0]];
+        for (int k = 1; k < count; k++) {
+            const float x = particles.position[d][(std::size_t)members[k]];
+            lo[d] = std::min(lo[d], x);
+            hi[d] = std::max(hi[d], x);
+        }
+    }
+
+    int axis = 0;
+    for (int d = 0; d < Dim; d++) {
+        node.center[d] = 0.5f * (lo[d] + hi[d]);
+        if (hi[d] - lo[d] > hi[axis] - lo[axis]) axis = d;
+    }
+    node.halfSize = 0.5f * (hi[axis] - lo[axis]);
+
+    if (count <= bucketCapacity) {
+        node.particleIndex = count == 1 ? members[0] : -3;
+        float massSum = 0.0f;
+        std::array<float, Dim> weighted{};
+        for (int k = 0; k < count; k++) {
+            const std::size_t i = (std::size_t)members[k];
+            massSum += particles.mass[i];
+            for (int d = 0; d < Dim; d++) weighted[d] += particles.mass[i] * particles.position[d][i];
+            particleLeaf[i] = nodeIndex;
+        }
+        node.totalMass = massSum;
+        for (int d = 0; d < Dim; d++) node.centerOfMass[d] = massSum > 0.0f ? weighted[d] / massSum : node.center[d];
+        return;
+    }
+
+    const int leftCount = count / 2;
+    const AlignedVector<float>& key = particles.position[axis];
+    std::nth_element(members, members + leftCount, members + count,
+                     [&key](int a, int b) { return key[(std::size_t)a] < key[(std::size_t)b]; });
+    node.childIndex[0] = nodeIndex + 1;
+    node.childIndex[1] = nodeIndex + 1 + balancedNodeCount(leftCount, bucketCapacity);
+
+    if (!recurse) return;
+    splitBalanced(node.childIndex[0], first, leftCount, particles, true);
+    splitBalanced(node.childIndex[1], first + leftCount, count - leftCount, particles, true);
+    mergeChildren(nodeIndex);
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::mergeChildren(int nodeIndex) {
+    Node& node = treeNodes[(std::size_t)nodeIndex];
+    const Node& left = treeNodes[(std::size_t)node.childIndex[0]];
+    const Node& right = treeNodes[(std::size_t)node.childIndex[1]];
+    node.totalMass = left.totalMass + right.totalMass;
+    if (node.totalMass > 0.0f) {
+        for (int d = 0; d < Dim; d++) {
+            node.centerOfMass[d] =
+                (left.centerOfMass[d] * left.totalMass + right.centerOfMass[d] * right.totalMass) / node.totalMass;
+        }
+    } else {
+        node.centerOfMass = node.center;
+    }
+}
+
+template <int Dim>
+void BarnesHutTree<Dim>::refit(const Particles<Dim>& particles) {
+    // Children are always created after their parent, so walking the array backwards
+    // visits every child before it is merged into its parent.
+    for (std::size_t n = treeNodes.size(); n-- > 0;) {
+        Node& node = treeNodes[n];
+        if (node.particleCount == 0) continue;
+
+        float massSum = 0.0f;
+        std::array<float, Dim> weighted{};
+        std::array<float, Dim> lo{};
+        std::array<float, Dim> hi{};
+        bool first = true;
+        auto include = [&](const std::array<float, Dim>& boxLo, const std::array<float, Dim>& boxHi) {
+            for (int d = 0; d < Dim; d++) {
+                lo[d] = first ? boxLo[d] : std::min(lo[d], boxLo[d]);
+                hi[d] = first ? boxHi[d] : std::max(hi[d], boxHi[d]);
+            }
+            first = false;
+        };
+
+        if (node.isLeaf()) {
+            for (int k = 0; k < node.particleCount; k++) {
+                int i = orderedParticles[(std::size_t)(node.firstParticle + k)];
+                std::array<float, Dim> p;
+                for (int d = 0; d < Dim; d++) p[d] = particles.position[d][i];
+                massSum += particles.mass[i];
+                for (int d = 0; d < Dim; d++) weighted[d] += particles.mass[i] * p[d];
+                include(p, p);
+            }
+        } else {
+            for (int c : node.childIndex) {
+                if (c < 0) continue;
+                const Node& child = treeNodes[(std::size_t)c];
+                if (child.particleCount == 0) continue;
+                massSum += child.totalMass;
+                std::array<float, Dim> childLo;
+                std::array<float, Dim> childHi;
+                for (int d = 0; d < Dim; d++) {
+                    weighted[d] += child.totalMass * child.centerOfMass[d];
+                    childLo[d] = child.center[d] - child.halfSize;
+                    childHi[d] = child.center[d] + child.halfSize;
+                }
+                include(childLo, childHi);
+            }
+        }
+
+        // Smallest cube around the members' bounding box.
+        float halfSize = 0.0f;
+        for (int d = 0; d < Dim; d++) {
+            node.center[d] = 0.5f * (lo[d] + hi[d]);
+            halfSize = std::max(halfSize, 0.5f * (hi[d] - lo[d]));
+        }
+        node.halfSize = halfSize;
+        node.totalMass = massSum;
+        if (massSum > 0.0f) {
+            for (int d = 0; d < Dim; d++) node.centerOfMass[d] = weighted[d] / massSum;
+        } else {
+            node.centerOfMass = node.center;
+        }
+    }
+}
+
+template struct BarnesHutNode<2>;
+template struct BarnesHutNode<3>;
+template class BarnesHutTree<2>;
+template class BarnesHutTree<3>;
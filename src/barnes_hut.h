@@ -1,43 +1,127 @@
-#pragma once
-#include <vector>
-#include "particles.h"
-
-struct BarnesHutNode {
-    float centerX = 0.0f;
-    float centerY = 0.0f;
-    float halfSize = 0.0f;
-
-    float totalMass = 0.0f;
-    float centerOfMassX = 0.0f;
-    float centerOfMassY = 0.0f;
-
-    int childIndex0 = -1;
-    int childIndex1 = -1;
-    int childIndex2 = -1;
-    int childIndex3 = -1;
-
-    int particleIndex = -1;
-
-    bool isLeaf() const;
-};
-
-class BarnesHutTree {
-public:
-    void build(const Particles& particles);
-    const std::vector<BarnesHutNode>& nodes() const;
-
-private:
-    static constexpr int kMaxDepth = 20;
-    static constexpr float kMinHalfSize = 2.0f;
-
-    std::vector<BarnesHutNode> treeNodes;
-
-    int createNode(float cx, float cy, float halfSize);
-    void insertParticle(int nodeIndex, const Particles& particles, int particleIndex, int depth);
-    void computeMassProperties(int nodeIndex, const Particles& particles);
-
-    int selectQuadrant(const BarnesHutNode& node, float x, float y) const;
-    void childBounds(const BarnesHutNode& node, int quadrant, float& outCenterX, float& outCenterY, float& outHalfSize) const;
-
-    void accumulateIntoLeaf(int nodeIndex, const Particles& particles, int particleIndex);
-};
+#pragma once
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Builds configured with GRAVITY_TREE_STATS (the CMake option of the same name) take
+// TreeStatistics after every tree build and count the force walk's work; otherwise
+// both compile away.
+#if defined(GRAVITY_TREE_STATS)
+inline constexpr bool kCollectTreeStatistics = true;
+#else
+inline constexpr bool kCollectTreeStatistics = false;
+#endif
+
+// Shape of one tree build, for tuning the depth and size limits and theta.
+struct TreeStatistics {
+    std::size_t nodes = 0;
+    std::size_t leaves = 0;
+    std::size_t emptyLeaves = 0;
+    // Leaves at the depth/size limit, whose members act as one monopole.
+    std::size_t aggregatedLeaves = 0;
+    std::size_t aggregatedParticles = 0;
+    // Leaves of a balanced build holding more than one particle.
+    std::size_t bucketLeaves = 0;
+    // Indexed by level, the root being level 0. Particles are counted at their leaf.
+    std::vector<std::size_t> nodesPerDepth;
+    std::vector<std::size_t> particlesPerDepth;
+    // Node array in use against its allocated capacity.
+    std::size_t bytesUsed = 0;
+    std::size_t bytesReserved = 0;
+
+    double emptyLeafRatio() const { return leaves > 0 ? (double)emptyLeaves / (double)leaves : 0.0; }
+};
+
+// Quadtree node in 2D, octree node in 3D. Child k covers the orthant whose
+// bit d is set when the coordinate along axis d is >= center[d]. Nodes of a
+// balanced k-d build only use children 0 and 1, and their box is the smallest
+// cube around the members, so it need not tile the parent's.
+//
+// The tree is threaded for stackless walks: skipIndex is the node a depth-first walk
+// reaches after this subtree, the next sibling or, for a last child, wherever the
+// parent skips to. A walk is one loop that moves to childIndex[0] to open a node and
+// to skipIndex to accept or skip it. The balanced build stores nodes in depth-first
+// order, so its subtrees are the ranges [index, skipIndex).
+template <int Dim>
+struct BarnesHutNode {
+    static constexpr int kChildCount = 1 << Dim;
+
+    std::array<float, Dim> center{};
+    float halfSize = 0.0f;
+
+    float totalMass = 0.0f;
+    std::array<float, Dim> centerOfMass{};
+
+    std::array<int, kChildCount> childIndex;
+
+    // The particle of a single-particle leaf; -1 for empty leaves and inner nodes, -2 for
+    // leaves aggregated at the depth/size limit (one monopole) and -3 for the bucket
+    // leaves of a balanced build, whose members act one by one.
+    int particleIndex = -1;
+
+    // Members occupy particleOrder()[firstParticle, firstParticle + particleCount).
+    int firstParticle = 0;
+    int particleCount = 0;
+
+    // nodes().size() when no node follows the subtree.
+    int skipIndex = 0;
+
+    BarnesHutNode() { childIndex.fill(-1); }
+
+    bool isLeaf() const;
+};
+
+template <int Dim>
+class BarnesHutTree {
+public:
+    using Node = BarnesHutNode<Dim>;
+
+    void build(const Particles<Dim>& particles);
+    // Binary k-d tree instead: every node splits its members at the median along the
+    // widest axis of their bounding box, down to buckets of at most bucketSize. No node
+    // is empty and the depth stays about log2(N / bucketSize) however clustered the
+    // particles are. Subtrees are built in parallel on the pool.
+    void buildBalanced(const Particles<Dim>& particles, ThreadPool& pool, int bucketSize = 8);
+    const AlignedVector<Node>& nodes() const;
+    // Particle indices grouped by node in depth-first order, so every node's members
+    // form one contiguous range.
+    const std::vector<int>& particleOrder() const;
+    // Leaf node holding each particle.
+    const std::vector<int>& particleLeaves() const;
+    // Deepest level at which the last build placed a particle; the root is level 0.
+    int depth() const;
+    // One pass over the nodes of the last build; out keeps its vectors' storage.
+    void statistics(TreeStatistics& out) const;
+
+    // Recomputes masses, centres of mass and boxes from the current positions while
+    // keeping the structure and membership of the last build. Each non-empty node's box
+    // becomes the smallest cube around its members, so it no longer tiles its parent.
+    void refit(const Particles<Dim>& particles);
+
+private:
+    static constexpr int kMaxDepth = 20;
+    static constexpr float kMinHalfSize = 2.0f;
+
+    AlignedVector<Node> treeNodes;
+    std::vector<int> orderedParticles;
+    std::vector<int> particleLeaf;
+    int deepestLevel = 0;
+    int bucketCapacity = 8;
+
+    int createNode(const std::array<float, Dim>& center, float halfSize);
+    void insertParticle(int nodeIndex, const Particles<Dim>& particles, int particleIndex, int depth);
+    void computeMassProperties(int nodeIndex, const Particles<Dim>& particles, int& nextParticle);
+    void linkSkipIndices();
+
+    int selectChild(const Node& node, const Particles<Dim>& particles, int particleIndex) const;
+    void childBounds(const Node& node, int child, std::array<float, Dim>& outCenter, float& outHalfSize) const;
+
+    void accumulateIntoLeaf(int nodeIndex, const Particles<Dim>& particles, int particleIndex);
+
+    // Splits the members of one node of a balanced build and, with recurse set, builds
+    // its whole subtree including the mass properties.
+    void splitBalanced(int nodeIndex, int first, int count, const Particles<Dim>& particles, bool recurse);
+    void mergeChildren(int nodeIndex);
+};
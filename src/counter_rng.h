@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random Numbers:
+// As Easy as 1, 2, 3"). It has no sequential state: the same key and counter always
+// give the same four words, so any particle can draw its numbers independently.
+struct CounterRng {
+    uint32_t key0;
+    uint32_t key1;
+
+    explicit CounterRng(uint32_t seed, uint32_t stream = 0) : key0(seed), key1(stream ^ 0x9E3779B9u) {}
+
+    std::array<uint32_t, 4> block(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3) const {
+        uint32_t k0 = key0;
+        uint32_t k1 = key1;
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+            uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n1 = (uint32_t)p1;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            uint32_t n3 = (uint32_t)p0;
+            c0 = n0;
+            c1 = n1;
+            c2 = n2;
+            c3 = n3;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        return { c0, c1, c2, c3 };
+    }
+};
+
+// Sequential view over the blocks belonging to one item (e.g. one particle index):
+// counter = (index low, index high, block number, 0). Drawing order inside an item is
+// fixed, so results do not depend on which thread generates which item.
+struct CounterRngStream {
+    const CounterRng& rng;
+    uint64_t index;
+    uint32_t blockNumber = 0;
+    std::array<uint32_t, 4> words{};
+    int wordsLeft = 0;
+
+    CounterRngStream(const CounterRng& generator, uint64_t itemIndex) : rng(generator), index(itemIndex) {}
+
+    uint32_t nextU32() {
+        if (wordsLeft == 0) {
+            words = rng.block((uint32_t)index, (uint32_t)(index >> 32), blockNumber++, 0u);
+            wordsLeft = 4;
+        }
+        return words[4 - wordsLeft--];
+    }
+    float nextFloat01() {
+        return (nextU32() >> 8) * (1.0f / 16777216.0f);
+    }
+    float range(float a, float b) {
+        return a + (b - a) * nextFloat01();
+    }
+};
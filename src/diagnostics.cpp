@@ -0,0 +1,72 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+static constexpr std::size_t kReductionBlock = 4096;
+
+struct PartialSums {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    std::array<double, 3> momentum{};
+    std::array<double, 3> angularMomentum{};
+};
+
+template <int Dim>
+ConservationDiagnostics measureConservation(const Particles<Dim>& particles,
+                                            const AlignedVector<float>& potential,
+                                            ThreadPool& pool) {
+    const std::size_t n = particles.count();
+    const std::size_t blockCount = (n + kReductionBlock - 1) / kReductionBlock;
+    std::vector<PartialSums> partials(blockCount);
+
+    pool.parallelFor(0, n, kReductionBlock, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin / kReductionBlock; b * kReductionBlock < end; b++) {
+            PartialSums sums;
+            std::size_t last = std::min(n, (b + 1) * kReductionBlock);
+            for (std::size_t i = b * kReductionBlock; i < last; i++) {
+                double m = particles.mass[i];
+                std::array<double, 3> x{};
+                std::array<double, 3> v{};
+                double v2 = 0.0;
+                for (int d = 0; d < Dim; d++) {
+                    x[d] = particles.position[d][i];
+                    v[d] = particles.velocity[d][i];
+                    v2 += v[d] * v[d];
+                    sums.momentum[d] += m * v[d];
+                }
+                sums.kinetic += 0.5 * m * v2;
+                sums.potential += 0.5 * m * (double)potential[i];
+
+                sums.angularMomentum[0] += m * (x[1] * v[2] - x[2] * v[1]);
+                sums.angularMomentum[1] += m * (x[2] * v[0] - x[0] * v[2]);
+                sums.angularMomentum[2] += m * (x[0] * v[1] - x[1] * v[0]);
+            }
+            partials[b] = sums;
+        }
+    });
+
+    ConservationDiagnostics result;
+    for (const PartialSums& sums : partials) {
+        result.kineticEnergy += sums.kinetic;
+        result.potentialEnergy += sums.potential;
+        for (int k = 0; k < 3; k++) {
+            result.momentum[k] += sums.momentum[k];
+            result.angularMomentum[k] += sums.angularMomentum[k];
+        }
+    }
+    result.totalEnergy = result.kineticEnergy + result.potentialEnergy;
+    return result;
+}
+
+void printDiagnostics(const ConservationDiagnostics& diagnostics) {
+    std::printf("step=%" PRIu64 " E=%.6e K=%.6e U=%.6e dE/E0=%+.3e P=(%.4e, %.4e, %.4e) L=(%.4e, %.4e, %.4e)\n",
+                diagnostics.step, diagnostics.totalEnergy, diagnostics.kineticEnergy, diagnostics.potentialEnergy,
+                diagnostics.relativeEnergyDrift,
+                diagnostics.momentum[0], diagnostics.momentum[1], diagnostics.momentum[2],
+                diagnostics.angularMomentum[0], diagnostics.angularMomentum[1], diagnostics.angularMomentum[2]);
+    std::fflush(stdout);
+}
+
+template ConservationDiagnostics measureConservation<2>(const Particles<2>&, const AlignedVector<float>&, ThreadPool&);
+template ConservationDiagnostics measureConservation<3>(const Particles<3>&, const AlignedVector<float>&, ThreadPool&);
@@ -0,0 +1,28 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Conserved quantities of one particle state. In 2D only the z component of the
+// angular momentum is populated; momentum uses the first Dim components.
+struct ConservationDiagnostics {
+    uint64_t step = 0;
+    double kineticEnergy = 0.0;
+    double potentialEnergy = 0.0;
+    double totalEnergy = 0.0;
+    double relativeEnergyDrift = 0.0;
+    std::array<double, 3> momentum{};
+    std::array<double, 3> angularMomentum{};
+};
+
+// `potential` holds each particle's specific potential from the tree walk at the same
+// positions. Partial sums are taken over fixed blocks and combined in index order, so
+// the totals are identical for any worker count.
+template <int Dim>
+ConservationDiagnostics measureConservation(const Particles<Dim>& particles,
+                                            const AlignedVector<float>& potential,
+                                            ThreadPool& pool);
+
+void printDiagnostics(const ConservationDiagnostics& diagnostics);
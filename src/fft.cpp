@@ -0,0 +1,109 @@
+#include "fft.h"
+#include <cmath>
+#include <utility>
+
+static const double kTwoPi = 6.283185307179586;
+
+void Fft::init(std::size_t n) {
+    if (n == length) return;
+    length = n;
+
+    int bits = 0;
+    while (((std::size_t)1 << bits) < n) bits++;
+
+    bitReverse.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        std::size_t r = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & ((std::size_t)1 << b)) r |= (std::size_t)1 << (bits - 1 - b);
+        }
+        bitReverse[i] = r;
+    }
+
+    // Twiddles are computed in double so long transforms do not accumulate phase error.
+    twiddles.resize(n / 2);
+    for (std::size_t k = 0; k < n / 2; k++) {
+        double angle = -kTwoPi * (double)k / (double)n;
+        twiddles[k] = std::complex<float>((float)std::cos(angle), (float)std::sin(angle));
+    }
+}
+
+std::size_t Fft::size() const {
+    return length;
+}
+
+void Fft::transform(std::complex<float>* data, bool inverse) const {
+    const std::size_t n = length;
+    for (std::size_t i = 0; i < n; i++) {
+        std::size_t j = bitReverse[i];
+        if (i < j) std::swap(data[i], data[j]);
+    }
+
+    for (std::size_t span = 1; span < n; span *= 2) {
+        const std::size_t step = n / (2 * span);
+        for (std::size_t start = 0; start < n; start += 2 * span) {
+            for (std::size_t k = 0; k < span; k++) {
+                std::complex<float> w = twiddles[k * step];
+                if (inverse) w = std::conj(w);
+                std::complex<float> a = data[start + k];
+                std::complex<float> b = data[start + k + span] * w;
+                data[start + k] = a + b;
+                data[start + k + span] = a - b;
+            }
+        }
+    }
+}
+
+void RealFft::init(std::size_t n) {
+    if (n == length) return;
+    length = n;
+    half.init(n / 2);
+
+    twiddles.resize(n / 2 + 1);
+    for (std::size_t k = 0; k <= n / 2; k++) {
+        double angle = -kTwoPi * (double)k / (double)n;
+        twiddles[k] = std::complex<float>((float)std::cos(angle), (float)std::sin(angle));
+    }
+}
+
+std::size_t RealFft::size() const {
+    return length;
+}
+
+void RealFft::forward(const float* input, std::complex<float>* output, std::complex<float>* scratch) const {
+    const std::size_t m = length / 2;
+    for (std::size_t k = 0; k < m; k++) scratch[k] = std::complex<float>(input[2 * k], input[2 * k + 1]);
+    half.transform(scratch, false);
+
+    // Split Z into the spectra of the even (E) and odd (O) samples:
+    // X[k] = E[k] + W^k O[k], E[k] = (Z[k] + conj(Z[m-k])) / 2, O[k] = (Z[k] - conj(Z[m-k])) / 2i.
+    const std::complex<float> minusHalfI(0.0f, -0.5f);
+    for (std::size_t k = 0; k <= m; k++) {
+        std::complex<float> z = scratch[k % m];
+        std::complex<float> zMirror = std::conj(scratch[(m - k) % m]);
+        std::complex<float> even = 0.5f * (z + zMirror);
+        std::complex<float> odd = minusHalfI * (z - zMirror);
+        output[k] = even + twiddles[k] * odd;
+    }
+}
+
+void RealFft::inverse(const std::complex<float>* input, float* output, std::complex<float>* scratch) const {
+    const std::size_t m = length / 2;
+
+    // Rebuild Z[k] = E[k] + i O[k] from X, scaled so the half-length inverse returns
+    // n times the signal, the same as an unnormalized inverse of full length.
+    const std::complex<float> i(0.0f, 1.0f);
+    for (std::size_t k = 0; k < m; k++) {
+        std::complex<float> x = input[k];
+        std::complex<float> xMirror = std::conj(input[m - k]);
+        std::complex<float> even = x + xMirror;
+        std::complex<float> odd = (x - xMirror) * std::conj(twiddles[k]);
+        scratch[k] = even + i * odd;
+    }
+    half.transform(scratch, true);
+
+    for (std::size_t k = 0; k < m; k++) {
+        output[2 * k] = scratch[k].real();
+        output[2 * k + 1] = scratch[k].imag();
+    }
+}
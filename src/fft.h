@@ -0,0 +1,38 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+// In-place radix-2 complex FFT for one power-of-two length. The inverse is not
+// normalized (forward then inverse multiplies by the length).
+class Fft {
+public:
+    void init(std::size_t length);
+    std::size_t size() const;
+
+    void transform(std::complex<float>* data, bool inverse) const;
+
+private:
+    std::size_t length = 0;
+    std::vector<std::size_t> bitReverse;
+    std::vector<std::complex<float>> twiddles;
+};
+
+// Real-to-complex transform of even power-of-two length n through one complex FFT of
+// length n/2 (even samples as real parts, odd samples as imaginary parts). The forward
+// transform writes the n/2 + 1 non-redundant coefficients; the inverse reads them back
+// and, like Fft, is not normalized.
+class RealFft {
+public:
+    void init(std::size_t length);
+    std::size_t size() const;
+
+    // scratch must hold n/2 values.
+    void forward(const float* input, std::complex<float>* output, std::complex<float>* scratch) const;
+    void inverse(const std::complex<float>* input, float* output, std::complex<float>* scratch) const;
+
+private:
+    std::size_t length = 0;
+    Fft half;
+    std::vector<std::complex<float>> twiddles;
+};
@@ -0,0 +1,73 @@
+#include "frame_writer.h"
+
+#if defined(_WIN32)
+#define popen _popen
+#define pclose _pclose
+static const char* kPipeMode = "wb";
+#else
+static const char* kPipeMode = "w";
+#endif
+
+FrameWriter::~FrameWriter() {
+    close();
+}
+
+bool FrameWriter::open(const std::string& directory, const std::string& pipeCommand, int width, int height) {
+    close();
+    outputDirectory = directory;
+    frameWidth = width;
+    frameHeight = height;
+    frameIndex = 0;
+
+    if (!pipeCommand.empty()) {
+        pipe = popen(pipeCommand.c_str(), kPipeMode);
+        if (!pipe) {
+            std::fprintf(stderr, "frames: cannot start '%s'\n", pipeCommand.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameWriter::write(const std::vector<uint8_t>& rgb) {
+    const std::size_t bytes = (std::size_t)frameWidth * (std::size_t)frameHeight * 3;
+    if (rgb.size() < bytes) return false;
+
+    if (pipe) {
+        if (std::fwrite(rgb.data(), 1, bytes, pipe) != bytes) {
+            std::fprintf(stderr, "frames: pipe closed after %d frames\n", frameIndex);
+            return false;
+        }
+    } else {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%06d.ppm", frameIndex);
+        std::string path = outputDirectory + "/" + name;
+
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            std::fprintf(stderr, "frames: cannot write %s\n", path.c_str());
+            return false;
+        }
+        std::fprintf(file, "P6\n%d %d\n255\n", frameWidth, frameHeight);
+        bool ok = std::fwrite(rgb.data(), 1, bytes, file) == bytes;
+        ok = (std::fclose(file) == 0) && ok;
+        if (!ok) {
+            std::fprintf(stderr, "frames: short write to %s\n", path.c_str());
+            return false;
+        }
+    }
+
+    frameIndex++;
+    return true;
+}
+
+void FrameWriter::close() {
+    if (pipe) {
+        pclose(pipe);
+        pipe = nullptr;
+    }
+}
+
+int FrameWriter::framesWritten() const {
+    return frameIndex;
+}
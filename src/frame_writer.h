@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Sends rendered RGB frames either to numbered binary PPM files in a directory or, as
+// raw rgb24, to the stdin of a shell command (e.g. ffmpeg -f rawvideo ... -i -).
+class FrameWriter {
+public:
+    FrameWriter() = default;
+    ~FrameWriter();
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    bool open(const std::string& directory, const std::string& pipeCommand, int width, int height);
+    bool write(const std::vector<uint8_t>& rgb);
+    void close();
+
+    int framesWritten() const;
+
+private:
+    std::string outputDirectory;
+    std::FILE* pipe = nullptr;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    int frameIndex = 0;
+};
@@ -0,0 +1,406 @@
+#include "gravity_api.h"
+#include "gravity_simulation.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Dimension-erased view of GravitySimulation<Dim>, so the C handle does not have to
+// carry the template parameter.
+struct gravity_simulation {
+    std::atomic<bool> busy{ false };
+    // Lets gravity_destroy sleep until a background step releases the handle.
+    std::mutex idleMutex;
+    std::condition_variable idleSignal;
+
+    virtual ~gravity_simulation() = default;
+    virtual int dimensions() const = 0;
+    virtual void reset() = 0;
+    virtual void step(double dt, int steps) = 0;
+    virtual SimulationParams& params() = 0;
+    virtual const SimulationParams& params() const = 0;
+    virtual std::size_t particleCount() const = 0;
+    virtual std::size_t liveParticleCount() const = 0;
+    virtual uint64_t stepCount() const = 0;
+    virtual uint64_t stateHash() = 0;
+    virtual const float* positions(int axis) const = 0;
+    virtual const float* velocities(int axis) const = 0;
+    virtual const float* masses() const = 0;
+    virtual const uint64_t* ids() const = 0;
+    virtual const uint8_t* flags() const = 0;
+    virtual void load(std::size_t count, const float* const* positions, const float* const* velocities,
+                      const float* masses, bool append) = 0;
+    virtual bool loadFile(const char* path) = 0;
+    virtual void spawn(std::size_t count, const float* const* positions, const float* const* velocities,
+                       const float* masses, uint64_t* outIds) = 0;
+    virtual std::size_t despawn(std::size_t count, const uint64_t* ids) = 0;
+};
+
+template <int Dim>
+struct SimulationHandle final : gravity_simulation {
+    GravitySimulation<Dim> simulation;
+
+    SimulationHandle(unsigned int workerThreads, int particleCount, uint32_t seed, GalaxyPreset preset)
+        : simulation(workerThreads, particleCount, seed, preset) {}
+
+    int dimensions() const override { return Dim; }
+    void reset() override { simulation.reset(); }
+    void step(double dt, int steps) override {
+        for (int s = 0; s < steps; s++) simulation.stepFixed(dt);
+    }
+    SimulationParams& params() override { return simulation.params(); }
+    const SimulationParams& params() const override { return simulation.params(); }
+    std::size_t particleCount() const override { return simulation.particles().count(); }
+    std::size_t liveParticleCount() const override { return simulation.liveParticleCount(); }
+    uint64_t stepCount() const override { return simulation.stepCount(); }
+    uint64_t stateHash() override { return simulation.computeStateHash(); }
+    const float* positions(int axis) const override { return simulation.particles().position[axis].data(); }
+    const float* velocities(int axis) const override { return simulation.particles().velocity[axis].data(); }
+    const float* masses() const override { return simulation.particles().mass.data(); }
+    const uint64_t* ids() const override { return simulation.particles().id.data(); }
+    const uint8_t* flags() const override { return simulation.particles().flags.data(); }
+
+    void load(std::size_t count, const float* const* positions, const float* const* velocities,
+              const float* masses, bool append) override {
+        Particles<Dim> incoming;
+        incoming.resize(count);
+        for (int d = 0; d < Dim; d++) {
+            std::copy(positions[d], positions[d] + count, incoming.position[d].begin());
+            std::copy(velocities[d], velocities[d] + count, incoming.velocity[d].begin());
+        }
+        std::copy(masses, masses + count, incoming.mass.begin());
+
+        if (append) simulation.appendParticles(incoming);
+        else simulation.loadParticles(incoming);
+    }
+
+    bool loadFile(const char* path) override { return simulation.loadParticlesFromFile(path); }
+
+    void spawn(std::size_t count, const float* const* positions, const float* const* velocities,
+               const float* masses, uint64_t* outIds) override {
+        for (std::size_t i = 0; i < count; i++) {
+            std::array<float, Dim> p;
+            std::array<float, Dim> v;
+            for (int d = 0; d < Dim; d++) {
+                p[d] = positions[d][i];
+                v[d] = velocities[d][i];
+            }
+            const uint64_t id = simulation.spawnParticle(p, v, masses[i]);
+            if (outIds) outIds[i] = id;
+        }
+    }
+
+    std::size_t despawn(std::size_t count, const uint64_t* ids) override {
+        std::size_t removed = 0;
+        for (std::size_t i = 0; i < count; i++) {
+            if (simulation.despawnParticle(ids[i])) removed++;
+        }
+        return removed;
+    }
+};
+
+struct gravity_step_handle {
+    gravity_simulation* simulation = nullptr;
+    std::thread worker;
+    std::atomic<bool> done{ false };
+    gravity_status status = GRAVITY_OK;
+};
+
+// Claims the handle for one call; fails instead of blocking when a background step owns it.
+static bool acquire(gravity_simulation* simulation) {
+    bool expected = false;
+    return simulation->busy.compare_exchange_strong(expected, true, std::memory_order_acquire);
+}
+
+// Notifies while still holding the mutex: gravity_destroy cannot see the handle idle,
+// and delete it, before this call is done with the condition variable.
+static void release(gravity_simulation* simulation) {
+    std::lock_guard<std::mutex> lock(simulation->idleMutex);
+    simulation->busy.store(false, std::memory_order_release);
+    simulation->idleSignal.notify_all();
+}
+
+static bool isIdle(const gravity_simulation* simulation) {
+    return simulation && !simulation->busy.load(std::memory_order_acquire);
+}
+
+template <typename Fn>
+static gravity_status guarded(gravity_simulation* simulation, Fn&& fn) {
+    if (!simulation) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!acquire(simulation)) return GRAVITY_ERROR_BUSY;
+    gravity_status status = GRAVITY_OK;
+    try {
+        status = fn();
+    } catch (const std::exception&) {
+        status = GRAVITY_ERROR_INTERNAL;
+    }
+    release(simulation);
+    return status;
+}
+
+static bool validColumns(const gravity_simulation* simulation, size_t count, const float* const* positions,
+                         const float* const* velocities, const float* masses) {
+    if (!simulation) return false;
+    if (count == 0) return true;
+    if (!positions || !velocities || !masses) return false;
+    for (int d = 0; d < simulation->dimensions(); d++) {
+        if (!positions[d] || !velocities[d]) return false;
+    }
+    return true;
+}
+
+static gravity_status loadParticles(gravity_simulation* simulation, size_t count,
+                                    const float* const* positions, const float* const* velocities,
+                                    const float* masses, bool append) {
+    if (!validColumns(simulation, count, positions, velocities, masses)) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!append && count == 0) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    return guarded(simulation, [&] {
+        simulation->load(count, positions, velocities, masses, append);
+        return GRAVITY_OK;
+    });
+}
+
+extern "C" {
+
+int gravity_api_version(void) {
+    return GRAVITY_API_VERSION;
+}
+
+gravity_simulation* gravity_create(int dimensions, unsigned int worker_threads,
+                                   int particle_count, uint32_t seed, const char* preset) {
+    GalaxyPreset galaxyPreset = GalaxyPreset::Disc;
+    if (preset && !parseGalaxyPreset(preset, galaxyPreset)) return nullptr;
+    if (worker_threads == 0) worker_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    try {
+        if (dimensions == 2) return new SimulationHandle<2>(worker_threads, particle_count, seed, galaxyPreset);
+        if (dimensions == 3) return new SimulationHandle<3>(worker_threads, particle_count, seed, galaxyPreset);
+    } catch (const std::exception&) {
+    }
+    return nullptr;
+}
+
+void gravity_destroy(gravity_simulation* simulation) {
+    if (!simulation) return;
+    // A background step releases the handle as its last access to it, so once the claim
+    // succeeds nothing else touches the simulation.
+    {
+        std::unique_lock<std::mutex> lock(simulation->idleMutex);
+        simulation->idleSignal.wait(lock, [&] { return acquire(simulation); });
+    }
+    delete simulation;
+}
+
+gravity_status gravity_reset(gravity_simulation* simulation) {
+    return guarded(simulation, [&] {
+        simulation->reset();
+        return GRAVITY_OK;
+    });
+}
+
+gravity_status gravity_step(gravity_simulation* simulation, double dt, int steps) {
+    if (!(dt > 0.0) || steps < 0) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    return guarded(simulation, [&] {
+        simulation->step(dt, steps);
+        return GRAVITY_OK;
+    });
+}
+
+gravity_status gravity_get_params(const gravity_simulation* simulation, gravity_params* out_params) {
+    if (!out_params) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!simulation) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!isIdle(simulation)) return GRAVITY_ERROR_BUSY;
+
+    const SimulationParams& p = simulation->params();
+    out_params->gravitational_constant = p.gravitationalConstant;
+    out_params->softening_length = p.softeningLength;
+    out_params->fixed_time_step = p.fixedTimeStep;
+    out_params->barnes_hut_theta = p.barnesHutTheta;
+    out_params->opening_criterion = p.openingCriterion == OpeningCriterion::RelativeAcceleration
+        ? GRAVITY_OPENING_RELATIVE_ACCELERATION : GRAVITY_OPENING_GEOMETRIC;
+    out_params->relative_force_accuracy = p.relativeForceAccuracy;
+    out_params->velocity_clamp = p.velocityClamp;
+    out_params->diagnostics_interval = p.diagnosticsInterval;
+    return GRAVITY_OK;
+}
+
+gravity_status gravity_set_params(gravity_simulation* simulation, const gravity_params* params) {
+    if (!params) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (params->opening_criterion != GRAVITY_OPENING_GEOMETRIC &&
+        params->opening_criterion != GRAVITY_OPENING_RELATIVE_ACCELERATION) {
+        return GRAVITY_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded(simulation, [&] {
+        SimulationParams& p = simulation->params();
+        p.gravitationalConstant = params->gravitational_constant;
+        p.softeningLength = params->softening_length;
+        p.fixedTimeStep = params->fixed_time_step;
+        p.barnesHutTheta = params->barnes_hut_theta;
+        p.openingCriterion = params->opening_criterion == GRAVITY_OPENING_RELATIVE_ACCELERATION
+            ? OpeningCriterion::RelativeAcceleration : OpeningCriterion::Geometric;
+        p.relativeForceAccuracy = params->relative_force_accuracy;
+        p.velocityClamp = params->velocity_clamp;
+        p.diagnosticsInterval = params->diagnostics_interval;
+        return GRAVITY_OK;
+    });
+}
+
+gravity_status gravity_get_integrator(const gravity_simulation* simulation, gravity_integrator* out_integrator) {
+    if (!out_integrator) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!simulation) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (!isIdle(simulation)) return GRAVITY_ERROR_BUSY;
+    *out_integrator = (gravity_integrator)simulation->params().integrator;
+    return GRAVITY_OK;
+}
+
+gravity_status gravity_set_integrator(gravity_simulation* simulation, gravity_integrator integrator) {
+    if (integrator < GRAVITY_INTEGRATOR_SYMPLECTIC_EULER || integrator > GRAVITY_INTEGRATOR_FOREST_RUTH) {
+        return GRAVITY_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded(simulation, [&] {
+        simulation->params().integrator = (Integrator)integrator;
+        return GRAVITY_OK;
+    });
+}
+
+gravity_status gravity_load_particles(gravity_simulation* simulation, size_t count,
+                                      const float* const* positions, const float* const* velocities,
+                                      const float* masses) {
+    return loadParticles(simulation, count, positions, velocities, masses, false);
+}
+
+gravity_status gravity_inject_particles(gravity_simulation* simulation, size_t count,
+                                        const float* const* positions, const float* const* velocities,
+                                        const float* masses) {
+    return loadParticles(simulation, count, positions, velocities, masses, true);
+}
+
+gravity_status gravity_load_particles_file(gravity_simulation* simulation, const char* path) {
+    if (!path) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    return guarded(simulation, [&] {
+        return simulation->loadFile(path) ? GRAVITY_OK : GRAVITY_ERROR_INVALID_ARGUMENT;
+    });
+}
+
+gravity_status gravity_spawn_particles(gravity_simulation* simulation, size_t count,
+                                       const float* const* positions, const float* const* velocities,
+                                       const float* masses, uint64_t* out_ids) {
+    if (!validColumns(simulation, count, positions, velocities, masses)) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    return guarded(simulation, [&] {
+        simulation->spawn(count, positions, velocities, masses, out_ids);
+        return GRAVITY_OK;
+    });
+}
+
+gravity_status gravity_despawn_particles(gravity_simulation* simulation, size_t count, const uint64_t* ids,
+                                         size_t* out_removed) {
+    if (out_removed) *out_removed = 0;
+    if (count > 0 && !ids) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    return guarded(simulation, [&] {
+        const size_t removed = simulation->despawn(count, ids);
+        if (out_removed) *out_removed = removed;
+        return GRAVITY_OK;
+    });
+}
+
+int gravity_dimensions(const gravity_simulation* simulation) {
+    return simulation ? simulation->dimensions() : 0;
+}
+
+size_t gravity_particle_count(const gravity_simulation* simulation) {
+    return isIdle(simulation) ? simulation->particleCount() : 0;
+}
+
+size_t gravity_live_particle_count(const gravity_simulation* simulation) {
+    return isIdle(simulation) ? simulation->liveParticleCount() : 0;
+}
+
+uint64_t gravity_step_count(const gravity_simulation* simulation) {
+    return isIdle(simulation) ? simulation->stepCount() : 0;
+}
+
+uint64_t gravity_state_hash(gravity_simulation* simulation) {
+    uint64_t hash = 0;
+    guarded(simulation, [&] {
+        hash = simulation->stateHash();
+        return GRAVITY_OK;
+    });
+    return hash;
+}
+
+const float* gravity_positions(const gravity_simulation* simulation, int axis, size_t* out_length) {
+    if (out_length) *out_length = 0;
+    if (!isIdle(simulation) || axis < 0 || axis >= simulation->dimensions()) return nullptr;
+    if (out_length) *out_length = simulation->particleCount();
+    return simulation->positions(axis);
+}
+
+const float* gravity_velocities(const gravity_simulation* simulation, int axis, size_t* out_length) {
+    if (out_length) *out_length = 0;
+    if (!isIdle(simulation) || axis < 0 || axis >= simulation->dimensions()) return nullptr;
+    if (out_length) *out_length = simulation->particleCount();
+    return simulation->velocities(axis);
+}
+
+const float* gravity_masses(const gravity_simulation* simulation, size_t* out_length) {
+    if (out_length) *out_length = 0;
+    if (!isIdle(simulation)) return nullptr;
+    if (out_length) *out_length = simulation->particleCount();
+    return simulation->masses();
+}
+
+const uint64_t* gravity_ids(const gravity_simulation* simulation, size_t* out_length) {
+    if (out_length) *out_length = 0;
+    if (!isIdle(simulation)) return nullptr;
+    if (out_length) *out_length = simulation->particleCount();
+    return simulation->ids();
+}
+
+const uint8_t* gravity_flags(const gravity_simulation* simulation, size_t* out_length) {
+    if (out_length) *out_length = 0;
+    if (!isIdle(simulation)) return nullptr;
+    if (out_length) *out_length = simulation->particleCount();
+    return simulation->flags();
+}
+
+gravity_step_handle* gravity_step_async(gravity_simulation* simulation, double dt, int steps) {
+    if (!simulation || !(dt > 0.0) || steps < 0) return nullptr;
+    if (!acquire(simulation)) return nullptr;
+
+    gravity_step_handle* handle = nullptr;
+    try {
+        handle = new gravity_step_handle();
+        handle->simulation = simulation;
+        handle->worker = std::thread([handle, dt, steps] {
+            try {
+                handle->simulation->step(dt, steps);
+            } catch (const std::exception&) {
+                handle->status = GRAVITY_ERROR_INTERNAL;
+            }
+            release(handle->simulation);
+            handle->done.store(true, std::memory_order_release);
+        });
+    } catch (const std::exception&) {
+        delete handle;
+        release(simulation);
+        return nullptr;
+    }
+    return handle;
+}
+
+int gravity_step_poll(const gravity_step_handle* handle) {
+    return (handle && handle->done.load(std::memory_order_acquire)) ? 1 : 0;
+}
+
+gravity_status gravity_step_wait(gravity_step_handle* handle) {
+    if (!handle) return GRAVITY_ERROR_INVALID_ARGUMENT;
+    if (handle->worker.joinable()) handle->worker.join();
+    gravity_status status = handle->status;
+    delete handle;
+    return status;
+}
+
+}
@@ -0,0 +1,146 @@
+#ifndef GRAVITY_API_H
+#define GRAVITY_API_H
+
+/*
+ * C interface of libgravity. A simulation is an opaque handle; particle data is exposed
+ * as read-only pointers into the solver's own SoA columns, so hosts can read positions
+ * without copying. Column pointers stay valid until the next call that steps, resets,
+ * loads, spawns or despawns particles on the same handle.
+ *
+ * A handle may be used from any thread, but not from two threads at once. While an
+ * asynchronous step is in flight, every other call on that handle returns
+ * GRAVITY_ERROR_BUSY (or NULL / 0 for the accessors), except gravity_destroy, which
+ * waits for the step.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+  #if defined(GRAVITY_API_BUILD)
+    #define GRAVITY_API __declspec(dllexport)
+  #else
+    #define GRAVITY_API __declspec(dllimport)
+  #endif
+#else
+  #define GRAVITY_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GRAVITY_API_VERSION 3
+
+typedef struct gravity_simulation gravity_simulation;
+typedef struct gravity_step_handle gravity_step_handle;
+
+typedef enum gravity_status {
+    GRAVITY_OK = 0,
+    GRAVITY_ERROR_INVALID_ARGUMENT = 1,
+    GRAVITY_ERROR_BUSY = 2,
+    GRAVITY_ERROR_INTERNAL = 3
+} gravity_status;
+
+typedef enum gravity_integrator {
+    GRAVITY_INTEGRATOR_SYMPLECTIC_EULER = 0,
+    GRAVITY_INTEGRATOR_LEAPFROG = 1,
+    GRAVITY_INTEGRATOR_FOREST_RUTH = 2
+} gravity_integrator;
+
+typedef enum gravity_opening_criterion {
+    GRAVITY_OPENING_GEOMETRIC = 0,
+    GRAVITY_OPENING_RELATIVE_ACCELERATION = 1
+} gravity_opening_criterion;
+
+/* Bits of the gravity_flags column. */
+#define GRAVITY_PARTICLE_CENTRAL_BODY 1u
+#define GRAVITY_PARTICLE_REMOVED 2u
+
+/* Mirrors SimulationParams. The layout is frozen at version 2 so hosts built against
+ * older headers keep working; later settings get accessors of their own. */
+typedef struct gravity_params {
+    float gravitational_constant;
+    float softening_length;
+    float fixed_time_step;
+    float barnes_hut_theta;
+    int opening_criterion;
+    float relative_force_accuracy;
+    float velocity_clamp;
+    int diagnostics_interval;
+} gravity_params;
+
+GRAVITY_API int gravity_api_version(void);
+
+/* dimensions is 2 or 3; preset is "disc", "bulge", "ring", "merger" or NULL for "disc". */
+GRAVITY_API gravity_simulation* gravity_create(int dimensions, unsigned int worker_threads,
+                                               int particle_count, uint32_t seed, const char* preset);
+/* Blocks until an asynchronous step in flight on the handle has finished, then frees it.
+ * The step handle stays valid and must still be passed to gravity_step_wait. */
+GRAVITY_API void gravity_destroy(gravity_simulation* simulation);
+
+GRAVITY_API gravity_status gravity_reset(gravity_simulation* simulation);
+GRAVITY_API gravity_status gravity_step(gravity_simulation* simulation, double dt, int steps);
+
+GRAVITY_API gravity_status gravity_get_params(const gravity_simulation* simulation, gravity_params* out_params);
+GRAVITY_API gravity_status gravity_set_params(gravity_simulation* simulation, const gravity_params* params);
+
+/* Since version 3. */
+GRAVITY_API gravity_status gravity_get_integrator(const gravity_simulation* simulation,
+                                                  gravity_integrator* out_integrator);
+GRAVITY_API gravity_status gravity_set_integrator(gravity_simulation* simulation, gravity_integrator integrator);
+
+/* positions and velocities point to `dimensions` arrays of `count` floats each (SoA).
+ * load replaces all particles; inject appends to the running simulation. */
+GRAVITY_API gravity_status gravity_load_particles(gravity_simulation* simulation, size_t count,
+                                                  const float* const* positions,
+                                                  const float* const* velocities,
+                                                  const float* masses);
+GRAVITY_API gravity_status gravity_inject_particles(gravity_simulation* simulation, size_t count,
+                                                    const float* const* positions,
+                                                    const float* const* velocities,
+                                                    const float* masses);
+
+/* Replaces all particles with the contents of a file: CSV/whitespace text with one
+ * "x y [z] vx vy [vz] m" row per body, or the binary column layout described in
+ * src/particle_import.h. Large files are memory-mapped and parsed in parallel. */
+GRAVITY_API gravity_status gravity_load_particles_file(gravity_simulation* simulation, const char* path);
+
+/* Adds bodies between steps without rebuilding anything until the next step, refilling
+ * slots of despawned bodies first. out_ids (may be NULL) receives `count` stable IDs;
+ * an ID keeps naming its body when later compactions move it to another index. */
+GRAVITY_API gravity_status gravity_spawn_particles(gravity_simulation* simulation, size_t count,
+                                                   const float* const* positions,
+                                                   const float* const* velocities,
+                                                   const float* masses, uint64_t* out_ids);
+/* Removes bodies by ID. Unknown or already removed IDs are skipped; out_removed (may be
+ * NULL) receives how many were removed. A removed body keeps its slot, massless and
+ * flagged GRAVITY_PARTICLE_REMOVED, until a later step compacts the columns. */
+GRAVITY_API gravity_status gravity_despawn_particles(gravity_simulation* simulation, size_t count,
+                                                     const uint64_t* ids, size_t* out_removed);
+
+GRAVITY_API int gravity_dimensions(const gravity_simulation* simulation);
+/* Length of the particle columns, including removed slots not yet compacted away. */
+GRAVITY_API size_t gravity_particle_count(const gravity_simulation* simulation);
+GRAVITY_API size_t gravity_live_particle_count(const gravity_simulation* simulation);
+GRAVITY_API uint64_t gravity_step_count(const gravity_simulation* simulation);
+GRAVITY_API uint64_t gravity_state_hash(gravity_simulation* simulation);
+
+/* Zero-copy column access; axis is 0 .. dimensions-1. out_length may be NULL. */
+GRAVITY_API const float* gravity_positions(const gravity_simulation* simulation, int axis, size_t* out_length);
+GRAVITY_API const float* gravity_velocities(const gravity_simulation* simulation, int axis, size_t* out_length);
+GRAVITY_API const float* gravity_masses(const gravity_simulation* simulation, size_t* out_length);
+GRAVITY_API const uint64_t* gravity_ids(const gravity_simulation* simulation, size_t* out_length);
+GRAVITY_API const uint8_t* gravity_flags(const gravity_simulation* simulation, size_t* out_length);
+
+/* Starts `steps` steps on a background thread and returns immediately. Poll returns 1
+ * once finished; wait blocks until then, releases the handle and returns the status. */
+GRAVITY_API gravity_step_handle* gravity_step_async(gravity_simulation* simulation, double dt, int steps);
+GRAVITY_API int gravity_step_poll(const gravity_step_handle* handle);
+GRAVITY_API gravity_status gravity_step_wait(gravity_step_handle* handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
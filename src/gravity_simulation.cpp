@@ -1,173 +1,894 @@
-#include "gravity_simulation.h"
-#include "deterministic_rng.h"
-#include <cmath>
-#include <algorithm>
-#include <vector>
-
-static inline void addGravity(float& ax, float& ay,
-                              float px, float py,
-                              float sx, float sy, float smass,
-                              float gravitationalConstant, float softeningSquared) {
-    float dx = sx - px;
-    float dy = sy - py;
-    float r2 = dx * dx + dy * dy + softeningSquared;
-    float invR = 1.0f / std::sqrt(r2);
-    float invR3 = invR * invR * invR;
-    float scale = gravitationalConstant * smass * invR3;
-    ax += dx * scale;
-    ay += dy * scale;
-}
-
-GravitySimulation::GravitySimulation(unsigned int workerThreads, int particleCount, uint32_t seed)
-    : workers(std::max(1u, workerThreads)),
-      configuredParticleCount(std::max(1, particleCount)),
-      configuredSeed(seed),
-      pool(workers) {
-    reset();
-}
-
-void GravitySimulation::reset() {
-    initializeParticles();
-}
-
-const Particles& GravitySimulation::particles() const { return particleData; }
-const SimulationParams& GravitySimulation::params() const { return simulationParams; }
-SimulationParams& GravitySimulation::params() { return simulationParams; }
-
-void GravitySimulation::initializeParticles() {
-    particleData.clear();
-    particleData.reserve((std::size_t)configuredParticleCount + 1);
-
-    DeterministicRng rng(configuredSeed);
-
-    float galaxyCenterX = 0.0f;
-    float galaxyCenterY = 0.0f;
-
-    for (int i = 0; i < configuredParticleCount; i++) {
-        float radius = std::sqrt(rng.nextFloat01()) * 560.0f;
-        float angle = rng.range(0.0f, 6.2831853f);
-
-        float px = galaxyCenterX + radius * std::cos(angle);
-        float py = galaxyCenterY + radius * std::sin(angle);
-
-        float baseSpeed = std::sqrt(std::max(25.0f, radius)) * 5.0f;
-        float tangentX = -std::sin(angle);
-        float tangentY =  std::cos(angle);
-
-        float speedJitter = rng.range(0.86f, 1.14f);
-
-        float vx = tangentX * baseSpeed * speedJitter;
-        float vy = tangentY * baseSpeed * speedJitter;
-
-        float m = rng.range(0.65f, 1.55f);
-        if ((rng.nextU32() & 2047u) == 0u) m *= 70.0f;
-
-        particleData.add(px, py, vx, vy, m);
-    }
-
-    particleData.add(galaxyCenterX, galaxyCenterY, 0.0f, 0.0f, 24000.0f);
-
-    accelerationX.resize(particleData.count());
-    accelerationY.resize(particleData.count());
-}
-
-void GravitySimulation::stepFixed(double fixedDeltaSeconds) {
-    float dt = (float)fixedDeltaSeconds;
-    computeAccelerationsBarnesHut();
-    integrateSymplecticEuler(dt);
-}
-
-void GravitySimulation::computeAccelerationsBarnesHut() {
-    quadtree.build(particleData);
-
-    std::fill(accelerationX.begin(), accelerationX.end(), 0.0f);
-    std::fill(accelerationY.begin(), accelerationY.end(), 0.0f);
-
-    const auto& nodes = quadtree.nodes();
-    if (nodes.empty()) return;
-
-    const float softeningSquared = simulationParams.softeningLength * simulationParams.softeningLength;
-    const float gravitationalConstant = simulationParams.gravitationalConstant;
-    const float theta = simulationParams.barnesHutTheta;
-    const float thetaSquared = theta * theta;
-
-    auto computeRange = [&](std::size_t begin, std::size_t end) {
-        std::vector<int> traversalStack;
-        traversalStack.reserve(4096);
-
-        for (std::size_t i = begin; i < end; i++) {
-            float ax = 0.0f;
-            float ay = 0.0f;
-
-            const float px = particleData.positionX[i];
-            const float py = particleData.positionY[i];
-
-            traversalStack.clear();
-            traversalStack.push_back(0);
-
-            while (!traversalStack.empty()) {
-                int nodeIndex = traversalStack.back();
-                traversalStack.pop_back();
-
-                const BarnesHutNode& node = nodes[(std::size_t)nodeIndex];
-                if (node.totalMass <= 0.0f) continue;
-
-                if (node.isLeaf()) {
-                    if (node.particleIndex >= 0 && node.particleIndex != (int)i) {
-                        addGravity(ax, ay, px, py,
-                                   node.centerOfMassX, node.centerOfMassY, node.totalMass,
-                                   gravitationalConstant, softeningSquared);
-                    }
-                    continue;
-                }
-
-                const float dx = node.centerOfMassX - px;
-                const float dy = node.centerOfMassY - py;
-                const float d2 = dx * dx + dy * dy + softeningSquared;
-
-                const float s = node.halfSize * 2.0f;
-
-                // (s / d) < theta  <=>  s*s < theta^2 * d^2   (avoid sqrt)
-                if ((s * s) < (thetaSquared * d2)) {
-                    addGravity(ax, ay, px, py,
-                               node.centerOfMassX, node.centerOfMassY, node.totalMass,
-                               gravitationalConstant, softeningSquared);
-                } else {
-                    int c0 = node.childIndex0;
-                    int c1 = node.childIndex1;
-                    int c2 = node.childIndex2;
-                    int c3 = node.childIndex3;
-
-                    if (c3 >= 0) traversalStack.push_back(c3);
-                    if (c2 >= 0) traversalStack.push_back(c2);
-                    if (c1 >= 0) traversalStack.push_back(c1);
-                    if (c0 >= 0) traversalStack.push_back(c0);
-                }
-            }
-
-            accelerationX[i] = ax;
-            accelerationY[i] = ay;
-        }
-    };
-
-    pool.parallelFor(0, particleData.count(), 16384, computeRange);
-}
-
-void GravitySimulation::integrateSymplecticEuler(float dtSeconds) {
-    float velocityClampSquared = simulationParams.velocityClamp * simulationParams.velocityClamp;
-
-    for (std::size_t i = 0; i < particleData.count(); i++) {
-        particleData.velocityX[i] += accelerationX[i] * dtSeconds;
-        particleData.velocityY[i] += accelerationY[i] * dtSeconds;
-
-        float v2 = particleData.velocityX[i] * particleData.velocityX[i] + particleData.velocityY[i] * particleData.velocityY[i];
-        if (v2 > velocityClampSquared) {
-            float scale = simulationParams.velocityClamp / std::sqrt(v2);
-            particleData.velocityX[i] *= scale;
-            particleData.velocityY[i] *= scale;
-        }
-
-        particleData.positionX[i] += particleData.velocityX[i] * dtSeconds;
-        particleData.positionY[i] += particleData.velocityY[i] * dtSeconds;
-    }
-}
+#include "gravity_simulation.h"
+#include "state_hash.h"
+#include "particle_import.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+// Constants of one pairwise interaction. split is set for the short-range TreePM walk.
+struct PairInteraction {
+    float gravitationalConstant;
+    float softeningSquared;
+    const ShortRangeSplit* split;
+};
+
+template <int Dim, bool kPotential, bool kShortRange>
+static inline void addGravity(std::array<float, Dim>& a, float& phi,
+                              const std::array<float, Dim>& p,
+                              const std::array<float, Dim>& s, float smass,
+                              const PairInteraction& pair) {
+    std::array<float, Dim> delta;
+    float r2 = 0.0f;
+    for (int d = 0; d < Dim; d++) {
+        delta[d] = s[d] - p[d];
+        r2 += delta[d] * delta[d];
+    }
+    float longForce = 0.0f;
+    float longPotential = 0.0f;
+    if constexpr (kShortRange) {
+        // The mesh supplies everything beyond the cutoff and the long-range part inside it.
+        if (r2 >= pair.split->cutoffSquared) return;
+        pair.split->lookup(r2, longForce, longPotential);
+    }
+    r2 += pair.softeningSquared;
+    float invR = 1.0f / std::sqrt(r2);
+    float invR3 = invR * invR * invR;
+    if constexpr (kShortRange) {
+        invR3 -= longForce;
+        invR -= longPotential;
+    }
+    float scale = pair.gravitationalConstant * smass * invR3;
+    for (int d = 0; d < Dim; d++) a[d] += delta[d] * scale;
+    if constexpr (kPotential) phi -= pair.gravitationalConstant * smass * invR;
+}
+
+template <int Dim>
+static inline bool insideBox(const std::array<float, Dim>& p, const std::array<float, Dim>& center, float halfExtent) {
+    for (int d = 0; d < Dim; d++) {
+        if (std::fabs(p[d] - center[d]) >= halfExtent) return false;
+    }
+    return true;
+}
+
+// Applies a node's monopole when the node may contain the particle itself: aggregated
+// leaves at the depth/size limit, and small nodes the softened opening test accepts
+// around their own members. A member's own share is removed first; otherwise it would
+// feel (and count the potential of) its own mass. Membership comes from the particle
+// order, where leafStart is the first slot of the particle's leaf, because the boxes of
+// a balanced build overlap and a box may hold particles that are not members.
+template <int Dim, bool kPotential, bool kShortRange>
+static inline void addNodeGravityExcludingSelf(std::array<float, Dim>& a, float& phi,
+                                               const std::array<float, Dim>& p, float pmass, int leafStart,
+                                               const BarnesHutNode<Dim>& leaf,
+                                               const PairInteraction& pair) {
+    if ((unsigned)(leafStart - leaf.firstParticle) >= (unsigned)leaf.particleCount) {
+        addGravity<Dim, kPotential, kShortRange>(a, phi, p, leaf.centerOfMass, leaf.totalMass, pair);
+        return;
+    }
+
+    float otherMass = leaf.totalMass - pmass;
+    if (otherMass <= 0.0f) return;
+    std::array<float, Dim> other;
+    for (int d = 0; d < Dim; d++) {
+        other[d] = (leaf.centerOfMass[d] * leaf.totalMass - p[d] * pmass) / otherMass;
+    }
+    addGravity<Dim, kPotential, kShortRange>(a, phi, p, other, otherMass, pair);
+}
+
+// Compaction waits until this many slots are despawned, or an eighth of all slots if
+// that is more, so its cost spreads over many despawns.
+static const std::size_t kMinCompactionSlots = 4096;
+
+// True when both settings give the same forces, so accelerations computed under one can
+// be reused under the other. The focus region only trades accuracy and is left out.
+static bool sameForceModel(const SimulationParams& a, const SimulationParams& b) {
+    return a.gravitationalConstant == b.gravitationalConstant && a.softeningLength == b.softeningLength &&
+           a.barnesHutTheta == b.barnesHutTheta && a.openingCriterion == b.openingCriterion &&
+           a.relativeForceAccuracy == b.relativeForceAccuracy && a.treeType == b.treeType &&
+           a.treeBucketSize == b.treeBucketSize && a.forceSolver == b.forceSolver &&
+           a.massAssignment == b.massAssignment && a.meshSize == b.meshSize &&
+           a.treePmSplitCells == b.treePmSplitCells;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <int Dim>
+GravitySimulation<Dim>::GravitySimulation(unsigned int workerThreads, int particleCount, uint32_t seed,
+                                          GalaxyPreset preset)
+    : configuredParticleCount(std::max(1, particleCount)),
+      configuredSeed(seed),
+      configuredPreset(preset),
+      ownedPool(std::make_unique<ThreadPool>(std::max(1u, workerThreads))),
+      pool(*ownedPool) {
+    reset();
+}
+
+template <int Dim>
+GravitySimulation<Dim>::GravitySimulation(ThreadPool& sharedPool, int particleCount, uint32_t seed,
+                                          GalaxyPreset preset)
+    : configuredParticleCount(std::max(1, particleCount)),
+      configuredSeed(seed),
+      configuredPreset(preset),
+      pool(sharedPool) {
+    reset();
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::reset() {
+    initializeParticles();
+    completedSteps = 0;
+    simulatedSeconds = 0.0;
+    previousTimeStep = 0.0;
+    energyStepScale = 1.0;
+    hasInitialEnergy = false;
+    hasPendingDiagnostics = false;
+}
+
+template <int Dim>
+const Particles<Dim>& GravitySimulation<Dim>::particles() const { return particleData; }
+template <int Dim>
+const BarnesHutTree<Dim>& GravitySimulation<Dim>::tree() const { return barnesHutTree; }
+template <int Dim>
+bool GravitySimulation<Dim>::treeIsCurrent() const { return treeCurrent; }
+template <int Dim>
+const TreeStatistics& GravitySimulation<Dim>::treeStatistics() const { return barnesHutTreeStatistics; }
+template <int Dim>
+const std::array<AlignedVector<float>, Dim>& GravitySimulation<Dim>::accelerations() const { return acceleration; }
+template <int Dim>
+const SimulationParams& GravitySimulation<Dim>::params() const { return simulationParams; }
+template <int Dim>
+SimulationParams& GravitySimulation<Dim>::params() { return simulationParams; }
+template <int Dim>
+uint64_t GravitySimulation<Dim>::stepCount() const { return completedSteps; }
+template <int Dim>
+double GravitySimulation<Dim>::simulationTime() const { return simulatedSeconds; }
+template <int Dim>
+double GravitySimulation<Dim>::lastTimeStep() const { return previousTimeStep; }
+template <int Dim>
+uint64_t GravitySimulation<Dim>::forceEvaluationCount() const { return forceEvaluations; }
+template <int Dim>
+const StepStatistics& GravitySimulation<Dim>::lastStepStatistics() const { return stepStatistics; }
+template <int Dim>
+const ThreadPool& GravitySimulation<Dim>::workerPool() const { return pool; }
+
+template <int Dim>
+uint64_t GravitySimulation<Dim>::computeStateHash() {
+    return hashParticleState(particleData, pool);
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::initializeParticles() {
+    generateInitialConditions(particleData, configuredPreset, configuredParticleCount, configuredSeed, pool);
+    assignParticleIds();
+
+    for (int d = 0; d < Dim; d++) acceleration[d].assign(particleData.count(), 0.0f);
+    accelerationsValid = false;
+    accelerationsCurrent = false;
+    precisePhaseSpaceValid = false;
+    // Keeps tree() consistent with the particle set before the first step.
+    buildTree();
+    treeCurrent = true;
+    interactionLists.invalidate();
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::loadParticles(Particles<Dim> particles) {
+    particleData = std::move(particles);
+    assignParticleIds();
+    for (int d = 0; d < Dim; d++) acceleration[d].assign(particleData.count(), 0.0f);
+    accelerationsValid = false;
+    accelerationsCurrent = false;
+    precisePhaseSpaceValid = false;
+    buildTree();
+    treeCurrent = true;
+    interactionLists.invalidate();
+    completedSteps = 0;
+    simulatedSeconds = 0.0;
+    previousTimeStep = 0.0;
+    energyStepScale = 1.0;
+    hasInitialEnergy = false;
+    hasPendingDiagnostics = false;
+}
+
+template <int Dim>
+bool GravitySimulation<Dim>::loadParticlesFromFile(const std::string& path) {
+    Particles<Dim> imported;
+    if (!importParticles(path, imported, pool)) return false;
+    loadParticles(std::move(imported));
+    return true;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::appendParticles(const Particles<Dim>& particles) {
+    for (std::size_t i = 0; i < particles.count(); i++) {
+        std::array<float, Dim> p;
+        std::array<float, Dim> v;
+        for (int d = 0; d < Dim; d++) {
+            p[d] = particles.position[d][i];
+            v[d] = particles.velocity[d][i];
+        }
+        spawnParticle(p, v, particles.mass[i], particles.flags[i]);
+    }
+    buildTree();
+    treeCurrent = true;
+    interactionLists.invalidate();
+    hasInitialEnergy = false;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::buildTree() {
+    if (simulationParams.treeType == TreeType::KdTree) {
+        barnesHutTree.buildBalanced(particleData, pool, simulationParams.treeBucketSize);
+    } else {
+        barnesHutTree.build(particleData);
+    }
+    if constexpr (kCollectTreeStatistics) barnesHutTree.statistics(barnesHutTreeStatistics);
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::assignParticleIds() {
+    particleIds.clear();
+    removedSlots.clear();
+    for (std::size_t i = 0; i < particleData.count(); i++) {
+        particleData.id[i] = particleIds.allocate(i);
+        particleData.flags[i] &= (uint8_t)~ParticleFlagRemoved;
+    }
+}
+
+template <int Dim>
+uint64_t GravitySimulation<Dim>::spawnParticle(const std::array<float, Dim>& p, const std::array<float, Dim>& v,
+                                               float m, uint8_t flags) {
+    flags &= (uint8_t)~ParticleFlagRemoved;
+    std::size_t index;
+    if (!removedSlots.empty()) {
+        index = removedSlots.back();
+        removedSlots.pop_back();
+        for (int d = 0; d < Dim; d++) {
+            particleData.position[d][index] = p[d];
+            particleData.velocity[d][index] = v[d];
+            acceleration[d][index] = 0.0f;
+            if (precisePhaseSpaceValid) {
+                precisePhaseSpace.position[d][index] = p[d];
+                precisePhaseSpace.velocity[d][index] = v[d];
+            }
+        }
+        particleData.mass[index] = m;
+        particleData.flags[index] = flags;
+    } else {
+        index = particleData.count();
+        particleData.add(p, v, m, flags);
+        for (int d = 0; d < Dim; d++) {
+            acceleration[d].push_back(0.0f);
+            if (precisePhaseSpaceValid) {
+                precisePhaseSpace.position[d].push_back(p[d]);
+                precisePhaseSpace.velocity[d].push_back(v[d]);
+            }
+        }
+    }
+    const uint64_t id = particleIds.allocate(index);
+    particleData.id[index] = id;
+
+    // The next step builds a tree that includes the new body, and integrators that reuse
+    // the last forces evaluate them again first.
+    treeCurrent = false;
+    accelerationsValid = false;
+    accelerationsCurrent = false;
+    interactionLists.invalidate();
+    hasInitialEnergy = false;
+    return id;
+}
+
+template <int Dim>
+bool GravitySimulation<Dim>::despawnParticle(uint64_t id) {
+    std::size_t index;
+    if (!particleIds.lookup(id, index)) return false;
+    particleIds.release(id);
+
+    // A massless, frozen body exerts no force and stays where the tree and any cached
+    // interaction lists expect it, so neither has to be rebuilt for the removal.
+    particleData.flags[index] |= ParticleFlagRemoved;
+    particleData.mass[index] = 0.0f;
+    for (int d = 0; d < Dim; d++) {
+        particleData.velocity[d][index] = 0.0f;
+        acceleration[d][index] = 0.0f;
+        if (precisePhaseSpaceValid) precisePhaseSpace.velocity[d][index] = 0.0;
+    }
+    removedSlots.push_back(index);
+    hasInitialEnergy = false;
+    return true;
+}
+
+template <int Dim>
+bool GravitySimulation<Dim>::particleIndex(uint64_t id, std::size_t& outIndex) const {
+    return particleIds.lookup(id, outIndex);
+}
+
+template <int Dim>
+std::size_t GravitySimulation<Dim>::liveParticleCount() const {
+    return particleData.count() - removedSlots.size();
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::compactParticles() {
+    const std::size_t n = particleData.count();
+    const std::size_t blockCount = (n + kParticleGrain - 1) / kParticleGrain;
+
+    // Live particles per block, then their exclusive prefix sum as each block's first
+    // output slot.
+    compactionOffsets.assign(blockCount + 1, 0);
+    pool.parallelFor(0, blockCount, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin; b < end; b++) {
+            std::size_t live = 0;
+            for (std::size_t i = b * kParticleGrain; i < std::min(n, (b + 1) * kParticleGrain); i++) {
+                if (!(particleData.flags[i] & ParticleFlagRemoved)) live++;
+            }
+            compactionOffsets[b + 1] = live;
+        }
+    });
+    for (std::size_t b = 0; b < blockCount; b++) compactionOffsets[b + 1] += compactionOffsets[b];
+
+    const std::size_t liveCount = compactionOffsets[blockCount];
+    compactedParticles.resize(liveCount);
+    for (int d = 0; d < Dim; d++) compactedAcceleration[d].resize(liveCount);
+    const bool precise = precisePhaseSpaceValid;
+    if (precise) {
+        for (int d = 0; d < Dim; d++) {
+            compactedPhaseSpace.position[d].resize(liveCount);
+            compactedPhaseSpace.velocity[d].resize(liveCount);
+        }
+    }
+
+    pool.parallelFor(0, blockCount, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin; b < end; b++) {
+            std::size_t out = compactionOffsets[b];
+            for (std::size_t i = b * kParticleGrain; i < std::min(n, (b + 1) * kParticleGrain); i++) {
+                if (particleData.flags[i] & ParticleFlagRemoved) continue;
+                for (int d = 0; d < Dim; d++) {
+                    compactedParticles.position[d][out] = particleData.position[d][i];
+                    compactedParticles.velocity[d][out] = particleData.velocity[d][i];
+                    compactedAcceleration[d][out] = acceleration[d][i];
+                    if (precise) {
+                        compactedPhaseSpace.position[d][out] = precisePhaseSpace.position[d][i];
+                        compactedPhaseSpace.velocity[d][out] = precisePhaseSpace.velocity[d][i];
+                    }
+                }
+                compactedParticles.mass[out] = particleData.mass[i];
+                compactedParticles.id[out] = particleData.id[i];
+                compactedParticles.flags[out] = particleData.flags[i];
+                // Live IDs own distinct table slots, so blocks never write the same entry.
+                particleIds.move(particleData.id[i], out);
+                out++;
+            }
+        }
+    });
+
+    std::swap(particleData, compactedParticles);
+    std::swap(acceleration, compactedAcceleration);
+    if (precise) std::swap(precisePhaseSpace, compactedPhaseSpace);
+    removedSlots.clear();
+    treeCurrent = false;
+    interactionLists.invalidate();
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::stepFixed(double fixedDeltaSeconds) {
+    float dt = (float)fixedDeltaSeconds;
+
+    if (removedSlots.size() >= std::max(kMinCompactionSlots, particleData.count() / 8)) compactParticles();
+
+    const int diagnosticsInterval = simulationParams.diagnosticsInterval;
+    const bool measure = diagnosticsInterval > 0 && completedSteps % (uint64_t)diagnosticsInterval == 0;
+
+    ThreadPool::ResidentScope resident(pool, simulationParams.residentWorkers);
+
+    const auto stepStart = std::chrono::steady_clock::now();
+    stepStatistics = StepStatistics();
+    interactionCount.store(0, std::memory_order_relaxed);
+    visitedNodeCount.store(0, std::memory_order_relaxed);
+    acceptedCellCount.store(0, std::memory_order_relaxed);
+    particleInteractionCount.store(0, std::memory_order_relaxed);
+
+    // Forest-Ruth: theta = 1 / (2 - 2^(1/3)); the middle stage runs backwards in time.
+    static constexpr float kLeapfrogWeights[] = { 1.0f };
+    static constexpr float kForestRuthWeights[] = { 1.3512071919596578f, -1.7024143839193155f, 1.3512071919596578f };
+
+    switch (simulationParams.integrator) {
+    case Integrator::Leapfrog:
+        stepComposition(dt, kLeapfrogWeights, 1, measure);
+        break;
+    case Integrator::ForestRuth:
+        stepComposition(dt, kForestRuthWeights, 3, measure);
+        break;
+    default:
+        stepSymplecticEuler(dt, measure);
+        break;
+    }
+
+    stepStatistics.interactions = interactionCount.load(std::memory_order_relaxed);
+    stepStatistics.nodesVisited = visitedNodeCount.load(std::memory_order_relaxed);
+    stepStatistics.cellsAccepted = acceptedCellCount.load(std::memory_order_relaxed);
+    stepStatistics.particleInteractions = particleInteractionCount.load(std::memory_order_relaxed);
+    if (treeCurrent) {
+        stepStatistics.treeNodes = barnesHutTree.nodes().size();
+        stepStatistics.treeDepth = barnesHutTree.depth();
+    }
+
+    completedSteps++;
+    simulatedSeconds += fixedDeltaSeconds;
+    previousTimeStep = fixedDeltaSeconds;
+    stepStatistics.totalSeconds = secondsSince(stepStart);
+    stepStatistics.forceSeconds = stepStatistics.totalSeconds - stepStatistics.treeSeconds -
+                                  stepStatistics.integrateSeconds - stepStatistics.diagnosticsSeconds;
+}
+
+template <int Dim>
+double GravitySimulation<Dim>::advance() {
+    const double dt = simulationParams.timeStep.adaptive ? chooseTimeStep() : (double)simulationParams.fixedTimeStep;
+    stepFixed(dt);
+    return dt;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::stepSymplecticEuler(float dtSeconds, bool measure) {
+    ParallelPhase integratePhase = kickDriftPhase(dtSeconds, dtSeconds);
+
+    // Without diagnostics nothing has to happen between the force pass and the kick, so
+    // both run in one dispatch.
+    computeAccelerations(measure, measure ? nullptr : &integratePhase);
+
+    // Measured before the kick so kinetic and potential energy refer to the same state.
+    if (measure) {
+        recordDiagnostics();
+
+        const auto integrateStart = std::chrono::steady_clock::now();
+        pool.parallelFor(integratePhase.begin, integratePhase.end, integratePhase.minGrain, integratePhase.task);
+        stepStatistics.integrateSeconds = secondsSince(integrateStart);
+    }
+    accelerationsCurrent = false;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::stepComposition(float dtSeconds, const float* weights, int stages, bool measure) {
+    // Only needed after a reset, load, spawn or a change to the force parameters; otherwise
+    // the last step ended with these forces.
+    if (!accelerationsCurrent || !sameForceModel(forceParams, simulationParams)) computeAccelerations(false, nullptr);
+
+    const auto integrateStart = std::chrono::steady_clock::now();
+    const ParallelPhase opening = kickDriftPhase(0.5f * weights[0] * dtSeconds, weights[0] * dtSeconds);
+    pool.parallelFor(opening.begin, opening.end, opening.minGrain, opening.task);
+    stepStatistics.integrateSeconds += secondsSince(integrateStart);
+
+    for (int s = 0; s < stages; s++) {
+        if (s + 1 < stages) {
+            // Closing kick of this stage and opening kick and drift of the next.
+            const ParallelPhase next = kickDriftPhase(0.5f * (weights[s] + weights[s + 1]) * dtSeconds,
+                                                      weights[s + 1] * dtSeconds);
+            computeAccelerations(false, &next);
+        } else if (!measure) {
+            const ParallelPhase closing = kickDriftPhase(0.5f * weights[s] * dtSeconds, 0.0f);
+            computeAccelerations(false, &closing);
+        } else {
+            // Positions and velocities are synchronized after the closing kick, so energy
+            // is measured there.
+            computeAccelerations(true, nullptr);
+            const auto kickStart = std::chrono::steady_clock::now();
+            const ParallelPhase closing = kickDriftPhase(0.5f * weights[s] * dtSeconds, 0.0f);
+            pool.parallelFor(closing.begin, closing.end, closing.minGrain, closing.task);
+            stepStatistics.integrateSeconds += secondsSince(kickStart);
+            recordDiagnostics();
+        }
+    }
+}
+
+template <int Dim>
+ParallelPhase GravitySimulation<Dim>::kickDriftPhase(float kickSeconds, float driftSeconds) {
+    ParallelPhase phase;
+    phase.begin = 0;
+    phase.end = particleData.count();
+    phase.minGrain = std::max<std::size_t>(1, simulationParams.particleGrain);
+    if (simulationParams.positionPrecision == PositionPrecision::Double) {
+        syncPrecisePhaseSpace();
+        phase.task = [this, kickSeconds, driftSeconds](std::size_t begin, std::size_t end) {
+            kickDrift<double>(kickSeconds, driftSeconds, begin, end);
+        };
+    } else {
+        // The float columns move on their own from here.
+        precisePhaseSpaceValid = false;
+        phase.task = [this, kickSeconds, driftSeconds](std::size_t begin, std::size_t end) {
+            kickDrift<float>(kickSeconds, driftSeconds, begin, end);
+        };
+    }
+    return phase;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::syncPrecisePhaseSpace() {
+    if (precisePhaseSpaceValid) return;
+    for (int d = 0; d < Dim; d++) {
+        precisePhaseSpace.position[d].assign(particleData.position[d].begin(), particleData.position[d].end());
+        precisePhaseSpace.velocity[d].assign(particleData.velocity[d].begin(), particleData.velocity[d].end());
+    }
+    precisePhaseSpaceValid = true;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::recordDiagnostics() {
+    const auto diagnosticsStart = std::chrono::steady_clock::now();
+    ConservationDiagnostics diagnostics = measureConservation(particleData, potential, pool);
+    diagnostics.step = completedSteps;
+    if (!hasInitialEnergy) {
+        initialEnergy = diagnostics.totalEnergy;
+        previousEnergy = diagnostics.totalEnergy;
+        hasInitialEnergy = true;
+    }
+    if (initialEnergy != 0.0) {
+        diagnostics.relativeEnergyDrift = (diagnostics.totalEnergy - initialEnergy) / std::fabs(initialEnergy);
+
+        const TimeStepControl& control = simulationParams.timeStep;
+        if (control.adaptive && control.energyTolerance > 0.0f) {
+            const double change = std::fabs(diagnostics.totalEnergy - previousEnergy) / std::fabs(initialEnergy);
+            if (change > control.energyTolerance) {
+                energyStepScale = std::max(1.0 / 64.0, 0.5 * energyStepScale);
+            } else if (change < 0.25 * control.energyTolerance) {
+                energyStepScale = std::min(1.0, 1.25 * energyStepScale);
+            }
+        }
+    }
+    previousEnergy = diagnostics.totalEnergy;
+    latestDiagnostics = diagnostics;
+    hasPendingDiagnostics = true;
+    stepStatistics.diagnosticsSeconds += secondsSince(diagnosticsStart);
+}
+
+template <int Dim>
+double GravitySimulation<Dim>::chooseTimeStep() {
+    const TimeStepControl& control = simulationParams.timeStep;
+    // Right after a reset there are no forces to go by yet. Integrators that start from
+    // the last forces reuse this evaluation for the step itself.
+    if (!accelerationsValid) {
+        ThreadPool::ResidentScope resident(pool, simulationParams.residentWorkers);
+        computeAccelerations(false, nullptr);
+    }
+
+    const std::size_t n = particleData.count();
+    const std::size_t blockCount = (n + kParticleGrain - 1) / kParticleGrain;
+    std::vector<float> blockMaxima(2 * blockCount, 0.0f);
+    pool.parallelFor(0, blockCount, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin; b < end; b++) {
+            float maxA2 = 0.0f;
+            float maxV2 = 0.0f;
+            for (std::size_t i = b * kParticleGrain; i < std::min(n, (b + 1) * kParticleGrain); i++) {
+                float a2 = 0.0f;
+                float v2 = 0.0f;
+                for (int d = 0; d < Dim; d++) {
+                    a2 += acceleration[d][i] * acceleration[d][i];
+                    v2 += particleData.velocity[d][i] * particleData.velocity[d][i];
+                }
+                maxA2 = std::max(maxA2, a2);
+                maxV2 = std::max(maxV2, v2);
+            }
+            blockMaxima[2 * b] = maxA2;
+            blockMaxima[2 * b + 1] = maxV2;
+        }
+    });
+    float maxA2 = 0.0f;
+    float maxV2 = 0.0f;
+    for (std::size_t b = 0; b < blockCount; b++) {
+        maxA2 = std::max(maxA2, blockMaxima[2 * b]);
+        maxV2 = std::max(maxV2, blockMaxima[2 * b + 1]);
+    }
+
+    const double softening = std::max(simulationParams.softeningLength, 1.0e-3f);
+    double dt = control.maxTimeStep;
+    if (maxA2 > 0.0f) dt = std::min(dt, control.accelerationFactor * std::sqrt(softening / std::sqrt((double)maxA2)));
+    if (maxV2 > 0.0f) dt = std::min(dt, control.velocityFactor * softening / std::sqrt((double)maxV2));
+    return std::max((double)control.minTimeStep, dt * energyStepScale);
+}
+
+template <int Dim>
+bool GravitySimulation<Dim>::takeDiagnostics(ConservationDiagnostics& outDiagnostics) {
+    if (!hasPendingDiagnostics) return false;
+    outDiagnostics = latestDiagnostics;
+    hasPendingDiagnostics = false;
+    return true;
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::computeAccelerations(bool withPotential, const ParallelPhase* trailingPhase) {
+    forceEvaluations++;
+    accelerationsValid = true;
+    accelerationsCurrent = true;
+    forceParams = simulationParams;
+    AlignedVector<float>* potentialOut = withPotential ? &potential : nullptr;
+
+    switch (simulationParams.forceSolver) {
+    case ForceSolver::ParticleMesh:
+        particleMesh.compute(particleData, simulationParams, false, acceleration, potentialOut, pool);
+        treeCurrent = false;
+        if (trailingPhase) {
+            pool.parallelFor(trailingPhase->begin, trailingPhase->end, trailingPhase->minGrain, trailingPhase->task);
+        }
+        break;
+    case ForceSolver::TreePM:
+        particleMesh.compute(particleData, simulationParams, true, meshAcceleration,
+                             withPotential ? &meshPotential : nullptr, pool);
+        shortRangeSplit.configure(particleMesh.splitRadius());
+        computeAccelerationsBarnesHut(withPotential, &shortRangeSplit, trailingPhase);
+        break;
+    default:
+        computeAccelerationsBarnesHut(withPotential, nullptr, trailingPhase);
+        break;
+    }
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::computeAccelerationsBarnesHut(bool withPotential, const ShortRangeSplit* split,
+                                                           const ParallelPhase* trailingPhase) {
+    if (!split && simulationParams.interactionLists) {
+        computeAccelerationsFromLists(withPotential, trailingPhase);
+        return;
+    }
+    interactionLists.invalidate();
+
+    const auto treeStart = std::chrono::steady_clock::now();
+    buildTree();
+    treeCurrent = true;
+    stepStatistics.treeSeconds += secondsSince(treeStart);
+
+    const auto& nodes = barnesHutTree.nodes();
+    const auto& particleLeaves = barnesHutTree.particleLeaves();
+    const auto& order = barnesHutTree.particleOrder();
+    if (nodes.empty()) return;
+
+    const float softeningSquared = simulationParams.softeningLength * simulationParams.softeningLength;
+    const float gravitationalConstant = simulationParams.gravitationalConstant;
+    const PairInteraction pair{ gravitationalConstant, softeningSquared, split };
+    const float theta = simulationParams.barnesHutTheta;
+    const float thetaSquared = theta * theta;
+    const FocusRegion& focus = simulationParams.focus;
+    const bool useRelativeCriterion = simulationParams.openingCriterion == OpeningCriterion::RelativeAcceleration;
+    const float relativeAccuracy = simulationParams.relativeForceAccuracy;
+
+    // The potential is only accumulated when diagnostics are due, and the short-range
+    // split only applies under TreePM; the tags make both compile-time choices so the
+    // regular walk carries no extra work.
+    auto computeRange = [&](auto potentialTag, auto shortRangeTag, std::size_t begin, std::size_t end) {
+        constexpr bool kPotential = decltype(potentialTag)::value;
+        constexpr bool kShortRange = decltype(shortRangeTag)::value;
+
+        const int nodeEnd = (int)nodes.size();
+        uint64_t interactions = 0;
+        // Chunk-local, so each worker counts without sharing a cache line.
+        uint64_t visited = 0;
+        uint64_t accepted = 0;
+        uint64_t pairs = 0;
+
+        for (std::size_t i = begin; i < end; i++) {
+            std::array<float, Dim> a{};
+            float phi = 0.0f;
+
+            if (particleData.flags[i] & ParticleFlagRemoved) {
+                for (int d = 0; d < Dim; d++) acceleration[d][i] = 0.0f;
+                if constexpr (kPotential) potential[i] = 0.0f;
+                continue;
+            }
+
+            std::array<float, Dim> p;
+            for (int d = 0; d < Dim; d++) p[d] = particleData.position[d][i];
+            const int leafStart = nodes[(std::size_t)particleLeaves[i]].firstParticle;
+
+            // Each particle only reads and writes its own slot, so the previous step's
+            // acceleration is still intact here. It is zero on the first step after a
+            // reset, in which case the geometric test is used instead.
+            float errorBudget = 0.0f;
+            if (useRelativeCriterion) {
+                float oldA2 = 0.0f;
+                for (int d = 0; d < Dim; d++) oldA2 += acceleration[d][i] * acceleration[d][i];
+                errorBudget = relativeAccuracy * std::sqrt(oldA2);
+            }
+            const bool relative = errorBudget > 0.0f;
+
+            // Away from the focus region theta loosens; the relative budget follows it,
+            // since the monopole error grows as theta^2.
+            float particleThetaSquared = thetaSquared;
+            if (focus.enabled) {
+                const float particleTheta = focus.thetaFor(theta, p[0], p[1], p[0], p[1]);
+                particleThetaSquared = particleTheta * particleTheta;
+                if (thetaSquared > 0.0f) errorBudget *= particleThetaSquared / thetaSquared;
+            }
+
+            // Stackless: opening a node moves to its first child, anything else follows
+            // the skip index past the node's subtree.
+            int nodeIndex = 0;
+            while (nodeIndex < nodeEnd) {
+                const BarnesHutNode<Dim>& node = nodes[(std::size_t)nodeIndex];
+                nodeIndex = node.skipIndex;
+                if constexpr (kCollectTreeStatistics) visited++;
+                if (node.totalMass <= 0.0f) continue;
+
+                if (node.isLeaf()) {
+                    if (node.particleIndex >= 0 && node.particleIndex != (int)i) {
+                        addGravity<Dim, kPotential, kShortRange>(a, phi, p, node.centerOfMass, node.totalMass, pair);
+                        interactions++;
+                        if constexpr (kCollectTreeStatistics) pairs++;
+                    } else if (node.particleIndex == -2) {
+                        addNodeGravityExcludingSelf<Dim, kPotential, kShortRange>(a, phi, p, particleData.mass[i],
+                                                                                  leafStart, node, pair);
+                        interactions++;
+                        if constexpr (kCollectTreeStatistics) accepted++;
+                    } else if (node.particleIndex == -3) {
+                        for (int k = node.firstParticle; k < node.firstParticle + node.particleCount; k++) {
+                            const std::size_t j = (std::size_t)order[(std::size_t)k];
+                            if (j == i) continue;
+                            std::array<float, Dim> source;
+                            for (int d = 0; d < Dim; d++) source[d] = particleData.position[d][j];
+                            addGravity<Dim, kPotential, kShortRange>(a, phi, p, source, particleData.mass[j], pair);
+                            interactions++;
+                            if constexpr (kCollectTreeStatistics) pairs++;
+                        }
+                    }
+                    continue;
+                }
+
+                if constexpr (kShortRange) {
+                    // Nothing in a box entirely beyond the cutoff contributes.
+                    float gap2 = 0.0f;
+                    for (int d = 0; d < Dim; d++) {
+                        const float gap = std::fabs(p[d] - node.center[d]) - node.halfSize;
+                        if (gap > 0.0f) gap2 += gap * gap;
+                    }
+                    if (gap2 >= split->cutoffSquared) continue;
+                }
+
+                float d2 = 0.0f;
+                for (int d = 0; d < Dim; d++) {
+                    const float delta = node.centerOfMass[d] - p[d];
+                    d2 += delta * delta;
+                }
+                d2 += softeningSquared;
+
+                const float s = node.halfSize * 2.0f;
+
+                bool accept;
+                if (relative) {
+                    // Estimated error of the monopole, G*M/d^2 * (s/d)^2, against a fraction of |a_old|:
+                    // G*M*s^2 <= budget * d^4. A node whose (slightly enlarged) box still contains
+                    // the particle is always opened, since the estimate is meaningless there.
+                    accept = !insideBox<Dim>(p, node.center, 0.6f * s) &&
+                             (gravitationalConstant * node.totalMass * s * s) <= (errorBudget * d2 * d2);
+                } else {
+                    // (s / d) < theta  <=>  s*s < theta^2 * d^2   (avoid sqrt)
+                    accept = (s * s) < (particleThetaSquared * d2);
+                }
+
+                if (accept) {
+                    addNodeGravityExcludingSelf<Dim, kPotential, kShortRange>(a, phi, p, particleData.mass[i],
+                                                                              leafStart, node, pair);
+                    interactions++;
+                    if constexpr (kCollectTreeStatistics) accepted++;
+                } else {
+                    nodeIndex = node.childIndex[0];
+                }
+            }
+
+            if constexpr (kShortRange) {
+                for (int d = 0; d < Dim; d++) a[d] += meshAcceleration[d][i];
+                if constexpr (kPotential) phi += meshPotential[i];
+            }
+
+            for (int d = 0; d < Dim; d++) acceleration[d][i] = a[d];
+            if constexpr (kPotential) potential[i] = phi;
+        }
+        interactionCount.fetch_add(interactions, std::memory_order_relaxed);
+        if constexpr (kCollectTreeStatistics) {
+            visitedNodeCount.fetch_add(visited, std::memory_order_relaxed);
+            acceptedCellCount.fetch_add(accepted, std::memory_order_relaxed);
+            particleInteractionCount.fetch_add(pairs, std::memory_order_relaxed);
+        }
+    };
+
+    auto run = [&](auto potentialTag, auto shortRangeTag) {
+        std::vector<ParallelPhase> phases(1);
+        phases[0].begin = 0;
+        phases[0].end = particleData.count();
+        phases[0].minGrain = std::max<std::size_t>(1, simulationParams.particleGrain);
+        phases[0].task = [&](std::size_t begin, std::size_t end) { computeRange(potentialTag, shortRangeTag, begin, end); };
+        if (trailingPhase) phases.push_back(*trailingPhase);
+        pool.runPhases(phases);
+    };
+
+    if (withPotential) potential.resize(particleData.count());
+    if (withPotential && split) {
+        run(std::true_type(), std::true_type());
+    } else if (withPotential) {
+        run(std::true_type(), std::false_type());
+    } else if (split) {
+        run(std::false_type(), std::true_type());
+    } else {
+        run(std::false_type(), std::false_type());
+    }
+}
+
+template <int Dim>
+void GravitySimulation<Dim>::computeAccelerationsFromLists(bool withPotential, const ParallelPhase* trailingPhase) {
+    const auto treeStart = std::chrono::steady_clock::now();
+    if (interactionLists.needsRebuild(particleData, simulationParams)) {
+        buildTree();
+        interactionLists.reset(barnesHutTree, particleData, simulationParams);
+    } else {
+        barnesHutTree.refit(particleData);
+    }
+    treeCurrent = true;
+    stepStatistics.treeSeconds += secondsSince(treeStart);
+
+    AlignedVector<float>* potentialOut = nullptr;
+    if (withPotential) {
+        potential.resize(particleData.count());
+        potentialOut = &potential;
+    }
+
+    std::vector<ParallelPhase> phases(1);
+    phases[0].begin = 0;
+    phases[0].end = interactionLists.groupCount();
+    phases[0].minGrain = 16;
+    phases[0].task = [&](std::size_t begin, std::size_t end) {
+        const uint64_t interactions = interactionLists.updateAndEvaluate(begin, end, barnesHutTree, particleData,
+                                                                         simulationParams, acceleration, potentialOut);
+        interactionCount.fetch_add(interactions, std::memory_order_relaxed);
+    };
+    if (trailingPhase) phases.push_back(*trailingPhase);
+    pool.runPhases(phases);
+    interactionLists.finishStep();
+}
+
+template <int Dim>
+template <typename Real>
+void GravitySimulation<Dim>::kickDrift(float kickSeconds, float driftSeconds, std::size_t begin, std::size_t end) {
+    constexpr bool kPrecise = std::is_same_v<Real, double>;
+    std::array<Real*, Dim> position;
+    std::array<Real*, Dim> velocity;
+    for (int d = 0; d < Dim; d++) {
+        if constexpr (kPrecise) {
+            position[d] = precisePhaseSpace.position[d].data();
+            velocity[d] = precisePhaseSpace.velocity[d].data();
+        } else {
+            position[d] = particleData.position[d].data();
+            velocity[d] = particleData.velocity[d].data();
+        }
+    }
+    const Real velocityClamp = simulationParams.velocityClamp;
+    const Real velocityClampSquared = velocityClamp * velocityClamp;
+
+    for (std::size_t i = begin; i < end; i++) {
+        if (particleData.flags[i] & ParticleFlagRemoved) continue;
+
+        Real v2 = 0;
+        for (int d = 0; d < Dim; d++) {
+            velocity[d][i] += (Real)acceleration[d][i] * (Real)kickSeconds;
+            v2 += velocity[d][i] * velocity[d][i];
+        }
+
+        if (v2 > velocityClampSquared) {
+            Real scale = velocityClamp / std::sqrt(v2);
+            for (int d = 0; d < Dim; d++) velocity[d][i] *= scale;
+        }
+
+        for (int d = 0; d < Dim; d++) {
+            position[d][i] += velocity[d][i] * (Real)driftSeconds;
+        }
+
+        if constexpr (kPrecise) {
+            for (int d = 0; d < Dim; d++) {
+                particleData.position[d][i] = (float)position[d][i];
+                particleData.velocity[d][i] = (float)velocity[d][i];
+            }
+        }
+    }
+}
+
+template class GravitySimulation<2>;
+template class GravitySimulation<3>;
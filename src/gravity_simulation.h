@@ -1,37 +1,204 @@
-#pragma once
-#include <vector>
-#include <cstdint>
-#include "particles.h"
-#include "barnes_hut.h"
-#include "thread_pool.h"
-#include "simulation_params.h"
-
-class GravitySimulation {
-public:
-    GravitySimulation(unsigned int workerThreads, int particleCount, uint32_t seed);
-
-    void reset();
-    void stepFixed(double fixedDeltaSeconds);
-
-    const Particles& particles() const;
-    const SimulationParams& params() const;
-    SimulationParams& params();
-
-private:
-    void initializeParticles();
-    void computeAccelerationsBarnesHut();
-    void integrateSymplecticEuler(float dtSeconds);
-
-    unsigned int workers;
-    int configuredParticleCount;
-    uint32_t configuredSeed;
-
-    ThreadPool pool;
-    SimulationParams simulationParams;
-
-    Particles particleData;
-    BarnesHutTree quadtree;
-
-    std::vector<float> accelerationX;
-    std::vector<float> accelerationY;
-};
+#pragma once
+#include <array>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "particles.h"
+#include "particle_ids.h"
+#include "barnes_hut.h"
+#include "particle_mesh.h"
+#include "interaction_lists.h"
+#include "thread_pool.h"
+#include "simulation_params.h"
+#include "initial_conditions.h"
+#include "diagnostics.h"
+
+// Timings and tree figures of one step. When no diagnostics are due the kick runs in the
+// same dispatch as the force pass and its time is part of forceSeconds.
+struct StepStatistics {
+    double treeSeconds = 0.0;
+    double forceSeconds = 0.0;
+    double integrateSeconds = 0.0;
+    double diagnosticsSeconds = 0.0;
+    double totalSeconds = 0.0;
+    // Zero when the step built no tree (pure particle-mesh solver).
+    std::size_t treeNodes = 0;
+    int treeDepth = 0;
+    // Particle-particle and particle-node terms evaluated by the tree part of the solver.
+    uint64_t interactions = 0;
+    // Work of the per-particle tree walk, counted only when kCollectTreeStatistics is set:
+    // nodes the walk reached, nodes accepted as one monopole and particle-particle terms.
+    uint64_t nodesVisited = 0;
+    uint64_t cellsAccepted = 0;
+    uint64_t particleInteractions = 0;
+};
+
+template <int Dim>
+struct PrecisePhaseSpace {
+    std::array<AlignedVector<double>, Dim> position;
+    std::array<AlignedVector<double>, Dim> velocity;
+};
+
+template <int Dim>
+class GravitySimulation {
+public:
+    // Block size of the block-parallel passes (compaction, reductions). The force and
+    // kick passes hand out params().particleGrain instead.
+    static constexpr std::size_t kParticleGrain = 16384;
+
+    GravitySimulation(unsigned int workerThreads, int particleCount, uint32_t seed,
+                      GalaxyPreset preset = GalaxyPreset::Disc);
+    // Runs on a pool owned by the caller, e.g. one shared by several simulations that are
+    // stepped from the same thread.
+    GravitySimulation(ThreadPool& sharedPool, int particleCount, uint32_t seed,
+                      GalaxyPreset preset = GalaxyPreset::Disc);
+
+    void reset();
+    void stepFixed(double fixedDeltaSeconds);
+    // One step of params().fixedTimeStep, or of the size params().timeStep picks when it
+    // is adaptive. Returns the step taken.
+    double advance();
+
+    // Replaces the particle set with externally supplied bodies. reset() still
+    // regenerates the configured preset.
+    void loadParticles(Particles<Dim> particles);
+    // loadParticles() from a file in one of the layouts of importParticles(). Returns
+    // false, keeping the current particles, when the file cannot be imported.
+    bool loadParticlesFromFile(const std::string& path);
+    // Adds bodies to the running simulation; existing particles keep their state.
+    void appendParticles(const Particles<Dim>& particles);
+
+    // Adds one body between steps and returns its stable ID. Slots of despawned bodies
+    // are refilled first, so the columns only grow when none is free.
+    uint64_t spawnParticle(const std::array<float, Dim>& p, const std::array<float, Dim>& v, float m,
+                           uint8_t flags = 0);
+    // Removes the body behind `id`; false when the ID is not live. The slot turns
+    // massless at once and stays in particles(), flagged ParticleFlagRemoved, until a
+    // later step compacts the columns, which moves particles but keeps their IDs.
+    bool despawnParticle(uint64_t id);
+    bool particleIndex(uint64_t id, std::size_t& outIndex) const;
+    // particles().count() minus the despawned slots not yet compacted away.
+    std::size_t liveParticleCount() const;
+
+    uint64_t stepCount() const;
+    // Simulated seconds since the last reset or load.
+    double simulationTime() const;
+    double lastTimeStep() const;
+    // Force evaluations since construction, including the extra ones integrators and the
+    // step controller need after a reset.
+    uint64_t forceEvaluationCount() const;
+    uint64_t computeStateHash();
+
+    // Returns true once for every new measurement taken at params().diagnosticsInterval.
+    bool takeDiagnostics(ConservationDiagnostics& outDiagnostics);
+    const StepStatistics& lastStepStatistics() const;
+    const ThreadPool& workerPool() const;
+
+    const Particles<Dim>& particles() const;
+    // Tree of the most recent force evaluation (or of the initial state after a reset).
+    // Particles have moved by one step since it was built.
+    const BarnesHutTree<Dim>& tree() const;
+    // False once the pure particle-mesh solver has stepped, which builds no tree.
+    bool treeIsCurrent() const;
+    // Statistics of tree() taken right after it was built; empty unless
+    // kCollectTreeStatistics is set.
+    const TreeStatistics& treeStatistics() const;
+    // Accelerations of the most recent force evaluation.
+    const std::array<AlignedVector<float>, Dim>& accelerations() const;
+    const SimulationParams& params() const;
+    SimulationParams& params();
+
+private:
+    void initializeParticles();
+    // Gives every particle a fresh ID equal to its index.
+    void assignParticleIds();
+    // Drops despawned slots in parallel, preserving the order of the live particles.
+    void compactParticles();
+    // Builds barnesHutTree with the layout params().treeType selects.
+    void buildTree();
+    // trailingPhase, when given, runs right after the force pass; the tree walk fuses it
+    // into the same dispatch.
+    void computeAccelerations(bool withPotential, const ParallelPhase* trailingPhase);
+    // With split set, only the short-range TreePM part is walked and the mesh part in
+    // meshAcceleration / meshPotential is added on top.
+    void computeAccelerationsBarnesHut(bool withPotential, const ShortRangeSplit* split,
+                                       const ParallelPhase* trailingPhase);
+    void computeAccelerationsFromLists(bool withPotential, const ParallelPhase* trailingPhase);
+    void stepSymplecticEuler(float dtSeconds, bool measure);
+    // Leapfrog stages of weights w[0..stages) times dtSeconds, sharing the force
+    // evaluation between the closing kick of one stage and the opening kick of the next.
+    void stepComposition(float dtSeconds, const float* weights, int stages, bool measure);
+    // v += a * kickSeconds (clamped to velocityClamp), then x += v * driftSeconds, on the
+    // float columns (Real = float) or on precisePhaseSpace (Real = double).
+    template <typename Real>
+    void kickDrift(float kickSeconds, float driftSeconds, std::size_t begin, std::size_t end);
+    // Copies the float columns into precisePhaseSpace unless it already tracks them.
+    void syncPrecisePhaseSpace();
+    ParallelPhase kickDriftPhase(float kickSeconds, float driftSeconds);
+    void recordDiagnostics();
+    double chooseTimeStep();
+
+    int configuredParticleCount;
+    uint32_t configuredSeed;
+    GalaxyPreset configuredPreset;
+    uint64_t completedSteps = 0;
+    double simulatedSeconds = 0.0;
+    double previousTimeStep = 0.0;
+    uint64_t forceEvaluations = 0;
+    // The acceleration arrays belong to the current particle set (accelerationsValid) and
+    // were evaluated at the current positions (accelerationsCurrent), with the force model
+    // of forceParams; params() may have changed since.
+    bool accelerationsValid = false;
+    bool accelerationsCurrent = false;
+    SimulationParams forceParams;
+
+    std::unique_ptr<ThreadPool> ownedPool;
+    ThreadPool& pool;
+    SimulationParams simulationParams;
+
+    Particles<Dim> particleData;
+    ParticleIdTable particleIds;
+    // Despawned slots, refilled by spawnParticle before the columns grow.
+    std::vector<std::size_t> removedSlots;
+    // Targets of compactParticles, swapped with the live columns so neither side
+    // reallocates once both have reached their working size.
+    Particles<Dim> compactedParticles;
+    std::array<AlignedVector<float>, Dim> compactedAcceleration;
+    PrecisePhaseSpace<Dim> compactedPhaseSpace;
+    std::vector<std::size_t> compactionOffsets;
+    BarnesHutTree<Dim> barnesHutTree;
+    bool treeCurrent = false;
+    TreeStatistics barnesHutTreeStatistics;
+    ParticleMesh<Dim> particleMesh;
+    ShortRangeSplit shortRangeSplit;
+    InteractionLists<Dim> interactionLists;
+
+    // Under PositionPrecision::Double, the state that particleData's positions and
+    // velocities are rounded from. Spawns, despawns and compactions keep it in step while
+    // it is valid; anything else that replaces the particles drops it.
+    PrecisePhaseSpace<Dim> precisePhaseSpace;
+    bool precisePhaseSpaceValid = false;
+
+    std::array<AlignedVector<float>, Dim> acceleration;
+    AlignedVector<float> potential;
+    std::array<AlignedVector<float>, Dim> meshAcceleration;
+    AlignedVector<float> meshPotential;
+
+    StepStatistics stepStatistics;
+    // Summed by the force workers, one update per chunk.
+    std::atomic<uint64_t> interactionCount{0};
+    std::atomic<uint64_t> visitedNodeCount{0};
+    std::atomic<uint64_t> acceptedCellCount{0};
+    std::atomic<uint64_t> particleInteractionCount{0};
+
+    ConservationDiagnostics latestDiagnostics;
+    bool hasPendingDiagnostics = false;
+    bool hasInitialEnergy = false;
+    double initialEnergy = 0.0;
+    // Energy feedback of the adaptive step controller; previousEnergy is set together
+    // with initialEnergy.
+    double previousEnergy = 0.0;
+    double energyStepScale = 1.0;
+};
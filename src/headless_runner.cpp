@@ -0,0 +1,146 @@
+#include "headless_runner.h"
+#include "gravity_simulation.h"
+#include "state_hash.h"
+#include "software_renderer.h"
+#include "frame_writer.h"
+#include "metrics.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+
+[[maybe_unused]] static void printTreeStatistics(const TreeStatistics& tree) {
+    std::printf("tree: nodes=%zu leaves=%zu empty=%.1f%% aggregated=%zu (%zu particles) buckets=%zu "
+                "bytes=%zu of %zu reserved\n",
+                tree.nodes, tree.leaves, 100.0 * tree.emptyLeafRatio(), tree.aggregatedLeaves,
+                tree.aggregatedParticles, tree.bucketLeaves, tree.bytesUsed, tree.bytesReserved);
+    std::printf("tree depth: level nodes particles\n");
+    for (std::size_t level = 0; level < tree.nodesPerDepth.size(); level++) {
+        std::printf("  %2zu %9zu %9zu\n", level, tree.nodesPerDepth[level], tree.particlesPerDepth[level]);
+    }
+}
+
+static void printMemoryStatistics(const MemoryStatistics& memory) {
+    std::printf("memory: aligned=%.1f MiB advised for huge pages=%.1f MiB explicit huge pages=%zu ",
+                memory.alignedBytes / 1048576.0, memory.advisedBytes / 1048576.0, memory.explicitHugePages);
+    if (!memory.transparentHugePagesSupported) {
+        std::printf("transparent huge pages=unsupported");
+    } else if (memory.transparentHugePagesKnown) {
+        std::printf("transparent huge pages=%zu", memory.transparentHugePages);
+    } else {
+        std::printf("transparent huge pages=unknown");
+    }
+    std::printf(" fallbacks=%zu\n", memory.fallbacks);
+}
+
+template <int Dim>
+static int runHeadlessSteps(const AppConfig& config) {
+    ThreadPool pool(config.workerThreads);
+    GravitySimulation<Dim> simulation(pool, config.particleCount, config.deterministicSeed, config.galaxyPreset);
+    simulation.params().openingCriterion = config.openingCriterion;
+    simulation.params().forceSolver = config.forceSolver;
+    simulation.params().treeType = config.treeType;
+    simulation.params().integrator = config.integrator;
+    simulation.params().positionPrecision = config.positionPrecision;
+    simulation.params().timeStep = config.timeStep;
+    simulation.params().massAssignment = config.massAssignment;
+    simulation.params().meshSize = config.meshSize;
+    simulation.params().residentWorkers = config.residentWorkers;
+    simulation.params().particleGrain = config.particleGrain;
+    simulation.params().treeBucketSize = config.treeBucketSize;
+    simulation.params().interactionLists = config.interactionLists;
+    simulation.params().interactionListMargin = config.interactionListMargin;
+    simulation.params().diagnosticsInterval = config.diagnosticsInterval;
+
+    if (!config.initialConditionsPath.empty()) {
+        const auto importStart = std::chrono::steady_clock::now();
+        if (!simulation.loadParticlesFromFile(config.initialConditionsPath)) return 2;
+        std::printf("imported %zu particles from %s in %.3fs\n", simulation.particles().count(),
+                    config.initialConditionsPath.c_str(),
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - importStart).count());
+    }
+
+    StateHashMonitor hashMonitor;
+    if (!hashMonitor.configure(config.hashIntervalSteps, config.hashLogPath, config.hashVerifyPath)) return 2;
+
+    SimulationMetrics metrics;
+    MetricsServer metricsServer;
+    if (config.metricsPort > 0 && !metricsServer.start(config.metricsPort, metrics)) return 2;
+
+    // The renderer shares the simulation's workers; the two never run at the same time.
+    const FrameOutputConfig& frames = config.frames;
+    std::unique_ptr<SoftwareRenderer> renderer;
+    FrameWriter frameWriter;
+    WorldView view;
+    double renderSeconds = 0.0;
+    if (frames.enabled()) {
+        if (!frameWriter.open(frames.directory, frames.pipeCommand, frames.width, frames.height)) return 2;
+        renderer = std::make_unique<SoftwareRenderer>(pool, frames.width, frames.height);
+        renderer->setQualityPreset(frames.qualityPreset);
+        view.width = frames.viewWidth;
+        view.height = frames.viewWidth * (float)frames.height / (float)frames.width;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    StepStatistics walkTotals;
+
+    for (int step = 0; step < config.headlessSteps; step++) {
+        simulation.advance();
+        if constexpr (kCollectTreeStatistics) {
+            const StepStatistics& last = simulation.lastStepStatistics();
+            walkTotals.treeSeconds += last.treeSeconds;
+            walkTotals.forceSeconds += last.forceSeconds;
+            walkTotals.nodesVisited += last.nodesVisited;
+            walkTotals.cellsAccepted += last.cellsAccepted;
+            walkTotals.particleInteractions += last.particleInteractions;
+        }
+        if (config.metricsPort > 0) metrics.publish(simulation.lastStepStatistics(), simulation.particles().count(), pool);
+
+        ConservationDiagnostics diagnostics;
+        if (simulation.takeDiagnostics(diagnostics)) printDiagnostics(diagnostics);
+
+        if (hashMonitor.due(simulation.stepCount()) &&
+            !hashMonitor.submit(simulation.stepCount(), simulation.computeStateHash())) {
+            return 1;
+        }
+
+        if (renderer && simulation.stepCount() % (uint64_t)frames.intervalSteps == 0) {
+            auto renderStart = std::chrono::steady_clock::now();
+            renderer->render(simulation.particles(), view);
+            renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+            if (!frameWriter.write(renderer->frame())) return 2;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%dD N=%zu steps=%" PRIu64 " wall=%.3fs steps/s=%.1f hash=%016" PRIx64 "\n",
+                Dim, simulation.particles().count(), simulation.stepCount(), seconds,
+                (seconds > 0.0) ? (double)simulation.stepCount() / seconds : 0.0,
+                simulation.computeStateHash());
+    std::printf("simulated=%.3fs force evaluations=%" PRIu64 " (%.1f per simulated second)\n",
+                simulation.simulationTime(), simulation.forceEvaluationCount(),
+                simulation.simulationTime() > 0.0 ? (double)simulation.forceEvaluationCount() / simulation.simulationTime() : 0.0);
+    printMemoryStatistics(memoryStatistics());
+    if constexpr (kCollectTreeStatistics) {
+        const double particleSteps = (double)simulation.particles().count() * (double)simulation.stepCount();
+        if (particleSteps > 0.0) {
+            std::printf("walk per particle and step: visited=%.1f accepted=%.1f pairs=%.1f tree=%.3fs force=%.3fs\n",
+                        (double)walkTotals.nodesVisited / particleSteps,
+                        (double)walkTotals.cellsAccepted / particleSteps,
+                        (double)walkTotals.particleInteractions / particleSteps, walkTotals.treeSeconds,
+                        walkTotals.forceSeconds);
+        }
+        if (simulation.treeIsCurrent()) printTreeStatistics(simulation.treeStatistics());
+    }
+    if (renderer) {
+        std::printf("frames=%d %dx%d render=%.3fs (%.1f ms/frame)\n", frameWriter.framesWritten(),
+                    frames.width, frames.height, renderSeconds,
+                    frameWriter.framesWritten() > 0 ? 1000.0 * renderSeconds / frameWriter.framesWritten() : 0.0);
+    }
+    return 0;
+}
+
+int runHeadless(const AppConfig& config) {
+    if (config.dimensions == 3) return runHeadlessSteps<3>(config);
+    return runHeadlessSteps<2>(config);
+}
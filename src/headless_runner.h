@@ -0,0 +1,5 @@
+#pragma once
+#include "app_config.h"
+
+// Runs config.headlessSteps fixed steps without a window. Returns the process exit code.
+int runHeadless(const AppConfig& config);
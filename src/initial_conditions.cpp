@@ -0,0 +1,150 @@
+#include "initial_conditions.h"
+#include "counter_rng.h"
+#include <algorithm>
+#include <cmath>
+
+struct DiscSpec {
+    std::array<float, 2> center = { 0.0f, 0.0f };
+    std::array<float, 2> drift = { 0.0f, 0.0f };
+    float innerRadius = 0.0f;
+    float outerRadius = 560.0f;
+    float spin = 1.0f;
+    float speedScale = 1.0f;
+    float centralMass = 24000.0f;
+};
+
+struct PresetLayout {
+    DiscSpec discs[2];
+    int discCount = 1;
+    float bulgeFraction = 0.0f;
+};
+
+static PresetLayout presetLayout(GalaxyPreset preset) {
+    PresetLayout layout;
+    switch (preset) {
+    case GalaxyPreset::Disc:
+        break;
+    case GalaxyPreset::Bulge:
+        layout.bulgeFraction = 0.25f;
+        break;
+    case GalaxyPreset::Ring:
+        layout.discs[0].innerRadius = 320.0f;
+        layout.discs[0].speedScale = 1.1f;
+        break;
+    case GalaxyPreset::Merger:
+        layout.discCount = 2;
+        for (DiscSpec& disc : layout.discs) {
+            disc.outerRadius = 380.0f;
+            disc.speedScale = 0.8f;
+            disc.centralMass = 12000.0f;
+        }
+        layout.discs[0].center = { -520.0f, -160.0f };
+        layout.discs[0].drift = { 70.0f, 18.0f };
+        layout.discs[1].center = { 520.0f, 160.0f };
+        layout.discs[1].drift = { -70.0f, -18.0f };
+        layout.discs[1].spin = -1.0f;
+        break;
+    }
+    return layout;
+}
+
+template <int Dim>
+static void writeParticle(Particles<Dim>& particles, std::size_t i, CounterRngStream& rng,
+                          const DiscSpec& disc, bool inBulge) {
+    float u = rng.nextFloat01();
+    float radius;
+    if (inBulge) {
+        radius = u * 0.3f * disc.outerRadius;
+    } else {
+        float inner = disc.innerRadius / disc.outerRadius;
+        radius = std::sqrt(inner * inner + (1.0f - inner * inner) * u) * disc.outerRadius;
+    }
+    float angle = rng.range(0.0f, 6.2831853f);
+
+    float baseSpeed = std::sqrt(std::max(25.0f, radius)) * 5.0f * disc.speedScale;
+    float tangentX = -std::sin(angle) * disc.spin;
+    float tangentY =  std::cos(angle) * disc.spin;
+
+    float speedJitter = rng.range(0.86f, 1.14f);
+    float speed = baseSpeed * speedJitter * (inBulge ? 0.6f : 1.0f);
+
+    particles.position[0][i] = disc.center[0] + radius * std::cos(angle);
+    particles.position[1][i] = disc.center[1] + radius * std::sin(angle);
+    particles.velocity[0][i] = disc.drift[0] + tangentX * speed;
+    particles.velocity[1][i] = disc.drift[1] + tangentY * speed;
+
+    if (inBulge) {
+        // Bulge stars are dynamically hot: add an isotropic dispersion on top of the rotation.
+        particles.velocity[0][i] += rng.range(-0.35f, 0.35f) * baseSpeed;
+        particles.velocity[1][i] += rng.range(-0.35f, 0.35f) * baseSpeed;
+    }
+
+    float m = rng.range(0.65f, 1.55f);
+    if ((rng.nextU32() & 2047u) == 0u) m *= 70.0f;
+    particles.mass[i] = m;
+    particles.flags[i] = 0;
+
+    if constexpr (Dim == 3) {
+        // Thin disc that flares slightly with radius; the bulge is roughly spherical.
+        float thickness = inBulge ? radius : (6.0f + 0.03f * radius);
+        particles.position[2][i] = (rng.nextFloat01() + rng.nextFloat01() - 1.0f) * thickness;
+        particles.velocity[2][i] = rng.range(-1.0f, 1.0f) * (inBulge ? 0.35f : 0.1f) * baseSpeed;
+    }
+}
+
+bool parseGalaxyPreset(const std::string& name, GalaxyPreset& outPreset) {
+    static const GalaxyPreset kAll[] = { GalaxyPreset::Disc, GalaxyPreset::Bulge, GalaxyPreset::Ring, GalaxyPreset::Merger };
+    for (GalaxyPreset preset : kAll) {
+        if (name == galaxyPresetName(preset)) {
+            outPreset = preset;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* galaxyPresetName(GalaxyPreset preset) {
+    switch (preset) {
+    case GalaxyPreset::Disc: return "disc";
+    case GalaxyPreset::Bulge: return "bulge";
+    case GalaxyPreset::Ring: return "ring";
+    case GalaxyPreset::Merger: return "merger";
+    }
+    return "disc";
+}
+
+template <int Dim>
+void generateInitialConditions(Particles<Dim>& particles, GalaxyPreset preset,
+                               int particleCount, uint32_t seed, ThreadPool& pool) {
+    const PresetLayout layout = presetLayout(preset);
+    const std::size_t bodyCount = (std::size_t)std::max(0, particleCount);
+
+    particles.resize(bodyCount + (std::size_t)layout.discCount);
+
+    const CounterRng rng(seed);
+    const std::size_t perDisc = (bodyCount + (std::size_t)layout.discCount - 1) / (std::size_t)layout.discCount;
+    const uint32_t bulgeThreshold = (uint32_t)(layout.bulgeFraction * 4294967295.0f);
+
+    pool.parallelFor(0, bodyCount, 8192, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            CounterRngStream stream(rng, i);
+            bool inBulge = layout.bulgeFraction > 0.0f && stream.nextU32() < bulgeThreshold;
+            const DiscSpec& disc = layout.discs[std::min<std::size_t>(i / perDisc, (std::size_t)layout.discCount - 1)];
+            writeParticle<Dim>(particles, i, stream, disc, inBulge);
+        }
+    });
+
+    for (int k = 0; k < layout.discCount; k++) {
+        const DiscSpec& disc = layout.discs[k];
+        std::size_t i = bodyCount + (std::size_t)k;
+        for (int d = 0; d < Dim; d++) {
+            particles.position[d][i] = (d < 2) ? disc.center[d] : 0.0f;
+            particles.velocity[d][i] = (d < 2) ? disc.drift[d] : 0.0f;
+        }
+        particles.mass[i] = disc.centralMass;
+        particles.flags[i] = ParticleFlagCentralBody;
+    }
+}
+
+template void generateInitialConditions<2>(Particles<2>&, GalaxyPreset, int, uint32_t, ThreadPool&);
+template void generateInitialConditions<3>(Particles<3>&, GalaxyPreset, int, uint32_t, ThreadPool&);
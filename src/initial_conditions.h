@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "particles.h"
+#include "thread_pool.h"
+
+enum class GalaxyPreset {
+    Disc,
+    Bulge,
+    Ring,
+    Merger
+};
+
+bool parseGalaxyPreset(const std::string& name, GalaxyPreset& outPreset);
+const char* galaxyPresetName(GalaxyPreset preset);
+
+// Fills `particles` with `particleCount` bodies followed by the preset's central masses.
+// Every particle draws from its own counter-based stream keyed by (seed, index), so the
+// output is bitwise identical for any worker count.
+template <int Dim>
+void generateInitialConditions(Particles<Dim>& particles, GalaxyPreset preset,
+                               int particleCount, uint32_t seed, ThreadPool& pool);
@@ -0,0 +1,398 @@
+#include "interaction_lists.h"
+#include <algorithm>
+#include <cmath>
+
+// A refitted tree loosens as particles mix, so it is rebuilt after this many steps or
+// once this share of the groups had to re-walk in one step.
+static constexpr int kMaxTreeAge = 32;
+static constexpr float kMaxRewalkFraction = 0.25f;
+
+template <int Dim>
+bool InteractionLists<Dim>::BuildKey::operator==(const BuildKey& other) const {
+    return particleCount == other.particleCount && theta == other.theta && criterion == other.criterion &&
+           relativeAccuracy == other.relativeAccuracy && softeningLength == other.softeningLength &&
+           margin == other.margin && treeType == other.treeType && treeBucketSize == other.treeBucketSize;
+}
+
+template <int Dim>
+typename InteractionLists<Dim>::BuildKey InteractionLists<Dim>::keyFor(const Particles<Dim>& particles,
+                                                                      const SimulationParams& params) {
+    BuildKey key;
+    key.particleCount = particles.count();
+    key.theta = params.barnesHutTheta;
+    key.criterion = params.openingCriterion;
+    key.relativeAccuracy = params.relativeForceAccuracy;
+    key.softeningLength = params.softeningLength;
+    key.margin = params.interactionListMargin;
+    key.treeType = params.treeType;
+    key.treeBucketSize = params.treeBucketSize;
+    return key;
+}
+
+template <int Dim>
+void InteractionLists<Dim>::invalidate() {
+    valid = false;
+}
+
+template <int Dim>
+std::size_t InteractionLists<Dim>::groupCount() const {
+    return groups.size();
+}
+
+template <int Dim>
+float InteractionLists<Dim>::rewalkFraction() const {
+    return lastRewalkFraction;
+}
+
+template <int Dim>
+bool InteractionLists<Dim>::needsRebuild(const Particles<Dim>& particles, const SimulationParams& params) const {
+    return !valid || !(keyFor(particles, params) == builtKey) || treeAge >= kMaxTreeAge ||
+           lastRewalkFraction > kMaxRewalkFraction;
+}
+
+template <int Dim>
+void InteractionLists<Dim>::reset(const BarnesHutTree<Dim>& tree, const Particles<Dim>& particles,
+                                  const SimulationParams& params) {
+    using Node = BarnesHutNode<Dim>;
+    const AlignedVector<Node>& nodes = tree.nodes();
+
+    groups.clear();
+    members = tree.particleOrder();
+    builtKey = keyFor(particles, params);
+    valid = true;
+    treeAge = 0;
+    lastRewalkFraction = 0.0f;
+    if (nodes.empty()) return;
+
+    // Groups are the largest subtrees with at most kGroupSize members, in depth-first order.
+    const int nodeEnd = (int)nodes.size();
+    int nodeIndex = 0;
+    while (nodeIndex < nodeEnd) {
+        const Node& node = nodes[(std::size_t)nodeIndex];
+        if (node.particleCount > kGroupSize && !node.isLeaf()) {
+            nodeIndex = node.childIndex[0];
+            continue;
+        }
+        if (node.particleCount > 0) {
+            Group group;
+            group.firstMember = node.firstParticle;
+            group.memberCount = node.particleCount;
+            groups.push_back(std::move(group));
+        }
+        nodeIndex = node.skipIndex;
+    }
+}
+
+template <int Dim>
+void InteractionLists<Dim>::finishStep() {
+    std::size_t rewalked = 0;
+    for (const Group& group : groups) {
+        if (group.rewalked) rewalked++;
+    }
+    lastRewalkFraction = groups.empty() ? 0.0f : (float)rewalked / (float)groups.size();
+    treeAge++;
+}
+
+template <int Dim>
+static inline bool nodeOverlapsBox(const BarnesHutNode<Dim>& node,
+                                   const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) {
+    for (int d = 0; d < Dim; d++) {
+        if (node.center[d] + node.halfSize < lo[d] || node.center[d] - node.halfSize > hi[d]) return false;
+    }
+    return true;
+}
+
+// Thresholds of the opening test for one group. slack < 1 tightens it: lists are built
+// with slack = 1 - margin and kept while the test holds with slack = 1. Under a focus
+// region both thresholds follow the group's theta, the error scaling as theta^2.
+struct OpeningThresholds {
+    float thetaSquared;
+    float errorBudget;
+};
+
+template <int Dim>
+static OpeningThresholds openingThresholds(const SimulationParams& params, float slack, float errorBudget,
+                                           const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) {
+    const float theta = params.barnesHutTheta;
+    const float groupTheta = params.focus.thetaFor(theta, lo[0], lo[1], hi[0], hi[1]);
+    const float focusScale = (theta > 0.0f) ? (groupTheta * groupTheta) / (theta * theta) : 1.0f;
+    const float slackSquared = slack * slack;
+    return { slackSquared * groupTheta * groupTheta, slackSquared * focusScale * errorBudget };
+}
+
+// The opening test for every point of the group box at once, using the nearest point
+// to the node's centre of mass.
+template <int Dim>
+static inline bool acceptNode(const BarnesHutNode<Dim>& node,
+                              const std::array<float, Dim>& lo, const std::array<float, Dim>& hi,
+                              const SimulationParams& params, bool relative, const OpeningThresholds& thresholds) {
+    float d2 = params.softeningLength * params.softeningLength;
+    for (int d = 0; d < Dim; d++) {
+        const float c = node.centerOfMass[d];
+        const float gap = std::max(0.0f, std::max(lo[d] - c, c - hi[d]));
+        d2 += gap * gap;
+    }
+    const float s = node.halfSize * 2.0f;
+    if (relative) {
+        return (params.gravitationalConstant * node.totalMass * s * s) <= (thresholds.errorBudget * d2 * d2);
+    }
+    return (s * s) < (thresholds.thetaSquared * d2);
+}
+
+// Adds one source to members [begin, end). Sources outer and members inner: the loop has
+// no reduction and vectorizes, and each member still sums its sources in list order.
+template <int Dim, std::size_t kCount>
+static inline void accumulateSource(const std::array<float, Dim>& sp, float gm, float softeningSquared,
+                                    const std::array<std::array<float, kCount>, Dim>& memberPosition,
+                                    std::array<std::array<float, kCount>, Dim>& memberAcceleration,
+                                    std::array<float, kCount>& memberPotential, int begin, int end) {
+    for (int k = begin; k < end; k++) {
+        std::array<float, Dim> delta;
+        float r2 = softeningSquared;
+        for (int d = 0; d < Dim; d++) {
+            delta[d] = sp[d] - memberPosition[d][(std::size_t)k];
+            r2 += delta[d] * delta[d];
+        }
+        const float invR = 1.0f / std::sqrt(r2);
+        const float scale = gm * invR * invR * invR;
+        for (int d = 0; d < Dim; d++) memberAcceleration[d][(std::size_t)k] += delta[d] * scale;
+        memberPotential[(std::size_t)k] -= gm * invR;
+    }
+}
+
+template <int Dim>
+void InteractionLists<Dim>::walk(Group& group, const BarnesHutTree<Dim>& tree, const SimulationParams& params,
+                                 const std::array<AlignedVector<float>, Dim>& previousAcceleration,
+                                 const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) const {
+    using Node = BarnesHutNode<Dim>;
+    const AlignedVector<Node>& nodes = tree.nodes();
+    const float slack = 1.0f - std::clamp(params.interactionListMargin, 0.0f, 0.9f);
+
+    // Same fallback as the per-particle walk: without a previous acceleration for every
+    // member the geometric test is used.
+    group.errorBudget = 0.0f;
+    if (params.openingCriterion == OpeningCriterion::RelativeAcceleration) {
+        for (int k = 0; k < group.memberCount; k++) {
+            const std::size_t i = (std::size_t)members[(std::size_t)(group.firstMember + k)];
+            float a2 = 0.0f;
+            for (int d = 0; d < Dim; d++) a2 += previousAcceleration[d][i] * previousAcceleration[d][i];
+            const float budget = params.relativeForceAccuracy * std::sqrt(a2);
+            group.errorBudget = (k == 0) ? budget : std::min(group.errorBudget, budget);
+        }
+    }
+    const bool relative = group.errorBudget > 0.0f;
+    const OpeningThresholds thresholds = openingThresholds<Dim>(params, slack, group.errorBudget, lo, hi);
+
+    group.nodes.clear();
+    group.particles.clear();
+    group.selfLeaves.clear();
+
+    // Same stackless walk as the per-particle one.
+    const int nodeEnd = (int)nodes.size();
+    int next = 0;
+    while (next < nodeEnd) {
+        const int nodeIndex = next;
+        const Node& node = nodes[(std::size_t)nodeIndex];
+        next = node.skipIndex;
+        if (node.totalMass <= 0.0f) continue;
+
+        // Every node holding a member overlaps the group box, so accepted nodes and plain
+        // aggregated leaves never contain the group's own particles.
+        const bool overlaps = nodeOverlapsBox<Dim>(node, lo, hi);
+
+        if (node.isLeaf()) {
+            if (node.particleIndex >= 0) {
+                // The group's own particles interact through the member pass instead.
+                const bool member = node.firstParticle >= group.firstMember &&
+                                    node.firstParticle < group.firstMember + group.memberCount;
+                if (!member) group.particles.push_back(node.particleIndex);
+            } else if (node.particleIndex == -3) {
+                // Buckets lie within one group, so they are either all members or none.
+                const bool member = node.firstParticle >= group.firstMember &&
+                                    node.firstParticle < group.firstMember + group.memberCount;
+                if (member) continue;
+                const std::vector<int>& order = tree.particleOrder();
+                group.particles.insert(group.particles.end(), order.begin() + node.firstParticle,
+                                       order.begin() + node.firstParticle + node.particleCount);
+            } else if (overlaps) {
+                group.selfLeaves.push_back(nodeIndex);
+            } else {
+                group.nodes.push_back(nodeIndex);
+            }
+            continue;
+        }
+
+        if (!overlaps && acceptNode<Dim>(node, lo, hi, params, relative, thresholds)) {
+            group.nodes.push_back(nodeIndex);
+        } else {
+            next = node.childIndex[0];
+        }
+    }
+}
+
+template <int Dim>
+bool InteractionLists<Dim>::stillValid(const Group& group, const BarnesHutTree<Dim>& tree,
+                                       const SimulationParams& params,
+                                       const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) const {
+    const auto& nodes = tree.nodes();
+    const bool relative = group.errorBudget > 0.0f;
+    const OpeningThresholds thresholds = openingThresholds<Dim>(params, 1.0f, group.errorBudget, lo, hi);
+    for (int nodeIndex : group.nodes) {
+        const BarnesHutNode<Dim>& node = nodes[(std::size_t)nodeIndex];
+        if (nodeOverlapsBox<Dim>(node, lo, hi)) return false;
+        if (node.isLeaf()) continue;
+        if (!acceptNode<Dim>(node, lo, hi, params, relative, thresholds)) return false;
+    }
+    return true;
+}
+
+template <int Dim>
+uint64_t InteractionLists<Dim>::updateAndEvaluate(std::size_t begin, std::size_t end,
+                                                  const BarnesHutTree<Dim>& tree, const Particles<Dim>& particles,
+                                                  const SimulationParams& params,
+                                                  std::array<AlignedVector<float>, Dim>& acceleration,
+                                                  AlignedVector<float>* outPotential) {
+    uint64_t interactions = 0;
+    for (std::size_t g = begin; g < end; g++) {
+        Group& group = groups[g];
+
+        std::array<float, Dim> lo;
+        std::array<float, Dim> hi;
+        for (int k = 0; k < group.memberCount; k++) {
+            const std::size_t i = (std::size_t)members[(std::size_t)(group.firstMember + k)];
+            for (int d = 0; d < Dim; d++) {
+                const float x = particles.position[d][i];
+                lo[d] = (k == 0) ? x : std::min(lo[d], x);
+                hi[d] = (k == 0) ? x : std::max(hi[d], x);
+            }
+        }
+
+        group.rewalked = group.stale || !stillValid(group, tree, params, lo, hi);
+        if (group.rewalked) {
+            walk(group, tree, params, acceleration, lo, hi);
+            group.stale = false;
+        }
+        evaluate(group, tree, particles, params, acceleration, outPotential);
+        const std::size_t sources = group.nodes.size() + group.particles.size() + group.selfLeaves.size() +
+                                    (std::size_t)group.memberCount - 1;
+        interactions += (uint64_t)group.memberCount * sources;
+    }
+    return interactions;
+}
+
+template <int Dim>
+void InteractionLists<Dim>::evaluate(const Group& group, const BarnesHutTree<Dim>& tree,
+                                     const Particles<Dim>& particles, const SimulationParams& params,
+                                     std::array<AlignedVector<float>, Dim>& outAcceleration,
+                                     AlignedVector<float>* outPotential) const {
+    using Node = BarnesHutNode<Dim>;
+    const AlignedVector<Node>& nodes = tree.nodes();
+    const std::vector<int>& particleLeaf = tree.particleLeaves();
+    const float G = params.gravitationalConstant;
+    const float softeningSquared = params.softeningLength * params.softeningLength;
+
+    // Monopoles and leaf particles in one source array, kept per worker thread so groups
+    // and steps reuse the same storage.
+    const std::size_t sourceCount = group.nodes.size() + group.particles.size();
+    thread_local std::array<std::vector<float>, Dim> sourcePosition;
+    thread_local std::vector<float> sourceMass;
+    sourceMass.resize(sourceCount);
+    for (int d = 0; d < Dim; d++) sourcePosition[d].resize(sourceCount);
+    std::size_t s = 0;
+    for (int nodeIndex : group.nodes) {
+        const Node& node = nodes[(std::size_t)nodeIndex];
+        for (int d = 0; d < Dim; d++) sourcePosition[d][s] = node.centerOfMass[d];
+        sourceMass[s++] = node.totalMass;
+    }
+    for (int j : group.particles) {
+        for (int d = 0; d < Dim; d++) sourcePosition[d][s] = particles.position[d][(std::size_t)j];
+        sourceMass[s++] = particles.mass[(std::size_t)j];
+    }
+
+    std::array<std::array<float, kGroupSize>, Dim> memberPosition;
+    std::array<std::array<float, kGroupSize>, Dim> memberAcceleration;
+    std::array<float, kGroupSize> memberPotential;
+
+    // Aggregated leaves at the depth limit can exceed the group size; they are processed
+    // in slices.
+    for (int sliceStart = 0; sliceStart < group.memberCount; sliceStart += kGroupSize) {
+        const int count = std::min(kGroupSize, group.memberCount - sliceStart);
+        const int* memberIndex = members.data() + group.firstMember + sliceStart;
+
+        for (int k = 0; k < count; k++) {
+            for (int d = 0; d < Dim; d++) {
+                memberPosition[d][(std::size_t)k] = particles.position[d][(std::size_t)memberIndex[k]];
+                memberAcceleration[d][(std::size_t)k] = 0.0f;
+            }
+            memberPotential[(std::size_t)k] = 0.0f;
+        }
+
+        for (std::size_t e = 0; e < sourceCount; e++) {
+            std::array<float, Dim> sp;
+            for (int d = 0; d < Dim; d++) sp[d] = sourcePosition[d][e];
+            accumulateSource<Dim>(sp, G * sourceMass[e], softeningSquared, memberPosition, memberAcceleration,
+                                  memberPotential, 0, count);
+        }
+
+        // Members that sit in their own leaves act on each other directly; the two
+        // ranges skip the member itself.
+        for (int j = 0; j < group.memberCount; j++) {
+            const std::size_t source = (std::size_t)members[(std::size_t)(group.firstMember + j)];
+            if (nodes[(std::size_t)particleLeaf[source]].particleIndex == -2) continue;
+            std::array<float, Dim> sp;
+            for (int d = 0; d < Dim; d++) sp[d] = particles.position[d][source];
+            const float gm = G * particles.mass[source];
+            const int local = j - sliceStart;
+            if (local >= 0 && local < count) {
+                accumulateSource<Dim>(sp, gm, softeningSquared, memberPosition, memberAcceleration, memberPotential,
+                                      0, local);
+                accumulateSource<Dim>(sp, gm, softeningSquared, memberPosition, memberAcceleration, memberPotential,
+                                      local + 1, count);
+            } else {
+                accumulateSource<Dim>(sp, gm, softeningSquared, memberPosition, memberAcceleration, memberPotential,
+                                      0, count);
+            }
+        }
+
+        for (int k = 0; k < count; k++) {
+            const std::size_t i = (std::size_t)memberIndex[k];
+            const float pm = particles.mass[i];
+            std::array<float, Dim> a;
+            for (int d = 0; d < Dim; d++) a[d] = memberAcceleration[d][(std::size_t)k];
+            float phi = memberPotential[(std::size_t)k];
+
+            const int ownLeaf = particleLeaf[i];
+
+            for (int leafIndex : group.selfLeaves) {
+                const Node& leaf = nodes[(std::size_t)leafIndex];
+                float sourceMassHere = leaf.totalMass;
+                std::array<float, Dim> source = leaf.centerOfMass;
+                if (leafIndex == ownLeaf) {
+                    sourceMassHere = leaf.totalMass - pm;
+                    if (sourceMassHere <= 0.0f) continue;
+                    for (int d = 0; d < Dim; d++) {
+                        source[d] = (leaf.centerOfMass[d] * leaf.totalMass - particles.position[d][i] * pm) /
+                                    sourceMassHere;
+                    }
+                }
+                std::array<float, Dim> delta;
+                float r2 = softeningSquared;
+                for (int d = 0; d < Dim; d++) {
+                    delta[d] = source[d] - particles.position[d][i];
+                    r2 += delta[d] * delta[d];
+                }
+                if (r2 <= 0.0f) continue;
+                const float invR = 1.0f / std::sqrt(r2);
+                const float scale = G * sourceMassHere * invR * invR * invR;
+                for (int d = 0; d < Dim; d++) a[d] += delta[d] * scale;
+                phi -= G * sourceMassHere * invR;
+            }
+
+            for (int d = 0; d < Dim; d++) outAcceleration[d][i] = a[d];
+            if (outPotential) (*outPotential)[i] = phi;
+        }
+    }
+}
+
+template class InteractionLists<2>;
+template class InteractionLists<3>;
@@ -0,0 +1,87 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "barnes_hut.h"
+#include "particles.h"
+#include "simulation_params.h"
+#include "thread_pool.h"
+
+// Tree interaction lists cached across steps (Verlet-style). Particles are grouped into
+// small subtrees of one tree build, and each group walks the tree with the opening test
+// tightened by params.interactionListMargin. On later steps the tree is only refitted; a
+// group keeps its list while every cached node still passes the plain test against the
+// current positions, i.e. until motion has used up the margin, and forces come straight
+// from the list without traversal.
+template <int Dim>
+class InteractionLists {
+public:
+    static constexpr int kGroupSize = 32;
+
+    // True when the tree should be rebuilt and the lists started over: never built,
+    // parameters changed, the tree is old, or too many groups had to re-walk last step.
+    bool needsRebuild(const Particles<Dim>& particles, const SimulationParams& params) const;
+    // Forms the groups of a freshly built tree; every group walks on its next update.
+    void reset(const BarnesHutTree<Dim>& tree, const Particles<Dim>& particles, const SimulationParams& params);
+    void invalidate();
+
+    std::size_t groupCount() const;
+    // Re-walks groups [begin, end) whose lists no longer hold and evaluates their forces.
+    // The tree must have been refitted to the current positions. previousAcceleration and
+    // outAcceleration may be the same arrays; a group reads its members' old values first.
+    // Returns the number of source terms evaluated.
+    uint64_t updateAndEvaluate(std::size_t begin, std::size_t end, const BarnesHutTree<Dim>& tree,
+                               const Particles<Dim>& particles, const SimulationParams& params,
+                               std::array<AlignedVector<float>, Dim>& acceleration, AlignedVector<float>* outPotential);
+    // Counts the groups that re-walked during the step and ages the tree.
+    void finishStep();
+
+    // Fraction of groups that had to re-walk in the last step.
+    float rewalkFraction() const;
+
+private:
+    struct Group {
+        int firstMember = 0;
+        int memberCount = 0;
+        bool stale = true;
+        bool rewalked = false;
+        float errorBudget = 0.0f;
+        // Accepted nodes (monopoles), leaf particles and aggregated leaves that may hold
+        // the group's own members.
+        std::vector<int> nodes;
+        std::vector<int> particles;
+        std::vector<int> selfLeaves;
+    };
+
+    struct BuildKey {
+        std::size_t particleCount = 0;
+        float theta = 0.0f;
+        OpeningCriterion criterion = OpeningCriterion::Geometric;
+        float relativeAccuracy = 0.0f;
+        float softeningLength = 0.0f;
+        float margin = 0.0f;
+        TreeType treeType = TreeType::Octree;
+        int treeBucketSize = 0;
+
+        bool operator==(const BuildKey& other) const;
+    };
+
+    static BuildKey keyFor(const Particles<Dim>& particles, const SimulationParams& params);
+
+    void walk(Group& group, const BarnesHutTree<Dim>& tree, const SimulationParams& params,
+              const std::array<AlignedVector<float>, Dim>& previousAcceleration,
+              const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) const;
+    bool stillValid(const Group& group, const BarnesHutTree<Dim>& tree, const SimulationParams& params,
+                    const std::array<float, Dim>& lo, const std::array<float, Dim>& hi) const;
+    void evaluate(const Group& group, const BarnesHutTree<Dim>& tree, const Particles<Dim>& particles,
+                  const SimulationParams& params, std::array<AlignedVector<float>, Dim>& outAcceleration,
+                  AlignedVector<float>* outPotential) const;
+
+    bool valid = false;
+    BuildKey builtKey;
+    int treeAge = 0;
+    float lastRewalkFraction = 0.0f;
+
+    std::vector<Group> groups;
+    std::vector<int> members;
+};
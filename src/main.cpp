@@ -1,148 +1,268 @@
-#include <SFML/Graphics.hpp>
-#include <string>
-#include <algorithm>
-#include <sstream>
-#include <iomanip>
-
-#include "system_info.h"
-#include "app_config.h"
-#include "gravity_simulation.h"
-#include "renderer.h"
-
-int main() {
-    sf::ContextSettings contextSettings;
-    contextSettings.antialiasingLevel = 8;
-
-    sf::RenderWindow window(
-        sf::VideoMode(1600, 1000),
-        "Gravity Simulator",
-        sf::Style::Default,
-        contextSettings
-    );
-
-    window.setVerticalSyncEnabled(true);
-    window.setActive(true);
-
-    sf::View worldView(sf::FloatRect(0.0f, 0.0f, 1600.0f, 1000.0f));
-    worldView.setCenter(0.0f, 0.0f);
-    window.setView(worldView);
-
-    SystemInfo systemInfo = detectSystemInfo();
-    AppConfig config = buildAppConfig(systemInfo);
-
-    GravitySimulation simulation(config.workerThreads, config.particleCount, config.deterministicSeed);
-    Renderer renderer((int)window.getSize().x, (int)window.getSize().y);
-
-    bool isPaused = false;
-
-    bool isPanning = false;
-    sf::Vector2i lastMousePixelPosition;
-
-    double fixedStepAccumulatorSeconds = 0.0;
-    sf::Clock frameClock;
-
-    int frameCounter = 0;
-    sf::Clock fpsClock;
-
-    auto updateWindowTitle = [&](int fps) {
-        std::ostringstream thetaStream;
-        thetaStream << std::fixed << std::setprecision(2) << simulation.params().barnesHutTheta;
-
-        std::string title =
-            "Gravity Simulator | Threads=" + std::to_string(config.workerThreads) +
-            " | N=" + std::to_string(simulation.particles().count()) +
-            " | GPU=" + systemInfo.gpuRendererString +
-            " | theta=" + thetaStream.str() +
-            " | Barnes-Hut" +
-            " | FPS~" + std::to_string(fps);
-
-        window.setTitle(title);
-    };
-
-    updateWindowTitle(0);
-
-    while (window.isOpen()) {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed) {
-                window.close();
-            }
-
-            if (event.type == sf::Event::Resized) {
-                renderer.resize((int)event.size.width, (int)event.size.height);
-            }
-
-            if (event.type == sf::Event::KeyPressed) {
-                if (event.key.code == sf::Keyboard::Escape) window.close();
-                if (event.key.code == sf::Keyboard::Space) isPaused = !isPaused;
-                if (event.key.code == sf::Keyboard::R) simulation.reset();
-
-                if (event.key.code == sf::Keyboard::Up) {
-                    simulation.params().barnesHutTheta = std::min(1.20f, simulation.params().barnesHutTheta + 0.05f);
-                }
-                if (event.key.code == sf::Keyboard::Down) {
-                    simulation.params().barnesHutTheta = std::max(0.25f, simulation.params().barnesHutTheta - 0.05f);
-                }
-
-                if (event.key.code == sf::Keyboard::Num1) renderer.setQualityPreset(1);
-                if (event.key.code == sf::Keyboard::Num2) renderer.setQualityPreset(2);
-                if (event.key.code == sf::Keyboard::Num3) renderer.setQualityPreset(3);
-            }
-
-            if (event.type == sf::Event::MouseWheelScrolled) {
-                float zoomFactor = (event.mouseWheelScroll.delta > 0.0f) ? 0.9f : 1.111111f;
-                worldView.zoom(zoomFactor);
-                window.setView(worldView);
-            }
-
-            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Middle) {
-                isPanning = true;
-                lastMousePixelPosition = sf::Mouse::getPosition(window);
-            }
-
-            if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Middle) {
-                isPanning = false;
-            }
-        }
-
-        if (isPanning) {
-            sf::Vector2i currentMousePixelPosition = sf::Mouse::getPosition(window);
-            sf::Vector2f previousWorld = window.mapPixelToCoords(lastMousePixelPosition);
-            sf::Vector2f currentWorld = window.mapPixelToCoords(currentMousePixelPosition);
-            sf::Vector2f worldDelta = previousWorld - currentWorld;
-
-            worldView.move(worldDelta);
-            window.setView(worldView);
-            lastMousePixelPosition = currentMousePixelPosition;
-        }
-
-        double frameSeconds = frameClock.restart().asSeconds();
-        fixedStepAccumulatorSeconds += frameSeconds;
-
-        if (!isPaused) {
-            const double fixedStepSeconds = simulation.params().fixedTimeStep;
-            if (fixedStepAccumulatorSeconds > fixedStepSeconds) {
-                fixedStepAccumulatorSeconds = fixedStepSeconds;
-            }
-            
-            if (fixedStepAccumulatorSeconds >= fixedStepSeconds) {
-                simulation.stepFixed(fixedStepSeconds);
-                fixedStepAccumulatorSeconds -= fixedStepSeconds;
-            }
-        }
-
-        renderer.render(window, worldView, simulation.particles());
-        window.display();
-
-        frameCounter++;
-        if (fpsClock.getElapsedTime().asSeconds() >= 0.5f) {
-            float seconds = fpsClock.getElapsedTime().asSeconds();
-            int fps = (seconds > 0.0f) ? (int)(frameCounter / seconds) : 0;
-            frameCounter = 0;
-            fpsClock.restart();
-            updateWindowTitle(fps);
-        }
-    }
-
-    return 0;
-}
+#include <SFML/Graphics.hpp>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "system_info.h"
+#include "app_config.h"
+#include "autotune.h"
+#include "gravity_simulation.h"
+#include "renderer.h"
+#include "headless_runner.h"
+#include "sweep_runner.h"
+#include "state_hash.h"
+#include "metrics.h"
+
+template <int Dim>
+static void runSimulation(sf::RenderWindow& window, sf::View& worldView,
+                          const SystemInfo& systemInfo, const AppConfig& config) {
+    GravitySimulation<Dim> simulation(config.workerThreads, config.particleCount, config.deterministicSeed,
+                                      config.galaxyPreset);
+    simulation.params().openingCriterion = config.openingCriterion;
+    simulation.params().forceSolver = config.forceSolver;
+    simulation.params().treeType = config.treeType;
+    simulation.params().integrator = config.integrator;
+    simulation.params().positionPrecision = config.positionPrecision;
+    simulation.params().timeStep = config.timeStep;
+    simulation.params().massAssignment = config.massAssignment;
+    simulation.params().meshSize = config.meshSize;
+    simulation.params().residentWorkers = config.residentWorkers;
+    simulation.params().particleGrain = config.particleGrain;
+    simulation.params().treeBucketSize = config.treeBucketSize;
+    simulation.params().interactionLists = config.interactionLists;
+    simulation.params().interactionListMargin = config.interactionListMargin;
+    simulation.params().diagnosticsInterval = config.diagnosticsInterval;
+    simulation.params().focus.enabled = config.focus;
+    simulation.params().focus.innerTheta = config.focusTheta;
+    // An imported set replaces the preset, also on every reset.
+    const bool imported = !config.initialConditionsPath.empty() &&
+                          simulation.loadParticlesFromFile(config.initialConditionsPath);
+    Renderer renderer((int)window.getSize().x, (int)window.getSize().y);
+    renderer.setPointSprites(config.pointSprites);
+
+    StateHashMonitor hashMonitor;
+    hashMonitor.configure(config.hashIntervalSteps, config.hashLogPath, config.hashVerifyPath);
+
+    SimulationMetrics metrics;
+    MetricsServer metricsServer;
+    const bool exportMetrics = config.metricsPort > 0 && metricsServer.start(config.metricsPort, metrics);
+
+    bool isPaused = false;
+    bool treeCulling = true;
+
+    bool isPanning = false;
+    sf::Vector2i lastMousePixelPosition;
+
+    double fixedStepAccumulatorSeconds = 0.0;
+    sf::Clock frameClock;
+
+    int frameCounter = 0;
+    sf::Clock fpsClock;
+
+    ConservationDiagnostics latestDiagnostics;
+    bool hasDiagnostics = false;
+
+    auto updateWindowTitle = [&](int fps) {
+        std::ostringstream thetaStream;
+        thetaStream << std::fixed << std::setprecision(2) << simulation.params().barnesHutTheta;
+
+        bool relativeOpening = simulation.params().openingCriterion == OpeningCriterion::RelativeAcceleration;
+
+        std::string title =
+            "Gravity Simulator | Threads=" + std::to_string(config.workerThreads) +
+            " | N=" + std::to_string(simulation.particles().count()) +
+            " | " + std::to_string(Dim) + "D" +
+            " | GPU=" + systemInfo.gpuRendererString +
+            " | theta=" + thetaStream.str() +
+            " | Barnes-Hut" + (relativeOpening ? " (relative)" : "") +
+            (simulation.params().focus.enabled ? " | focus" : "") +
+            " | splats=" + std::to_string(renderer.splatCount()) + (treeCulling ? " (LOD)" : "") +
+            " | FPS~" + std::to_string(fps);
+
+        if (hasDiagnostics) {
+            std::ostringstream driftStream;
+            driftStream << std::scientific << std::setprecision(2) << latestDiagnostics.relativeEnergyDrift;
+            title += " | dE/E0=" + driftStream.str();
+        }
+
+        if (hashMonitor.diverged()) {
+            title += " | DIVERGED at step " + std::to_string(hashMonitor.divergedStep());
+        }
+
+        window.setTitle(title);
+    };
+
+    updateWindowTitle(0);
+
+    while (window.isOpen()) {
+        sf::Event event;
+        while (window.pollEvent(event)) {
+            if (event.type == sf::Event::Closed) {
+                window.close();
+            }
+
+            if (event.type == sf::Event::Resized) {
+                renderer.resize((int)event.size.width, (int)event.size.height);
+            }
+
+            if (event.type == sf::Event::KeyPressed) {
+                if (event.key.code == sf::Keyboard::Escape) window.close();
+                if (event.key.code == sf::Keyboard::Space && !hashMonitor.diverged()) isPaused = !isPaused;
+                if (event.key.code == sf::Keyboard::R) {
+                    if (!imported || !simulation.loadParticlesFromFile(config.initialConditionsPath)) simulation.reset();
+                    hasDiagnostics = false;
+                }
+
+                if (event.key.code == sf::Keyboard::Up) {
+                    simulation.params().barnesHutTheta = std::min(1.20f, simulation.params().barnesHutTheta + 0.05f);
+                }
+                if (event.key.code == sf::Keyboard::Down) {
+                    simulation.params().barnesHutTheta = std::max(0.25f, simulation.params().barnesHutTheta - 0.05f);
+                }
+
+                if (event.key.code == sf::Keyboard::C) {
+                    OpeningCriterion& criterion = simulation.params().openingCriterion;
+                    criterion = (criterion == OpeningCriterion::Geometric) ? OpeningCriterion::RelativeAcceleration
+                                                                          : OpeningCriterion::Geometric;
+                }
+
+                if (event.key.code == sf::Keyboard::L) treeCulling = !treeCulling;
+                if (event.key.code == sf::Keyboard::F) {
+                    simulation.params().focus.enabled = !simulation.params().focus.enabled;
+                }
+
+                if (event.key.code == sf::Keyboard::Num1) renderer.setQualityPreset(1);
+                if (event.key.code == sf::Keyboard::Num2) renderer.setQualityPreset(2);
+                if (event.key.code == sf::Keyboard::Num3) renderer.setQualityPreset(3);
+            }
+
+            if (event.type == sf::Event::MouseWheelScrolled) {
+                float zoomFactor = (event.mouseWheelScroll.delta > 0.0f) ? 0.9f : 1.111111f;
+                worldView.zoom(zoomFactor);
+                window.setView(worldView);
+            }
+
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Middle) {
+                isPanning = true;
+                lastMousePixelPosition = sf::Mouse::getPosition(window);
+            }
+
+            if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Middle) {
+                isPanning = false;
+            }
+        }
+
+        if (isPanning) {
+            sf::Vector2i currentMousePixelPosition = sf::Mouse::getPosition(window);
+            sf::Vector2f previousWorld = window.mapPixelToCoords(lastMousePixelPosition);
+            sf::Vector2f currentWorld = window.mapPixelToCoords(currentMousePixelPosition);
+            sf::Vector2f worldDelta = previousWorld - currentWorld;
+
+            worldView.move(worldDelta);
+            window.setView(worldView);
+            lastMousePixelPosition = currentMousePixelPosition;
+        }
+
+        double frameSeconds = frameClock.restart().asSeconds();
+        fixedStepAccumulatorSeconds += frameSeconds;
+
+        if (simulation.params().focus.enabled) {
+            // The region follows the view, grown so particles about to scroll in are
+            // already accurate.
+            FocusRegion& focus = simulation.params().focus;
+            const sf::Vector2f center = worldView.getCenter();
+            const sf::Vector2f size = worldView.getSize();
+            focus.minX = center.x - 0.5f * size.x;
+            focus.maxX = center.x + 0.5f * size.x;
+            focus.minY = center.y - 0.5f * size.y;
+            focus.maxY = center.y + 0.5f * size.y;
+            focus.margin = 0.25f * std::max(size.x, size.y);
+        }
+
+        if (!isPaused) {
+            const double fixedStepSeconds = simulation.params().fixedTimeStep;
+            if (fixedStepAccumulatorSeconds > fixedStepSeconds) {
+                fixedStepAccumulatorSeconds = fixedStepSeconds;
+            }
+            
+            if (fixedStepAccumulatorSeconds >= fixedStepSeconds) {
+                // An adaptive step may be longer or shorter than fixedTimeStep; charging what
+                // it actually took keeps simulated time on wall time.
+                fixedStepAccumulatorSeconds -= simulation.advance();
+                if (exportMetrics) {
+                    metrics.publish(simulation.lastStepStatistics(), simulation.particles().count(),
+                                    simulation.workerPool());
+                }
+
+                if (simulation.takeDiagnostics(latestDiagnostics)) {
+                    hasDiagnostics = true;
+                    printDiagnostics(latestDiagnostics);
+                }
+
+                if (hashMonitor.due(simulation.stepCount()) &&
+                    !hashMonitor.submit(simulation.stepCount(), simulation.computeStateHash())) {
+                    isPaused = true;
+                }
+            }
+        }
+
+        const SimulationParams& params = simulation.params();
+        const bool useTree = treeCulling && simulation.treeIsCurrent();
+        renderer.render(window, worldView, simulation.particles(), useTree ? &simulation.tree() : nullptr,
+                        params.velocityClamp * (float)simulation.lastTimeStep());
+        window.display();
+
+        frameCounter++;
+        if (fpsClock.getElapsedTime().asSeconds() >= 0.5f) {
+            float seconds = fpsClock.getElapsedTime().asSeconds();
+            int fps = (seconds > 0.0f) ? (int)(frameCounter / seconds) : 0;
+            frameCounter = 0;
+            fpsClock.restart();
+            updateWindowTitle(fps);
+        }
+    }
+}
+
+int main() {
+    SystemInfo systemInfo = detectSystemInfo();
+    AppConfig config = buildAppConfig(systemInfo);
+    setHugePageMode(config.hugePages);
+
+    if (!config.sweep.resultsPath.empty()) {
+        return runSweep(config);
+    }
+
+    applyAutotune(config, systemInfo);
+
+    if (config.headlessSteps > 0) {
+        return runHeadless(config);
+    }
+
+    sf::ContextSettings contextSettings;
+    contextSettings.antialiasingLevel = 8;
+
+    sf::RenderWindow window(
+        sf::VideoMode(1600, 1000),
+        "Gravity Simulator",
+        sf::Style::Default,
+        contextSettings
+    );
+
+    window.setVerticalSyncEnabled(true);
+    window.setActive(true);
+
+    sf::View worldView(sf::FloatRect(0.0f, 0.0f, 1600.0f, 1000.0f));
+    worldView.setCenter(0.0f, 0.0f);
+    window.setView(worldView);
+
+    detectGpuInfo(systemInfo);
+
+    if (config.dimensions == 3) {
+        runSimulation<3>(window, worldView, systemInfo, config);
+    } else {
+        runSimulation<2>(window, worldView, systemInfo, config);
+    }
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+// Version 2 resolves GetProcessMemoryInfo from kernel32, so psapi.lib is not needed.
+#define PSAPI_VERSION 2
+#include <psapi.h>
+using SocketHandle = SOCKET;
+static const SocketHandle kInvalidSocket = INVALID_SOCKET;
+static void closeSocket(SocketHandle s) { closesocket(s); }
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+using SocketHandle = int;
+static const SocketHandle kInvalidSocket = -1;
+static void closeSocket(SocketHandle s) { ::close(s); }
+#endif
+
+#if defined(MSG_NOSIGNAL)
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static const char* const kPhaseNames[] = { "tree", "force", "integrate", "diagnostics" };
+
+static uint64_t residentMemoryBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (uint64_t)counters.WorkingSetSize;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return (uint64_t)info.resident_size;
+#elif defined(__linux__)
+    std::FILE* file = std::fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+    unsigned long long totalPages = 0, residentPages = 0;
+    int fields = std::fscanf(file, "%llu %llu", &totalPages, &residentPages);
+    std::fclose(file);
+    if (fields != 2) return 0;
+    return (uint64_t)residentPages * (uint64_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+void SimulationMetrics::publish(const StepStatistics& step, std::size_t particleCount, const ThreadPool& pool) {
+    const auto relaxed = std::memory_order_relaxed;
+    const uint64_t stepTotal = steps.load(relaxed) + 1;
+
+    particles.store(particleCount, relaxed);
+    stepSeconds.store(step.totalSeconds, relaxed);
+    const double phases[PhaseCount] = { step.treeSeconds, step.forceSeconds, step.integrateSeconds,
+                                        step.diagnosticsSeconds };
+    for (int p = 0; p < PhaseCount; p++) {
+        phaseSeconds[p].store(phases[p], relaxed);
+        phaseSecondsTotal[p].store(phaseSecondsTotal[p].load(relaxed) + phases[p], relaxed);
+    }
+    treeNodes.store(step.treeNodes, relaxed);
+    treeDepth.store(step.treeDepth, relaxed);
+    interactionsPerParticle.store(particleCount > 0 ? (double)step.interactions / (double)particleCount : 0.0, relaxed);
+    workerThreads.store(pool.workerCount(), relaxed);
+
+    // Rates are taken over windows of about a second so single slow frames do not show.
+    const auto now = std::chrono::steady_clock::now();
+    if (!windowStarted) {
+        windowStarted = true;
+        windowStart = now;
+        windowSteps = stepTotal;
+        windowBusySeconds = pool.busySeconds();
+    } else {
+        const double elapsed = std::chrono::duration<double>(now - windowStart).count();
+        if (elapsed >= 1.0) {
+            const double busy = pool.busySeconds();
+            const double capacity = elapsed * (double)pool.workerCount();
+            stepsPerSecond.store((double)(stepTotal - windowSteps) / elapsed, relaxed);
+            workerIdleFraction.store(std::max(0.0, 1.0 - (busy - windowBusySeconds) / capacity), relaxed);
+            windowStart = now;
+            windowSteps = stepTotal;
+            windowBusySeconds = busy;
+        }
+    }
+
+    steps.store(stepTotal, relaxed);
+}
+
+static void appendMetric(std::string& out, const char* name, const char* type, const char* help, double value) {
+    char line[256];
+    std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %.10g\n", name, help, name, type, name, value);
+    out += line;
+}
+
+std::string SimulationMetrics::render() const {
+    const auto relaxed = std::memory_order_relaxed;
+    std::string out;
+    out.reserve(4096);
+
+    appendMetric(out, "gravity_steps_total", "counter", "Simulation steps completed.",
+                 (double)steps.load(relaxed));
+    appendMetric(out, "gravity_steps_per_second", "gauge", "Steps per second over the last window of about 1 s.",
+                 stepsPerSecond.load(relaxed));
+    appendMetric(out, "gravity_particles", "gauge", "Particles in the simulation.", (double)particles.load(relaxed));
+    appendMetric(out, "gravity_step_seconds", "gauge", "Wall time of the last step.", stepSeconds.load(relaxed));
+
+    char line[256];
+    out += "# HELP gravity_phase_seconds Wall time of each phase in the last step.\n"
+           "# TYPE gravity_phase_seconds gauge\n";
+    for (int p = 0; p < PhaseCount; p++) {
+        std::snprintf(line, sizeof(line), "gravity_phase_seconds{phase=\"%s\"} %.10g\n", kPhaseNames[p],
+                      phaseSeconds[p].load(relaxed));
+        out += line;
+    }
+    out += "# HELP gravity_phase_seconds_total Wall time spent in each phase.\n"
+           "# TYPE gravity_phase_seconds_total counter\n";
+    for (int p = 0; p < PhaseCount; p++) {
+        std::snprintf(line, sizeof(line), "gravity_phase_seconds_total{phase=\"%s\"} %.10g\n", kPhaseNames[p],
+                      phaseSecondsTotal[p].load(relaxed));
+        out += line;
+    }
+
+    appendMetric(out, "gravity_tree_nodes", "gauge", "Nodes in the last tree (0 when no tree is built).",
+                 (double)treeNodes.load(relaxed));
+    appendMetric(out, "gravity_tree_max_depth", "gauge", "Deepest tree level holding a particle.",
+                 (double)treeDepth.load(relaxed));
+    appendMetric(out, "gravity_interactions_per_particle", "gauge",
+                 "Tree interactions evaluated per particle in the last step.", interactionsPerParticle.load(relaxed));
+    appendMetric(out, "gravity_worker_threads", "gauge", "Worker threads of the simulation pool.",
+                 (double)workerThreads.load(relaxed));
+    appendMetric(out, "gravity_worker_idle_fraction", "gauge",
+                 "Share of worker time spent outside tasks over the last window.", workerIdleFraction.load(relaxed));
+    appendMetric(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.",
+                 (double)residentMemoryBytes());
+    return out;
+}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+bool MetricsServer::start(int port, const SimulationMetrics& metrics) {
+    stop();
+    source = &metrics;
+
+#if defined(_WIN32)
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        std::fprintf(stderr, "metrics: winsock startup failed\n");
+        return false;
+    }
+    socketsInitialized = true;
+#endif
+
+    SocketHandle s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == kInvalidSocket) {
+        std::fprintf(stderr, "metrics: cannot create socket\n");
+        stop();
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (const sockaddr*)&address, sizeof(address)) != 0 || listen(s, 8) != 0) {
+        std::fprintf(stderr, "metrics: cannot listen on 127.0.0.1:%d\n", port);
+        closeSocket(s);
+        stop();
+        return false;
+    }
+
+    listenSocket = (std::intptr_t)s;
+    stopRequested.store(false);
+    thread = std::thread([this]() { serve(); });
+    std::fprintf(stderr, "metrics: serving http://127.0.0.1:%d/metrics\n", port);
+    return true;
+}
+
+void MetricsServer::stop() {
+    stopRequested.store(true);
+    if (thread.joinable()) thread.join();
+    if (listenSocket != -1) {
+        closeSocket((SocketHandle)listenSocket);
+        listenSocket = -1;
+    }
+#if defined(_WIN32)
+    if (socketsInitialized) WSACleanup();
+#endif
+    socketsInitialized = false;
+}
+
+void MetricsServer::serve() {
+    const SocketHandle s = (SocketHandle)listenSocket;
+    while (!stopRequested.load()) {
+        // A short timeout lets stop() end the thread without a wake-up connection.
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 200000;
+        if (select((int)s + 1, &readable, nullptr, nullptr, &timeout) <= 0) continue;
+
+        SocketHandle client = accept(s, nullptr, nullptr);
+        if (client == kInvalidSocket) continue;
+        respond((std::intptr_t)client);
+        closeSocket(client);
+    }
+}
+
+void MetricsServer::respond(std::intptr_t clientHandle) {
+    const SocketHandle client = (SocketHandle)clientHandle;
+
+    // A stalled client must not hold up later scrapes.
+#if defined(_WIN32)
+    DWORD receiveTimeout = 2000;
+#else
+    timeval receiveTimeout;
+    receiveTimeout.tv_sec = 2;
+    receiveTimeout.tv_usec = 0;
+#endif
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&receiveTimeout, sizeof(receiveTimeout));
+#if defined(SO_NOSIGPIPE)
+    int noSignal = 1;
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        const int received = (int)recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        request.append(buffer, (std::size_t)received);
+    }
+
+    // The path ends at the query string or the space before the HTTP version.
+    std::string path;
+    if (request.compare(0, 4, "GET ") == 0) {
+        const std::size_t end = request.find_first_of("? \r\n", 4);
+        path = request.substr(4, end == std::string::npos ? std::string::npos : end - 4);
+    }
+    const bool known = path == "/metrics" || path == "/";
+    const std::string body = known ? source->render() : std::string("not found\n");
+    std::string response = known ? "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 : "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    response += body;
+
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        const int n = (int)send(client, response.data() + sent, (int)(response.size() - sent), kSendFlags);
+        if (n <= 0) break;
+        sent += (std::size_t)n;
+    }
+}
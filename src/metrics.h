@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "gravity_simulation.h"
+#include "thread_pool.h"
+
+// Counters and gauges of a running simulation. The stepping thread publishes after every
+// step with relaxed atomic stores and the exporter thread only loads them, so a scrape
+// never blocks or slows the step loop.
+class SimulationMetrics {
+public:
+    void publish(const StepStatistics& step, std::size_t particleCount, const ThreadPool& pool);
+    // Prometheus text exposition format, version 0.0.4.
+    std::string render() const;
+
+private:
+    enum Phase { Tree, Force, Integrate, Diagnostics, PhaseCount };
+
+    std::atomic<uint64_t> steps{0};
+    std::atomic<uint64_t> particles{0};
+    std::atomic<double> stepsPerSecond{0.0};
+    std::atomic<double> stepSeconds{0.0};
+    std::array<std::atomic<double>, PhaseCount> phaseSeconds{};
+    // Only the publishing thread writes these, so a load and a store add up safely.
+    std::array<std::atomic<double>, PhaseCount> phaseSecondsTotal{};
+    std::atomic<uint64_t> treeNodes{0};
+    std::atomic<int> treeDepth{0};
+    std::atomic<double> interactionsPerParticle{0.0};
+    std::atomic<unsigned int> workerThreads{0};
+    std::atomic<double> workerIdleFraction{0.0};
+
+    // Rate window, touched by the publishing thread only.
+    bool windowStarted = false;
+    std::chrono::steady_clock::time_point windowStart;
+    uint64_t windowSteps = 0;
+    double windowBusySeconds = 0.0;
+};
+
+// Serves SimulationMetrics over HTTP on 127.0.0.1 from a background thread. Any GET of
+// / or /metrics returns the current values.
+class MetricsServer {
+public:
+    MetricsServer() = default;
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    bool start(int port, const SimulationMetrics& metrics);
+    void stop();
+
+private:
+    void serve();
+    void respond(std::intptr_t client);
+
+    const SimulationMetrics* source = nullptr;
+    std::intptr_t listenSocket = -1;
+    std::thread thread;
+    std::atomic<bool> stopRequested{false};
+    bool socketsInitialized = false;
+};
@@ -0,0 +1,43 @@
+#include "particle_ids.h"
+
+void ParticleIdTable::clear() {
+    slotIndex.clear();
+    slotGeneration.clear();
+    freeSlots.clear();
+}
+
+uint64_t ParticleIdTable::allocate(std::size_t index) {
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        slot = (uint32_t)slotIndex.size();
+        slotIndex.push_back(kNoIndex);
+        slotGeneration.push_back(0);
+    }
+    slotIndex[slot] = (uint32_t)index;
+    return ((uint64_t)slotGeneration[slot] << 32) | slot;
+}
+
+bool ParticleIdTable::release(uint64_t id) {
+    std::size_t index;
+    if (!lookup(id, index)) return false;
+    const uint32_t slot = (uint32_t)id;
+    slotIndex[slot] = kNoIndex;
+    slotGeneration[slot]++;
+    freeSlots.push_back(slot);
+    return true;
+}
+
+bool ParticleIdTable::lookup(uint64_t id, std::size_t& outIndex) const {
+    const uint32_t slot = (uint32_t)id;
+    if (slot >= slotIndex.size() || slotGeneration[slot] != (uint32_t)(id >> 32)) return false;
+    if (slotIndex[slot] == kNoIndex) return false;
+    outIndex = slotIndex[slot];
+    return true;
+}
+
+void ParticleIdTable::move(uint64_t id, std::size_t newIndex) {
+    slotIndex[(uint32_t)id] = (uint32_t)newIndex;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Maps stable particle IDs to their current index in the particle columns. An ID is
+// (generation << 32) | slot: released slots are reused, and the generation bump makes
+// the old ID of a reused slot miss instead of resolving to the new particle.
+class ParticleIdTable {
+public:
+    static constexpr uint32_t kNoIndex = 0xffffffffu;
+
+    // Forgets every ID. The next `count` allocations return IDs 0..count-1.
+    void clear();
+    uint64_t allocate(std::size_t index);
+    bool release(uint64_t id);
+    bool lookup(uint64_t id, std::size_t& outIndex) const;
+    // Records that the particle behind a live ID now sits at newIndex.
+    void move(uint64_t id, std::size_t newIndex);
+
+private:
+    std::vector<uint32_t> slotIndex;
+    std::vector<uint32_t> slotGeneration;
+    std::vector<uint32_t> freeSlots;
+};
@@ -0,0 +1,314 @@
+#include "particle_import.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kBinaryMagic[8] = { 'G', 'R', 'A', 'V', 'I', 'C', '0', '1' };
+static const std::size_t kBinaryHeaderSize = 24;
+// Text chunks per worker; a few extra even out lines of different length.
+static const std::size_t kChunksPerWorker = 8;
+static const std::size_t kMinChunkBytes = 1 << 16;
+
+// Read-only view of a whole file. Empty files map to a null view of size 0.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) return false;
+        bytes = (std::size_t)fileSize.QuadPart;
+        if (bytes == 0) return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        return view != nullptr;
+#else
+        descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) return false;
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) return false;
+        bytes = (std::size_t)info.st_size;
+        if (bytes == 0) return true;
+        void* address = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED) return false;
+        // Every page is read once, front to back within each chunk.
+        madvise(address, bytes, MADV_WILLNEED);
+        view = (const char*)address;
+        return true;
+#endif
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (view) UnmapViewOfFile(view);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (view) munmap((void*)view, bytes);
+        if (descriptor >= 0) ::close(descriptor);
+        descriptor = -1;
+#endif
+        view = nullptr;
+        bytes = 0;
+    }
+
+    const char* data() const { return view; }
+    std::size_t size() const { return bytes; }
+
+private:
+    const char* view = nullptr;
+    std::size_t bytes = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+};
+
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+static const char* lineEnd(const char* p, const char* end) {
+    const char* newline = (const char*)std::memchr(p, '\n', (std::size_t)(end - p));
+    return newline ? newline : end;
+}
+
+static bool isDataLine(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p < end && *p != '#';
+}
+
+// Parses one number at p, which must lie inside [p, end). Returns the position after
+// it, or nullptr when there is no valid number.
+static const char* parseFloat(const char* p, const char* end, float& out) {
+    if (p < end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars)
+    const std::from_chars_result result = std::from_chars(p, end, out);
+    if (result.ec != std::errc()) return nullptr;
+    return result.ptr;
+#else
+    // Standard libraries without floating-point from_chars: strtof needs a terminated
+    // copy, since the mapped file is not terminated.
+    char buffer[64];
+    std::size_t length = 0;
+    while (p + length < end && length + 1 < sizeof(buffer) && !isSeparator(p[length]) && p[length] != '\n') {
+        buffer[length] = p[length];
+        length++;
+    }
+    buffer[length] = '\0';
+    char* parsedEnd = nullptr;
+    out = std::strtof(buffer, &parsedEnd);
+    if (parsedEnd == buffer) return nullptr;
+    return p + (parsedEnd - buffer);
+#endif
+}
+
+// Reads the first 2 * Dim + 1 fields of the line [p, end).
+template <int Dim>
+static bool parseRecord(const char* p, const char* end, float* values) {
+    for (int c = 0; c < 2 * Dim + 1; c++) {
+        while (p < end && isSeparator(*p)) p++;
+        p = parseFloat(p, end, values[c]);
+        if (!p || !std::isfinite(values[c])) return false;
+        if (p < end && !isSeparator(*p)) return false;
+    }
+    return values[2 * Dim] >= 0.0f;
+}
+
+template <int Dim>
+static bool importBinary(const MappedFile& file, const std::string& path, Particles<Dim>& particles,
+                         ThreadPool& pool) {
+    if (file.size() < kBinaryHeaderSize) {
+        std::fprintf(stderr, "import: %s is truncated\n", path.c_str());
+        return false;
+    }
+    uint32_t dimensions = 0;
+    uint64_t count = 0;
+    std::memcpy(&dimensions, file.data() + 8, sizeof(dimensions));
+    std::memcpy(&count, file.data() + 16, sizeof(count));
+    if (dimensions != (uint32_t)Dim) {
+        std::fprintf(stderr, "import: %s holds %uD particles, the simulation is %dD\n", path.c_str(),
+                     (unsigned)dimensions, Dim);
+        return false;
+    }
+    const uint64_t columns = 2 * Dim + 1;
+    if (count == 0 || (file.size() - kBinaryHeaderSize) / sizeof(float) / columns < count) {
+        std::fprintf(stderr, "import: %s is truncated or empty\n", path.c_str());
+        return false;
+    }
+
+    particles.resize((std::size_t)count);
+    std::vector<float*> targets;
+    for (int d = 0; d < Dim; d++) targets.push_back(particles.position[d].data());
+    for (int d = 0; d < Dim; d++) targets.push_back(particles.velocity[d].data());
+    targets.push_back(particles.mass.data());
+
+    // Same rules as parseRecord: every value finite and no negative mass. Chunks start
+    // at multiples of the grain, so each one owns a slot for its first bad record.
+    const std::size_t grain = 1 << 18;
+    const std::size_t chunkCount = ((std::size_t)count + grain - 1) / grain;
+    std::vector<std::size_t> chunkError(chunkCount, (std::size_t)count);
+    const char* source = file.data() + kBinaryHeaderSize;
+    pool.parallelFor(0, (std::size_t)count, grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t c = 0; c < targets.size(); c++) {
+            std::memcpy(targets[c] + begin, source + (c * count + begin) * sizeof(float), (end - begin) * sizeof(float));
+        }
+        std::fill(particles.flags.begin() + (std::ptrdiff_t)begin, particles.flags.begin() + (std::ptrdiff_t)end, 0);
+
+        for (std::size_t i = begin; i < end; i++) {
+            bool valid = particles.mass[i] >= 0.0f && std::isfinite(particles.mass[i]);
+            for (int d = 0; d < Dim; d++) {
+                valid = valid && std::isfinite(particles.position[d][i]) && std::isfinite(particles.velocity[d][i]);
+            }
+            if (!valid) {
+                chunkError[begin / grain] = std::min(chunkError[begin / grain], i);
+                break;
+            }
+        }
+    });
+
+    for (std::size_t error : chunkError) {
+        if (error == (std::size_t)count) continue;
+        std::fprintf(stderr, "import: %s record %zu: expected %d numbers (x y%s vx vy%s m) with m >= 0\n",
+                     path.c_str(), error, 2 * Dim + 1, Dim == 3 ? " z" : "", Dim == 3 ? " vz" : "");
+        return false;
+    }
+    return true;
+}
+
+template <int Dim>
+static bool importText(const MappedFile& file, const std::string& path, Particles<Dim>& particles,
+                       ThreadPool& pool) {
+    const char* const begin = file.data();
+    const char* const end = begin + file.size();
+
+    // Skip comments up to the first record and drop it as a header when its first field
+    // is not a number.
+    const char* start = begin;
+    while (start < end && !isDataLine(start, lineEnd(start, end))) start = std::min(end, lineEnd(start, end) + 1);
+    if (start < end) {
+        const char* p = start;
+        while (p < end && isSeparator(*p)) p++;
+        float value;
+        if (!parseFloat(p, lineEnd(start, end), value)) start = std::min(end, lineEnd(start, end) + 1);
+    }
+
+    // Chunk boundaries sit right after a newline, so every line belongs to one chunk.
+    const std::size_t textBytes = (std::size_t)(end - start);
+    const std::size_t chunkCount = std::max<std::size_t>(
+        1, std::min<std::size_t>(pool.workerCount() * kChunksPerWorker, textBytes / kMinChunkBytes));
+    std::vector<const char*> chunkStart(chunkCount + 1, end);
+    chunkStart[0] = start;
+    for (std::size_t k = 1; k < chunkCount; k++) {
+        const char* p = std::max(chunkStart[k - 1], start + textBytes / chunkCount * k);
+        chunkStart[k] = p < end ? std::min(end, lineEnd(p, end) + 1) : end;
+    }
+
+    std::vector<std::size_t> chunkOffset(chunkCount + 1, 0);
+    pool.parallelFor(0, chunkCount, 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t k = first; k < last; k++) {
+            std::size_t records = 0;
+            for (const char* p = chunkStart[k]; p < chunkStart[k + 1];) {
+                const char* next = lineEnd(p, chunkStart[k + 1]);
+                if (isDataLine(p, next)) records++;
+                p = next + 1;
+            }
+            chunkOffset[k + 1] = records;
+        }
+    });
+    for (std::size_t k = 0; k < chunkCount; k++) chunkOffset[k + 1] += chunkOffset[k];
+
+    const std::size_t count = chunkOffset[chunkCount];
+    if (count == 0) {
+        std::fprintf(stderr, "import: %s holds no particles\n", path.c_str());
+        return false;
+    }
+    particles.resize(count);
+
+    // First malformed line of each chunk, as a pointer to its start.
+    std::vector<const char*> chunkError(chunkCount, nullptr);
+    pool.parallelFor(0, chunkCount, 1, [&](std::size_t first, std::size_t last) {
+        float values[2 * Dim + 1];
+        for (std::size_t k = first; k < last; k++) {
+            std::size_t row = chunkOffset[k];
+            for (const char* p = chunkStart[k]; p < chunkStart[k + 1];) {
+                const char* next = lineEnd(p, chunkStart[k + 1]);
+                if (isDataLine(p, next)) {
+                    if (!parseRecord<Dim>(p, next, values)) {
+                        chunkError[k] = p;
+                        break;
+                    }
+                    for (int d = 0; d < Dim; d++) {
+                        particles.position[d][row] = values[d];
+                        particles.velocity[d][row] = values[Dim + d];
+                    }
+                    particles.mass[row] = values[2 * Dim];
+                    particles.flags[row] = 0;
+                    row++;
+                }
+                p = next + 1;
+            }
+        }
+    });
+
+    for (const char* error : chunkError) {
+        if (!error) continue;
+        const std::size_t line = 1 + (std::size_t)std::count(begin, error, '\n');
+        std::fprintf(stderr, "import: %s line %zu: expected %d numbers (x y%s vx vy%s m) with m >= 0\n",
+                     path.c_str(), line, 2 * Dim + 1, Dim == 3 ? " z" : "", Dim == 3 ? " vz" : "");
+        return false;
+    }
+    return true;
+}
+
+template <int Dim>
+bool importParticles(const std::string& path, Particles<Dim>& particles, ThreadPool& pool) {
+    particles.clear();
+
+    MappedFile file;
+    if (!file.open(path)) {
+        std::fprintf(stderr, "import: cannot read %s\n", path.c_str());
+        return false;
+    }
+
+    const bool binary = file.size() >= sizeof(kBinaryMagic) &&
+                        std::memcmp(file.data(), kBinaryMagic, sizeof(kBinaryMagic)) == 0;
+    const bool loaded = binary ? importBinary(file, path, particles, pool) : importText(file, path, particles, pool);
+    if (!loaded) particles.clear();
+    return loaded;
+}
+
+template bool importParticles<2>(const std::string&, Particles<2>&, ThreadPool&);
+template bool importParticles<3>(const std::string&, Particles<3>&, ThreadPool&);
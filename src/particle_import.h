@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Loads an external particle set from one of two layouts:
+//  - text (CSV or whitespace): one body per line, "x y [z] vx vy [vz] m" for the
+//    simulation's dimension, separated by commas, semicolons, spaces or tabs. Lines
+//    starting with '#', blank lines and one leading header line are skipped; columns
+//    after the mass are ignored.
+//  - binary: the magic "GRAVIC01", uint32 dimensions, uint32 zero, uint64 count, then
+//    `count` little-endian float32 values per column in the order x, y, [z], vx, vy,
+//    [vz], m.
+// Both layouts reject non-finite values and negative masses.
+// The file is memory-mapped and text is split at line boundaries and parsed in
+// parallel straight into the columns. On failure the reason goes to stderr and
+// `particles` is left empty.
+template <int Dim>
+bool importParticles(const std::string& path, Particles<Dim>& particles, ThreadPool& pool);
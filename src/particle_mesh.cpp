@@ -0,0 +1,506 @@
+#include "particle_mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+static const double kPi = 3.141592653589793;
+
+// Cells kept free on each side of the particles so assignment stencils and the
+// 4-point gradient never reach outside the region the padded convolution gets right.
+static constexpr int kGuardCells = 3;
+
+// Largest total size of the per-chunk deposit grids, in floats.
+static constexpr std::size_t kDepositBudget = (std::size_t)16 << 20;
+
+void ShortRangeSplit::configure(float radius) {
+    if (radius == splitRadius && !longForce.empty()) return;
+
+    splitRadius = radius;
+    const double rs = radius;
+    const double cutoff = kCutoffRadii * rs;
+    cutoffSquared = (float)(cutoff * cutoff);
+    tableScale = (float)kTableSize / cutoffSquared;
+
+    longForce.resize(kTableSize + 1);
+    longPotential.resize(kTableSize + 1);
+    const double invSqrtPi = 1.0 / std::sqrt(kPi);
+    for (int k = 0; k <= kTableSize; k++) {
+        double r2 = (double)k / (double)tableScale;
+        double r = std::sqrt(r2);
+        if (k == 0) {
+            // Limits at r -> 0 of the expressions below.
+            longForce[k] = (float)(invSqrtPi / (6.0 * rs * rs * rs));
+            longPotential[k] = (float)(invSqrtPi / rs);
+            continue;
+        }
+        double x = r / (2.0 * rs);
+        double erfTerm = std::erf(x);
+        longForce[k] = (float)(erfTerm / (r2 * r) - invSqrtPi * std::exp(-x * x) / (rs * r2));
+        longPotential[k] = (float)(erfTerm / r);
+    }
+}
+
+template <int Dim>
+bool ParticleMesh<Dim>::KernelKey::operator==(const KernelKey& other) const {
+    return meshCells == other.meshCells && cellSize == other.cellSize &&
+           gravitationalConstant == other.gravitationalConstant && softeningLength == other.softeningLength &&
+           splitCells == other.splitCells && assignment == other.assignment && longRangeOnly == other.longRangeOnly;
+}
+
+// Splits [0, count) into a few blocks per worker. Lines of a transform are independent,
+// so the split does not affect the result.
+static void parallelLines(ThreadPool& pool, std::size_t count, const std::function<void(std::size_t, std::size_t)>& task) {
+    const std::size_t blocks = std::min<std::size_t>(count, (std::size_t)pool.workerCount() * 4);
+    if (blocks == 0) return;
+    pool.runTasks(blocks, [&](std::size_t b) { task(count * b / blocks, count * (b + 1) / blocks); });
+}
+
+template <int Dim>
+struct AssignmentStencil {
+    std::array<int, Dim> first;
+    std::array<std::array<float, 3>, Dim> weight;
+    int width;
+};
+
+template <int Dim>
+static AssignmentStencil<Dim> assignmentStencil(const std::array<float, Dim>& u, MassAssignment assignment) {
+    AssignmentStencil<Dim> s;
+    if (assignment == MassAssignment::CloudInCell) {
+        s.width = 2;
+        for (int d = 0; d < Dim; d++) {
+            int i = (int)std::floor(u[d]);
+            float f = u[d] - (float)i;
+            s.first[d] = i;
+            s.weight[d] = { 1.0f - f, f, 0.0f };
+        }
+    } else {
+        s.width = 3;
+        for (int d = 0; d < Dim; d++) {
+            int i = (int)std::floor(u[d] + 0.5f);
+            float f = u[d] - (float)i;
+            s.first[d] = i - 1;
+            s.weight[d] = { 0.5f * (0.5f - f) * (0.5f - f), 0.75f - f * f, 0.5f * (0.5f + f) * (0.5f + f) };
+        }
+    }
+    return s;
+}
+
+// Calls fn(index, weight) for every cell of the stencil in a row-major grid whose rows
+// are rowLength long.
+template <int Dim, typename Fn>
+static void forEachStencilCell(const AssignmentStencil<Dim>& s, std::size_t rowLength, Fn&& fn) {
+    if constexpr (Dim == 2) {
+        for (int a = 0; a < s.width; a++) {
+            const std::size_t row = (std::size_t)(s.first[0] + a) * rowLength;
+            for (int b = 0; b < s.width; b++) {
+                fn(row + (std::size_t)(s.first[1] + b), s.weight[0][a] * s.weight[1][b]);
+            }
+        }
+    } else {
+        for (int a = 0; a < s.width; a++) {
+            for (int b = 0; b < s.width; b++) {
+                const std::size_t row = ((std::size_t)(s.first[0] + a) * rowLength + (std::size_t)(s.first[1] + b)) * rowLength;
+                const float wab = s.weight[0][a] * s.weight[1][b];
+                for (int c = 0; c < s.width; c++) {
+                    fn(row + (std::size_t)(s.first[2] + c), wab * s.weight[2][c]);
+                }
+            }
+        }
+    }
+}
+
+template <int Dim>
+float ParticleMesh<Dim>::cellSize() const {
+    return meshCellSize;
+}
+
+template <int Dim>
+float ParticleMesh<Dim>::splitRadius() const {
+    return kernelKey.splitCells * meshCellSize;
+}
+
+template <int Dim>
+std::size_t ParticleMesh<Dim>::realIndex(const std::array<int, Dim>& cell) const {
+    std::size_t index = 0;
+    for (int d = 0; d < Dim; d++) {
+        int c = cell[d] % paddedCells;
+        if (c < 0) c += paddedCells;
+        index = index * (std::size_t)paddedCells + (std::size_t)c;
+    }
+    return index;
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::chooseGeometry(const Particles<Dim>& particles, int cells) {
+    std::array<float, Dim> minBound;
+    std::array<float, Dim> maxBound;
+    for (int d = 0; d < Dim; d++) {
+        minBound[d] = particles.position[d][0];
+        maxBound[d] = particles.position[d][0];
+    }
+    for (std::size_t i = 1; i < particles.count(); i++) {
+        for (int d = 0; d < Dim; d++) {
+            minBound[d] = std::min(minBound[d], particles.position[d][i]);
+            maxBound[d] = std::max(maxBound[d], particles.position[d][i]);
+        }
+    }
+
+    float span = 1.0f;
+    for (int d = 0; d < Dim; d++) span = std::max(span, maxBound[d] - minBound[d]);
+
+    // One spare cell on top of the guards absorbs rounding of the origin to whole cells.
+    const float needed = span / (float)(cells - 2 * kGuardCells - 1);
+    if (cells != meshCells || meshCellSize < needed || meshCellSize > 2.5f * needed) {
+        meshCellSize = 1.25f * needed;
+    }
+    meshCells = cells;
+    paddedCells = 2 * cells;
+    spectrumRow = cells + 1;
+
+    // Origins snap to whole cells so moving the box does not change the kernel.
+    for (int d = 0; d < Dim; d++) {
+        origin[d] = (std::floor(minBound[d] / meshCellSize) - (float)kGuardCells) * meshCellSize;
+    }
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::forwardTransform(const float* real, std::complex<float>* out, int activeCells, ThreadPool& pool) {
+    const std::size_t P = (std::size_t)paddedCells;
+    const std::size_t H = (std::size_t)spectrumRow;
+    const std::size_t active = (std::size_t)activeCells;
+
+    // Rows along the last axis; rows lying entirely in the zero padding stay zero.
+    const std::size_t rows = (Dim == 2) ? P : P * P;
+    parallelLines(pool, rows, [&](std::size_t begin, std::size_t end) {
+        std::vector<std::complex<float>> scratch(P / 2);
+        for (std::size_t r = begin; r < end; r++) {
+            bool inside = (Dim == 2) ? (r < active) : (r / P < active && r % P < active);
+            std::complex<float>* row = out + r * H;
+            if (inside) {
+                rowFft.forward(real + r * P, row, scratch.data());
+            } else {
+                std::fill(row, row + H, std::complex<float>(0.0f, 0.0f));
+            }
+        }
+    });
+
+    auto transformLines = [&](std::size_t lineCount, std::size_t stride, auto lineBase) {
+        parallelLines(pool, lineCount, [&](std::size_t begin, std::size_t end) {
+            std::vector<std::complex<float>> line(P);
+            for (std::size_t l = begin; l < end; l++) {
+                std::complex<float>* base = out + lineBase(l);
+                for (std::size_t k = 0; k < P; k++) line[k] = base[k * stride];
+                lineFft.transform(line.data(), false);
+                for (std::size_t k = 0; k < P; k++) base[k * stride] = line[k];
+            }
+        });
+    };
+
+    if constexpr (Dim == 3) {
+        // Axis 1, only in planes that contain data.
+        transformLines(active * H, H, [&](std::size_t l) { return (l / H) * P * H + l % H; });
+        transformLines(P * H, P * H, [&](std::size_t l) { return l; });
+    } else {
+        transformLines(H, H, [&](std::size_t l) { return l; });
+    }
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::inverseTransform(std::complex<float>* in, float* real, int neededCells, ThreadPool& pool) {
+    const std::size_t P = (std::size_t)paddedCells;
+    const std::size_t H = (std::size_t)spectrumRow;
+    const std::size_t needed = (std::size_t)neededCells;
+
+    auto transformLines = [&](std::size_t lineCount, std::size_t stride, auto lineBase) {
+        parallelLines(pool, lineCount, [&](std::size_t begin, std::size_t end) {
+            std::vector<std::complex<float>> line(P);
+            for (std::size_t l = begin; l < end; l++) {
+                std::complex<float>* base = in + lineBase(l);
+                for (std::size_t k = 0; k < P; k++) line[k] = base[k * stride];
+                lineFft.transform(line.data(), true);
+                for (std::size_t k = 0; k < P; k++) base[k * stride] = line[k];
+            }
+        });
+    };
+
+    if constexpr (Dim == 3) {
+        transformLines(P * H, P * H, [&](std::size_t l) { return l; });
+        transformLines(needed * H, H, [&](std::size_t l) { return (l / H) * P * H + l % H; });
+    } else {
+        transformLines(H, H, [&](std::size_t l) { return l; });
+    }
+
+    // Only rows inside the needed region are turned back into real values.
+    const std::size_t rows = (Dim == 2) ? needed : needed * needed;
+    parallelLines(pool, rows, [&](std::size_t begin, std::size_t end) {
+        std::vector<std::complex<float>> scratch(P / 2);
+        for (std::size_t r = begin; r < end; r++) {
+            std::size_t row = (Dim == 2) ? r : (r / needed) * P + r % needed;
+            rowFft.inverse(in + row * H, real + row * P, scratch.data());
+        }
+    });
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::buildKernel(ThreadPool& pool) {
+    const std::size_t P = (std::size_t)paddedCells;
+    const std::size_t H = (std::size_t)spectrumRow;
+    const double h = meshCellSize;
+    const double G = kernelKey.gravitationalConstant;
+    const double eps2 = (double)kernelKey.softeningLength * kernelKey.softeningLength;
+    const double rs = kernelKey.splitCells * h;
+    const bool longRange = kernelKey.longRangeOnly;
+
+    std::size_t realCells = 1;
+    std::size_t spectrumCells = H;
+    for (int d = 0; d < Dim; d++) realCells *= P;
+    for (int d = 0; d < Dim - 1; d++) spectrumCells *= P;
+
+    // Kernel sampled at the minimum-image separation, so the circular convolution over
+    // the doubled grid equals the open-boundary sum for sources inside the mesh.
+    auto signedIndex = [&](std::size_t n) { return (n <= P / 2) ? (double)n : (double)n - (double)P; };
+    parallelLines(pool, realCells / P, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = begin; r < end; r++) {
+            double rowR2 = 0.0;
+            std::size_t rest = r;
+            for (int d = 0; d < Dim - 1; d++) {
+                double dn = signedIndex(rest % P);
+                rowR2 += dn * dn;
+                rest /= P;
+            }
+            for (std::size_t k = 0; k < P; k++) {
+                double dn = signedIndex(k);
+                double r2 = (rowR2 + dn * dn) * h * h;
+                double value;
+                if (longRange) {
+                    double rr = std::sqrt(r2);
+                    value = (rr > 0.0) ? -G * std::erf(rr / (2.0 * rs)) / rr : -G / (std::sqrt(kPi) * rs);
+                } else {
+                    value = -G / std::sqrt(r2 + eps2);
+                }
+                grid[r * P + k] = (float)value;
+            }
+        }
+    });
+
+    spectrum.resize(spectrumCells);
+    forwardTransform(grid.data(), spectrum.data(), paddedCells, pool);
+
+    // The kernel is real and even, so its spectrum is real. Fold in the 1/P^Dim of the
+    // unnormalized inverse and, for TreePM, divide out the assignment window applied
+    // once by the deposit and once by the interpolation.
+    const int windowPower = (assignment == MassAssignment::CloudInCell) ? 2 : 3;
+    const float normalization = 1.0f / (float)realCells;
+    kernelSpectrum.resize(spectrumCells);
+    for (std::size_t s = 0; s < spectrumCells; s++) {
+        double window = 1.0;
+        if (longRange) {
+            std::size_t rest = s;
+            for (int d = Dim - 1; d >= 0; d--) {
+                std::size_t extent = (d == Dim - 1) ? H : P;
+                double n = (d == Dim - 1) ? (double)(rest % extent) : signedIndex(rest % extent);
+                rest /= extent;
+                double x = kPi * n / (double)P;
+                double sinc = (n == 0.0) ? 1.0 : std::sin(x) / x;
+                window *= std::pow(sinc, windowPower);
+            }
+        }
+        kernelSpectrum[s] = (float)(spectrum[s].real() / (window * window)) * normalization;
+    }
+
+    // Effective kernel near the origin, for the self-potential correction.
+    for (std::size_t s = 0; s < spectrumCells; s++) spectrum[s] = std::complex<float>(kernelSpectrum[s], 0.0f);
+    inverseTransform(spectrum.data(), grid.data(), paddedCells, pool);
+
+    std::size_t selfCells = 1;
+    for (int d = 0; d < Dim; d++) selfCells *= 5;
+    selfKernel.resize(selfCells);
+    for (std::size_t s = 0; s < selfCells; s++) {
+        std::array<int, Dim> offset;
+        std::size_t rest = s;
+        for (int d = Dim - 1; d >= 0; d--) {
+            offset[d] = (int)(rest % 5) - 2;
+            rest /= 5;
+        }
+        selfKernel[s] = grid[realIndex(offset)];
+    }
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::deposit(const Particles<Dim>& particles, ThreadPool& pool) {
+    const std::size_t M = (std::size_t)meshCells;
+    const std::size_t P = (std::size_t)paddedCells;
+    std::size_t meshVolume = 1;
+    for (int d = 0; d < Dim; d++) meshVolume *= M;
+
+    // Fixed chunking (independent of the worker count) and an in-order reduction keep
+    // the deposited masses bit-identical for any number of threads.
+    const std::size_t n = particles.count();
+    std::size_t chunkCount = std::clamp<std::size_t>(n / 16384, 1, 16);
+    chunkCount = std::max<std::size_t>(1, std::min(chunkCount, kDepositBudget / meshVolume));
+    depositChunks.resize(chunkCount);
+
+    const float invCell = 1.0f / meshCellSize;
+    pool.runTasks(chunkCount, [&](std::size_t c) {
+        std::vector<float>& chunk = depositChunks[c];
+        chunk.assign(meshVolume, 0.0f);
+        for (std::size_t i = n * c / chunkCount; i < n * (c + 1) / chunkCount; i++) {
+            std::array<float, Dim> u;
+            for (int d = 0; d < Dim; d++) u[d] = (particles.position[d][i] - origin[d]) * invCell;
+            const float m = particles.mass[i];
+            forEachStencilCell(assignmentStencil<Dim>(u, assignment), M,
+                               [&](std::size_t cell, float w) { chunk[cell] += m * w; });
+        }
+    });
+
+    const std::size_t meshRows = meshVolume / M;
+    parallelLines(pool, meshRows, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = begin; r < end; r++) {
+            std::size_t paddedRow = (Dim == 2) ? r : (r / M) * P + r % M;
+            float* out = grid.data() + paddedRow * P;
+            std::fill(out, out + P, 0.0f);
+            for (std::size_t c = 0; c < chunkCount; c++) {
+                const float* in = depositChunks[c].data() + r * M;
+                for (std::size_t k = 0; k < M; k++) out[k] += in[k];
+            }
+        }
+    });
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::differentiate(ThreadPool& pool) {
+    const int M = meshCells;
+    const std::size_t P = (std::size_t)paddedCells;
+    std::size_t meshVolume = 1;
+    for (int d = 0; d < Dim; d++) meshVolume *= (std::size_t)M;
+
+    std::array<std::size_t, Dim> stride;
+    stride[Dim - 1] = 1;
+    for (int d = Dim - 2; d >= 0; d--) stride[d] = stride[d + 1] * P;
+
+    for (int d = 0; d < Dim; d++) meshAcceleration[d].assign(meshVolume, 0.0f);
+
+    const float invCell = 1.0f / meshCellSize;
+    const std::size_t meshRows = meshVolume / (std::size_t)M;
+    parallelLines(pool, meshRows, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = begin; r < end; r++) {
+            std::array<int, Dim> cell;
+            std::size_t rest = r;
+            for (int d = Dim - 2; d >= 0; d--) {
+                cell[d] = (int)(rest % (std::size_t)M);
+                rest /= (std::size_t)M;
+            }
+            // Gradients are only needed where stencils can reach, away from the mesh edge.
+            bool interior = true;
+            for (int d = 0; d < Dim - 1; d++) interior = interior && cell[d] >= 2 && cell[d] < M - 2;
+            if (!interior) continue;
+
+            for (int k = 2; k < M - 2; k++) {
+                cell[Dim - 1] = k;
+                std::size_t center = 0;
+                for (int d = 0; d < Dim; d++) center += (std::size_t)cell[d] * stride[d];
+                const std::size_t meshIndex = r * (std::size_t)M + (std::size_t)k;
+                for (int d = 0; d < Dim; d++) {
+                    const std::size_t s = stride[d];
+                    float gradient = (2.0f / 3.0f) * (grid[center + s] - grid[center - s]) -
+                                     (1.0f / 12.0f) * (grid[center + 2 * s] - grid[center - 2 * s]);
+                    meshAcceleration[d][meshIndex] = -gradient * invCell;
+                }
+            }
+        }
+    });
+}
+
+template <int Dim>
+void ParticleMesh<Dim>::compute(const Particles<Dim>& particles, const SimulationParams& params, bool longRangeOnly,
+                                std::array<AlignedVector<float>, Dim>& outAcceleration, AlignedVector<float>* outPotential,
+                                ThreadPool& pool) {
+    const std::size_t n = particles.count();
+    for (int d = 0; d < Dim; d++) outAcceleration[d].resize(n);
+    if (outPotential) outPotential->resize(n);
+    if (n == 0) return;
+
+    // Power of two for the radix-2 FFT; 3D meshes are capped to keep the padded grid
+    // (8x the mesh) within a few hundred MB.
+    int cells = 16;
+    while (cells < params.meshSize && cells < (Dim == 2 ? 4096 : 128)) cells *= 2;
+
+    assignment = params.massAssignment;
+    chooseGeometry(particles, cells);
+
+    const std::size_t P = (std::size_t)paddedCells;
+    std::size_t realCells = 1;
+    for (int d = 0; d < Dim; d++) realCells *= P;
+    grid.resize(realCells);
+    spectrum.resize(realCells / P * (std::size_t)spectrumRow);
+    lineFft.init(P);
+    rowFft.init(P);
+
+    KernelKey key;
+    key.meshCells = meshCells;
+    key.cellSize = meshCellSize;
+    key.gravitationalConstant = params.gravitationalConstant;
+    key.softeningLength = params.softeningLength;
+    key.splitCells = longRangeOnly ? params.treePmSplitCells : 0.0f;
+    key.assignment = assignment;
+    key.longRangeOnly = longRangeOnly;
+    if (!(key == kernelKey) || kernelSpectrum.empty()) {
+        kernelKey = key;
+        buildKernel(pool);
+    }
+
+    deposit(particles, pool);
+    forwardTransform(grid.data(), spectrum.data(), meshCells, pool);
+    for (std::size_t s = 0; s < spectrum.size(); s++) spectrum[s] *= kernelSpectrum[s];
+    inverseTransform(spectrum.data(), grid.data(), meshCells, pool);
+    differentiate(pool);
+
+    const std::size_t M = (std::size_t)meshCells;
+    const float invCell = 1.0f / meshCellSize;
+    pool.parallelFor(0, n, 16384, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            std::array<float, Dim> u;
+            for (int d = 0; d < Dim; d++) u[d] = (particles.position[d][i] - origin[d]) * invCell;
+            const AssignmentStencil<Dim> stencil = assignmentStencil<Dim>(u, assignment);
+
+            std::array<float, Dim> a{};
+            forEachStencilCell(stencil, M, [&](std::size_t cell, float w) {
+                for (int d = 0; d < Dim; d++) a[d] += w * meshAcceleration[d][cell];
+            });
+            for (int d = 0; d < Dim; d++) outAcceleration[d][i] = a[d];
+
+            if (!outPotential) continue;
+
+            float phi = 0.0f;
+            forEachStencilCell(stencil, P, [&](std::size_t cell, float w) { phi += w * grid[cell]; });
+
+            // The particle's own mass went through the same deposit / kernel /
+            // interpolation; subtract it so only the other particles remain.
+            float self = 0.0f;
+            const int width = stencil.width;
+            int cellsInStencil = 1;
+            for (int d = 0; d < Dim; d++) cellsInStencil *= width;
+            for (int s = 0; s < cellsInStencil; s++) {
+                for (int t = 0; t < cellsInStencil; t++) {
+                    float w = 1.0f;
+                    std::size_t selfIndex = 0;
+                    int sr = s, tr = t;
+                    for (int d = Dim - 1; d >= 0; d--) {
+                        int sa = sr % width, ta = tr % width;
+                        sr /= width;
+                        tr /= width;
+                        w *= stencil.weight[d][sa] * stencil.weight[d][ta];
+                        std::size_t place = 1;
+                        for (int e = d + 1; e < Dim; e++) place *= 5;
+                        selfIndex += (std::size_t)(sa - ta + 2) * place;
+                    }
+                    self += w * selfKernel[selfIndex];
+                }
+            }
+            (*outPotential)[i] = phi - particles.mass[i] * self;
+        }
+    });
+}
+
+template class ParticleMesh<2>;
+template class ParticleMesh<3>;
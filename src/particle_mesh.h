@@ -0,0 +1,99 @@
+#pragma once
+#include <array>
+#include <complex>
+#include <vector>
+#include "particles.h"
+#include "thread_pool.h"
+#include "simulation_params.h"
+#include "fft.h"
+
+// Long-range part of the TreePM force split, tabulated for the tree walk. The mesh
+// carries phi_long(r) = -G m erf(r / 2r_s) / r; the walk applies the softened pair force
+// minus this part and ignores pairs beyond the cutoff, where the remainder is < 0.2%.
+struct ShortRangeSplit {
+    static constexpr float kCutoffRadii = 4.5f;
+    static constexpr int kTableSize = 4096;
+
+    float splitRadius = 0.0f;
+    float cutoffSquared = 0.0f;
+    float tableScale = 0.0f;
+
+    // Indexed by r^2: F_long(r) / (G m r) and -phi_long(r) / (G m).
+    std::vector<float> longForce;
+    std::vector<float> longPotential;
+
+    void configure(float radius);
+
+    void lookup(float r2, float& outForce, float& outPotential) const {
+        float x = r2 * tableScale;
+        int k = (int)x;
+        float f = x - (float)k;
+        outForce = longForce[k] + f * (longForce[k + 1] - longForce[k]);
+        outPotential = longPotential[k] + f * (longPotential[k + 1] - longPotential[k]);
+    }
+};
+
+// Particle-mesh gravity on a non-periodic grid (Hockney & Eastwood): mass is assigned
+// with CIC or TSC, convolved with the softened point-mass kernel through zero-padded
+// real-to-complex FFTs, differentiated with a 4-point stencil and interpolated back with
+// the same assignment, which keeps the self-force at zero and momentum conserved.
+//
+// The mesh follows the particles' bounding box. The cell size only changes when the
+// box outgrows it or shrinks to less than half of it, so the kernel spectrum (one extra
+// FFT) is rebuilt rarely.
+template <int Dim>
+class ParticleMesh {
+public:
+    // Overwrites outAcceleration (and outPotential when given). With longRangeOnly the
+    // kernel is the erf-smoothed TreePM part at r_s = params.treePmSplitCells cells,
+    // deconvolved by the assignment window.
+    void compute(const Particles<Dim>& particles, const SimulationParams& params, bool longRangeOnly,
+                 std::array<AlignedVector<float>, Dim>& outAcceleration, AlignedVector<float>* outPotential,
+                 ThreadPool& pool);
+
+    float cellSize() const;
+    float splitRadius() const;
+
+private:
+    struct KernelKey {
+        int meshCells = 0;
+        float cellSize = 0.0f;
+        float gravitationalConstant = 0.0f;
+        float softeningLength = 0.0f;
+        float splitCells = 0.0f;
+        MassAssignment assignment = MassAssignment::CloudInCell;
+        bool longRangeOnly = false;
+
+        bool operator==(const KernelKey& other) const;
+    };
+
+    void chooseGeometry(const Particles<Dim>& particles, int cells);
+    void buildKernel(ThreadPool& pool);
+    void deposit(const Particles<Dim>& particles, ThreadPool& pool);
+    void forwardTransform(const float* real, std::complex<float>* spectrum, int activeCells, ThreadPool& pool);
+    void inverseTransform(std::complex<float>* spectrum, float* real, int neededCells, ThreadPool& pool);
+    void differentiate(ThreadPool& pool);
+
+    std::size_t realIndex(const std::array<int, Dim>& cell) const;
+
+    int meshCells = 0;
+    int paddedCells = 0;
+    int spectrumRow = 0;
+    float meshCellSize = 0.0f;
+    std::array<float, Dim> origin{};
+    MassAssignment assignment = MassAssignment::CloudInCell;
+
+    KernelKey kernelKey;
+    std::vector<float> kernelSpectrum;
+    // Effective kernel (after deconvolution) at offsets -2..2 per axis, for removing each
+    // particle's own contribution from the interpolated potential.
+    std::vector<float> selfKernel;
+
+    std::vector<std::vector<float>> depositChunks;
+    std::vector<float> grid;
+    std::vector<std::complex<float>> spectrum;
+    std::array<std::vector<float>, Dim> meshAcceleration;
+
+    Fft lineFft;
+    RealFft rowFft;
+};
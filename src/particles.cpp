@@ -1,29 +1,53 @@
-#include "particles.h"
-
-void Particles::reserve(std::size_t count) {
-    positionX.reserve(count);
-    positionY.reserve(count);
-    velocityX.reserve(count);
-    velocityY.reserve(count);
-    mass.reserve(count);
-}
-
-void Particles::clear() {
-    positionX.clear();
-    positionY.clear();
-    velocityX.clear();
-    velocityY.clear();
-    mass.clear();
-}
-
-void Particles::add(float x, float y, float vx, float vy, float m) {
-    positionX.push_back(x);
-    positionY.push_back(y);
-    velocityX.push_back(vx);
-    velocityY.push_back(vy);
-    mass.push_back(m);
-}
-
-std::size_t Particles::count() const {
-    return positionX.size();
-}
+#include "particles.h"
+
+template <int Dim>
+void Particles<Dim>::reserve(std::size_t count) {
+    for (int d = 0; d < Dim; d++) {
+        position[d].reserve(count);
+        velocity[d].reserve(count);
+    }
+    mass.reserve(count);
+    id.reserve(count);
+    flags.reserve(count);
+}
+
+template <int Dim>
+void Particles<Dim>::resize(std::size_t count) {
+    for (int d = 0; d < Dim; d++) {
+        position[d].resize(count);
+        velocity[d].resize(count);
+    }
+    mass.resize(count);
+    id.resize(count);
+    flags.resize(count);
+}
+
+template <int Dim>
+void Particles<Dim>::clear() {
+    for (int d = 0; d < Dim; d++) {
+        position[d].clear();
+        velocity[d].clear();
+    }
+    mass.clear();
+    id.clear();
+    flags.clear();
+}
+
+template <int Dim>
+void Particles<Dim>::add(const std::array<float, Dim>& p, const std::array<float, Dim>& v, float m, uint8_t f) {
+    for (int d = 0; d < Dim; d++) {
+        position[d].push_back(p[d]);
+        velocity[d].push_back(v[d]);
+    }
+    mass.push_back(m);
+    id.push_back(0);
+    flags.push_back(f);
+}
+
+template <int Dim>
+std::size_t Particles<Dim>::count() const {
+    return mass.size();
+}
+
+template struct Particles<2>;
+template struct Particles<3>;
@@ -1,16 +1,33 @@
-#pragma once
-#include <vector>
-#include <cstddef>
-
-struct Particles {
-    std::vector<float> positionX;
-    std::vector<float> positionY;
-    std::vector<float> velocityX;
-    std::vector<float> velocityY;
-    std::vector<float> mass;
-
-    void reserve(std::size_t count);
-    void clear();
-    void add(float x, float y, float vx, float vy, float m);
-    std::size_t count() const;
-};
+#pragma once
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "aligned_allocator.h"
+
+// Bits of Particles::flags.
+enum ParticleFlags : uint8_t {
+    // Massive body at a preset's centre, drawn larger and in white.
+    ParticleFlagCentralBody = 1,
+    // Despawned: massless and frozen until the next compaction drops the slot.
+    ParticleFlagRemoved = 2
+};
+
+template <int Dim>
+struct Particles {
+    static_assert(Dim == 2 || Dim == 3, "Particles supports 2D and 3D only");
+
+    std::array<AlignedVector<float>, Dim> position;
+    std::array<AlignedVector<float>, Dim> velocity;
+    AlignedVector<float> mass;
+    // Stable identifier of each slot; GravitySimulation assigns them and keeps them
+    // across compactions.
+    AlignedVector<uint64_t> id;
+    AlignedVector<uint8_t> flags;
+
+    void reserve(std::size_t count);
+    void resize(std::size_t count);
+    void clear();
+    void add(const std::array<float, Dim>& p, const std::array<float, Dim>& v, float m, uint8_t f = 0);
+    std::size_t count() const;
+};
@@ -1,184 +1,402 @@
-#include "renderer.h"
-#include "shaders.h"
-#include <cmath>
-#include <algorithm>
-
-static sf::Color speedToColor(float speed) {
-    float t = std::clamp(speed / 1200.0f, 0.0f, 1.0f);
-
-    auto lerp = [](float a, float b, float u) { return a + (b - a) * u; };
-
-    sf::Color c1(0, 255, 255);
-    sf::Color c2(255, 0, 255);
-    sf::Color c3(255, 255, 255);
-
-    sf::Color out;
-    if (t < 0.7f) {
-        float u = t / 0.7f;
-        out.r = (sf::Uint8)lerp((float)c1.r, (float)c2.r, u);
-        out.g = (sf::Uint8)lerp((float)c1.g, (float)c2.g, u);
-        out.b = (sf::Uint8)lerp((float)c1.b, (float)c2.b, u);
-    } else {
-        float u = (t - 0.7f) / 0.3f;
-        out.r = (sf::Uint8)lerp((float)c2.r, (float)c3.r, u);
-        out.g = (sf::Uint8)lerp((float)c2.g, (float)c3.g, u);
-        out.b = (sf::Uint8)lerp((float)c2.b, (float)c3.b, u);
-    }
-    out.a = 255;
-    return out;
-}
-
-Renderer::Renderer(int windowWidth, int windowHeight)
-    : particleQuads(sf::Quads) {
-    glowShader.loadFromMemory(kGlowFragmentShader, sf::Shader::Fragment);
-    blurShader.loadFromMemory(kBlurFragmentShader, sf::Shader::Fragment);
-    setQualityPreset(2);
-    ensureTargets(windowWidth, windowHeight);
-}
-
-void Renderer::resize(int windowWidth, int windowHeight) {
-    ensureTargets(windowWidth, windowHeight);
-}
-
-void Renderer::setQualityPreset(int presetIndex) {
-    if (presetIndex <= 1) {
-        visualQuality.trailFadeAlpha = 30.0f;
-        visualQuality.glowIntensity = 0.95f;
-        visualQuality.bloomRadius = 6.0f;
-        visualQuality.bloomSigma = 4.0f;
-        visualQuality.bloomDownscale = 0.5f;
-    } else if (presetIndex == 2) {
-        visualQuality.trailFadeAlpha = 18.0f;
-        visualQuality.glowIntensity = 1.15f;
-        visualQuality.bloomRadius = 8.0f;
-        visualQuality.bloomSigma = 5.0f;
-        visualQuality.bloomDownscale = 0.5f;
-    } else {
-        visualQuality.trailFadeAlpha = 12.0f;
-        visualQuality.glowIntensity = 1.35f;
-        visualQuality.bloomRadius = 10.0f;
-        visualQuality.bloomSigma = 6.0f;
-        visualQuality.bloomDownscale = 0.4f;
-    }
-
-    fadeRectangle.setFillColor(sf::Color(0, 0, 0, (sf::Uint8)std::clamp(visualQuality.trailFadeAlpha, 1.0f, 255.0f)));
-}
-
-void Renderer::ensureTargets(int width, int height) {
-    if (width == currentWidth && height == currentHeight) return;
-
-    currentWidth = width;
-    currentHeight = height;
-
-    trailTarget.create((unsigned)width, (unsigned)height);
-    trailTarget.clear(sf::Color::Black);
-    trailTarget.display();
-
-    fadeRectangle.setSize(sf::Vector2f((float)width, (float)height));
-    fadeRectangle.setPosition(0.0f, 0.0f);
-
-    int bloomWidth = std::max(64, (int)std::round(width * visualQuality.bloomDownscale));
-    int bloomHeight = std::max(64, (int)std::round(height * visualQuality.bloomDownscale));
-
-    bloomTargetA.create((unsigned)bloomWidth, (unsigned)bloomHeight);
-    bloomTargetB.create((unsigned)bloomWidth, (unsigned)bloomHeight);
-    bloomTargetA.clear(sf::Color::Black);
-    bloomTargetB.clear(sf::Color::Black);
-    bloomTargetA.display();
-    bloomTargetB.display();
-}
-
-void Renderer::updateParticleQuads(const Particles& particles, float worldUnitsPerPixel) {
-    std::size_t n = particles.count();
-    particleQuads.resize(n * 4);
-
-    float baseSize = std::clamp(1.4f * worldUnitsPerPixel, 0.9f, 6.0f);
-
-    for (std::size_t i = 0; i < n; i++) {
-        float px = particles.positionX[i];
-        float py = particles.positionY[i];
-        float vx = particles.velocityX[i];
-        float vy = particles.velocityY[i];
-
-        float speed = std::sqrt(vx * vx + vy * vy);
-        sf::Color color = speedToColor(speed);
-
-        float size = (i == n - 1) ? (baseSize * 9.0f) : baseSize;
-        if (i == n - 1) color = sf::Color(255, 255, 255);
-
-        sf::Vertex* v = &particleQuads[i * 4];
-
-        v[0].position = { px - size, py - size }; v[0].texCoords = { 0.f, 0.f }; v[0].color = color;
-        v[1].position = { px + size, py - size }; v[1].texCoords = { 1.f, 0.f }; v[1].color = color;
-        v[2].position = { px + size, py + size }; v[2].texCoords = { 1.f, 1.f }; v[2].color = color;
-        v[3].position = { px - size, py + size }; v[3].texCoords = { 0.f, 1.f }; v[3].color = color;
-    }
-}
-
-void Renderer::render(sf::RenderWindow& window, const sf::View& worldView, const Particles& particles) {
-    ensureTargets((int)window.getSize().x, (int)window.getSize().y);
-
-    float worldUnitsPerPixel = worldView.getSize().x / (float)window.getSize().x;
-    updateParticleQuads(particles, worldUnitsPerPixel);
-
-    glowShader.setUniform("uIntensity", visualQuality.glowIntensity);
-
-    trailTarget.setView(trailTarget.getDefaultView());
-    trailTarget.draw(fadeRectangle, sf::BlendAlpha);
-
-    trailTarget.setView(worldView);
-
-    sf::RenderStates glowStates;
-    glowStates.shader = &glowShader;
-    glowStates.blendMode = sf::BlendAdd;
-
-    trailTarget.draw(particleQuads, glowStates);
-    trailTarget.display();
-
-    int bloomWidth = (int)bloomTargetA.getSize().x;
-    int bloomHeight = (int)bloomTargetA.getSize().y;
-
-    sf::Sprite downsample(trailTarget.getTexture());
-    downsample.setScale((float)bloomWidth / (float)trailTarget.getSize().x,
-                        (float)bloomHeight / (float)trailTarget.getSize().y);
-
-    bloomTargetA.setView(bloomTargetA.getDefaultView());
-    bloomTargetA.clear(sf::Color::Black);
-    bloomTargetA.draw(downsample, sf::BlendAdd);
-    bloomTargetA.display();
-
-    blurShader.setUniform("uTexture", sf::Shader::CurrentTexture);
-    blurShader.setUniform("uRadius", visualQuality.bloomRadius);
-    blurShader.setUniform("uSigma", visualQuality.bloomSigma);
-
-    blurShader.setUniform("uDirection", sf::Glsl::Vec2(1.0f / (float)bloomWidth, 0.0f));
-    bloomTargetB.setView(bloomTargetB.getDefaultView());
-    bloomTargetB.clear(sf::Color::Black);
-    {
-        sf::RenderStates st;
-        st.shader = &blurShader;
-        bloomTargetB.draw(sf::Sprite(bloomTargetA.getTexture()), st);
-    }
-    bloomTargetB.display();
-
-    blurShader.setUniform("uDirection", sf::Glsl::Vec2(0.0f, 1.0f / (float)bloomHeight));
-    bloomTargetA.setView(bloomTargetA.getDefaultView());
-    bloomTargetA.clear(sf::Color::Black);
-    {
-        sf::RenderStates st;
-        st.shader = &blurShader;
-        bloomTargetA.draw(sf::Sprite(bloomTargetB.getTexture()), st);
-    }
-    bloomTargetA.display();
-
-    window.setView(window.getDefaultView());
-    window.clear(sf::Color::Black);
-
-    sf::Sprite base(trailTarget.getTexture());
-    window.draw(base);
-
-    sf::Sprite bloom(bloomTargetA.getTexture());
-    bloom.setScale((float)window.getSize().x / (float)bloomWidth,
-                   (float)window.getSize().y / (float)bloomHeight);
-    window.draw(bloom, sf::BlendAdd);
-}
+#include "renderer.h"
+#include "shaders.h"
+#include <SFML/OpenGL.hpp>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Buffer objects and separate blending are past OpenGL 1.1, so on Windows they are only
+// reachable through the context.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_VERTEX_PROGRAM_POINT_SIZE
+#define GL_VERTEX_PROGRAM_POINT_SIZE 0x8642
+#endif
+#ifndef GL_POINT_SPRITE
+#define GL_POINT_SPRITE 0x8861
+#endif
+#ifndef GL_ALIASED_POINT_SIZE_RANGE
+#define GL_ALIASED_POINT_SIZE_RANGE 0x846E
+#endif
+
+struct GlBufferFunctions {
+    void (APIENTRY* genBuffers)(GLsizei, GLuint*) = nullptr;
+    void (APIENTRY* deleteBuffers)(GLsizei, const GLuint*) = nullptr;
+    void (APIENTRY* bindBuffer)(GLenum, GLuint) = nullptr;
+    void (APIENTRY* bufferData)(GLenum, std::ptrdiff_t, const void*, GLenum) = nullptr;
+    void (APIENTRY* bufferSubData)(GLenum, std::ptrdiff_t, std::ptrdiff_t, const void*) = nullptr;
+    void (APIENTRY* blendFuncSeparate)(GLenum, GLenum, GLenum, GLenum) = nullptr;
+
+    bool load() {
+        genBuffers = reinterpret_cast<decltype(genBuffers)>(sf::Context::getFunction("glGenBuffers"));
+        deleteBuffers = reinterpret_cast<decltype(deleteBuffers)>(sf::Context::getFunction("glDeleteBuffers"));
+        bindBuffer = reinterpret_cast<decltype(bindBuffer)>(sf::Context::getFunction("glBindBuffer"));
+        bufferData = reinterpret_cast<decltype(bufferData)>(sf::Context::getFunction("glBufferData"));
+        bufferSubData = reinterpret_cast<decltype(bufferSubData)>(sf::Context::getFunction("glBufferSubData"));
+        blendFuncSeparate =
+            reinterpret_cast<decltype(blendFuncSeparate)>(sf::Context::getFunction("glBlendFuncSeparate"));
+        return genBuffers && deleteBuffers && bindBuffer && bufferData && bufferSubData && blendFuncSeparate;
+    }
+};
+
+static GlBufferFunctions glBuffers;
+
+// Third component of a point splat: 2048 * weight + speed, with weight = 16*log2(particles
+// merged into the splat), 0 for one particle. Speeds past the end of the colour ramp
+// all look the same, so clamping them keeps the two fields apart. The central body is -1.
+static constexpr float kSplatWeightStride = 2048.0f;
+static constexpr float kCentralBodyCode = -1.0f;
+
+static float splatCode(float speed, int count = 1) {
+    float weight = std::min(255.0f, std::round(16.0f * std::log2((float)std::max(1, count))));
+    return weight * kSplatWeightStride + std::min(speed, 1200.0f);
+}
+
+// Alpha is the splat weight read by kGlowFragmentShader.
+static sf::Color splatColor(ParticleColor c, float weight) {
+    return sf::Color(c.r, c.g, c.b, (sf::Uint8)weight);
+}
+
+template <int Dim>
+static float particleSpeed(const Particles<Dim>& particles, std::size_t i) {
+    float v2 = 0.0f;
+    for (int d = 0; d < Dim; d++) v2 += particles.velocity[d][i] * particles.velocity[d][i];
+    return std::sqrt(v2);
+}
+
+Renderer::Renderer(int windowWidth, int windowHeight)
+    : particleQuads(sf::Quads) {
+    glowShader.loadFromMemory(kGlowFragmentShader, sf::Shader::Fragment);
+    blurShader.loadFromMemory(kBlurFragmentShader, sf::Shader::Fragment);
+    pointShaderLoaded = pointShader.loadFromMemory(kPointSplatVertexShader, kPointSplatFragmentShader);
+    setQualityPreset(2);
+    ensureTargets(windowWidth, windowHeight);
+}
+
+Renderer::~Renderer() {
+    if (pointBuffer != 0 && trailTarget.setActive(true)) {
+        GLuint buffer = pointBuffer;
+        glBuffers.deleteBuffers(1, &buffer);
+    }
+}
+
+void Renderer::setPointSprites(bool enabled) {
+    pointSpritesEnabled = enabled;
+}
+
+void Renderer::resize(int windowWidth, int windowHeight) {
+    ensureTargets(windowWidth, windowHeight);
+}
+
+void Renderer::setQualityPreset(int presetIndex) {
+    visualQuality = visualQualityPreset(presetIndex);
+
+    fadeRectangle.setFillColor(sf::Color(0, 0, 0, (sf::Uint8)std::clamp(visualQuality.trailFadeAlpha, 1.0f, 255.0f)));
+}
+
+void Renderer::ensureTargets(int width, int height) {
+    if (width == currentWidth && height == currentHeight) return;
+
+    currentWidth = width;
+    currentHeight = height;
+
+    trailTarget.create((unsigned)width, (unsigned)height);
+    trailTarget.clear(sf::Color::Black);
+    trailTarget.display();
+
+    fadeRectangle.setSize(sf::Vector2f((float)width, (float)height));
+    fadeRectangle.setPosition(0.0f, 0.0f);
+
+    int bloomWidth = std::max(64, (int)std::round(width * visualQuality.bloomDownscale));
+    int bloomHeight = std::max(64, (int)std::round(height * visualQuality.bloomDownscale));
+
+    bloomTargetA.create((unsigned)bloomWidth, (unsigned)bloomHeight);
+    bloomTargetB.create((unsigned)bloomWidth, (unsigned)bloomHeight);
+    bloomTargetA.clear(sf::Color::Black);
+    bloomTargetB.clear(sf::Color::Black);
+    bloomTargetA.display();
+    bloomTargetB.display();
+}
+
+std::size_t Renderer::splatCount() const {
+    return pointSplats.size() / 3;
+}
+
+void Renderer::addSplat(float x, float y, float code) {
+    pointSplats.push_back(x);
+    pointSplats.push_back(y);
+    pointSplats.push_back(code);
+}
+
+void Renderer::writeSplat(std::size_t splat, float x, float y, float size, sf::Color color) {
+    sf::Vertex* v = &particleQuads[splat * 4];
+
+    v[0].position = { x - size, y - size }; v[0].texCoords = { 0.f, 0.f }; v[0].color = color;
+    v[1].position = { x + size, y - size }; v[1].texCoords = { 1.f, 0.f }; v[1].color = color;
+    v[2].position = { x + size, y + size }; v[2].texCoords = { 1.f, 1.f }; v[2].color = color;
+    v[3].position = { x - size, y + size }; v[3].texCoords = { 0.f, 1.f }; v[3].color = color;
+}
+
+// Builds the quads of the fallback path from the packed splats.
+void Renderer::expandSplatsToQuads(float baseSize) {
+    const std::size_t splats = pointSplats.size() / 3;
+    particleQuads.resize(splats * 4);
+    for (std::size_t s = 0; s < splats; s++) {
+        const float x = pointSplats[s * 3];
+        const float y = pointSplats[s * 3 + 1];
+        const float code = pointSplats[s * 3 + 2];
+        if (code < 0.0f) {
+            writeSplat(s, x, y, baseSize * 9.0f, splatColor({ 255, 255, 255 }, 0.0f));
+            continue;
+        }
+        const float weight = std::floor(code / kSplatWeightStride);
+        const float speed = code - weight * kSplatWeightStride;
+        writeSplat(s, x, y, baseSize, splatColor(speedToParticleColor(speed), weight));
+    }
+}
+
+template <int Dim>
+void Renderer::updateSplats(const Particles<Dim>& particles) {
+    const std::size_t n = particles.count();
+    pointSplats.clear();
+    pointSplats.reserve(n * 3);
+
+    for (std::size_t i = 0; i < n; i++) {
+        const uint8_t flags = particles.flags[i];
+        if (flags & ParticleFlagRemoved) continue;
+        const float code = (flags & ParticleFlagCentralBody) ? kCentralBodyCode : splatCode(particleSpeed(particles, i));
+        addSplat(particles.position[0][i], particles.position[1][i], code);
+    }
+}
+
+template <int Dim>
+void Renderer::updateSplatsFromTree(const Particles<Dim>& particles, const BarnesHutTree<Dim>& tree,
+                                    const sf::View& worldView, float worldUnitsPerPixel, float baseSize,
+                                    float motionMargin) {
+    const std::size_t n = particles.count();
+    const auto& nodes = tree.nodes();
+    const std::vector<int>& order = tree.particleOrder();
+
+    pointSplats.clear();
+    pointSplats.reserve(n * 3);
+
+    // Visible rectangle grown by the largest splat, so partly visible splats are kept.
+    const float pad = baseSize * 9.0f;
+    const float left = worldView.getCenter().x - 0.5f * worldView.getSize().x - pad;
+    const float right = worldView.getCenter().x + 0.5f * worldView.getSize().x + pad;
+    const float top = worldView.getCenter().y - 0.5f * worldView.getSize().y - pad;
+    const float bottom = worldView.getCenter().y + 0.5f * worldView.getSize().y + pad;
+
+    auto visible = [&](float x, float y) { return x >= left && x <= right && y >= top && y <= bottom; };
+
+    // Stackless walk: opening a node moves to its first child, culling it or drawing it
+    // whole follows the skip index past its subtree.
+    const int nodeEnd = (int)nodes.size();
+    int nodeIndex = 0;
+    while (nodeIndex < nodeEnd) {
+        const BarnesHutNode<Dim>& node = nodes[(std::size_t)nodeIndex];
+        nodeIndex = node.skipIndex;
+        if (node.particleCount == 0) continue;
+
+        // Members may have left the node's box by up to one step of motion.
+        const float extent = node.halfSize + motionMargin;
+        if (node.center[0] + extent < left || node.center[0] - extent > right ||
+            node.center[1] + extent < top || node.center[1] - extent > bottom) {
+            continue;
+        }
+
+        if (node.particleCount > 1 && 2.0f * node.halfSize < worldUnitsPerPixel) {
+            // Everything in here lands on about one pixel: draw one splat at the current
+            // position of an ordinary member, weighted by how many splats it stands for.
+            // Only ordinary members count: despawned slots stay in the tree until the next
+            // compaction, and central bodies are drawn on their own below.
+            int ordinaryMembers = 0;
+            std::size_t representative = 0;
+            for (int k = node.firstParticle; k < node.firstParticle + node.particleCount; k++) {
+                const std::size_t i = (std::size_t)order[(std::size_t)k];
+                if (particles.flags[i] != 0) continue;
+                if (ordinaryMembers++ == 0) representative = i;
+            }
+            if (ordinaryMembers == 0) continue;
+
+            const float x = particles.position[0][representative];
+            const float y = particles.position[1][representative];
+            if (visible(x, y)) addSplat(x, y, splatCode(particleSpeed(particles, representative), ordinaryMembers));
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for (int k = node.firstParticle; k < node.firstParticle + node.particleCount; k++) {
+                const std::size_t i = (std::size_t)order[(std::size_t)k];
+                const float x = particles.position[0][i];
+                const float y = particles.position[1][i];
+                if (particles.flags[i] != 0 || !visible(x, y)) continue;
+                addSplat(x, y, splatCode(particleSpeed(particles, i)));
+            }
+            continue;
+        }
+
+        nodeIndex = node.childIndex[0];
+    }
+
+    // Central bodies are drawn last and on their own, so culling never drops them. The
+    // flag column is one byte per particle, which keeps this scan cheap.
+    for (std::size_t i = 0; i < n; i++) {
+        if ((particles.flags[i] & (ParticleFlagCentralBody | ParticleFlagRemoved)) != ParticleFlagCentralBody) continue;
+        addSplat(particles.position[0][i], particles.position[1][i], kCentralBodyCode);
+    }
+}
+
+bool Renderer::pointSpritesReady() {
+    if (!pointSpritesEnabled || !pointShaderLoaded) return false;
+    if (pointSupport < 0) {
+        pointSupport = 0;
+        if (trailTarget.setActive(true) && glBuffers.load()) {
+            GLfloat range[2] = { 1.0f, 1.0f };
+            glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, range);
+            maxPointSize = range[1];
+            GLuint buffer = 0;
+            glBuffers.genBuffers(1, &buffer);
+            pointBuffer = buffer;
+            pointSupport = (buffer != 0) ? 1 : 0;
+        }
+    }
+    return pointSupport == 1;
+}
+
+// Draws the packed splats into the trail target as point sprites with additive blending,
+// like the quad path. Returns false when a splat would exceed the largest point size, in
+// which case nothing is drawn and the caller uses quads for this frame.
+bool Renderer::drawPointSplats(const sf::View& worldView, float splatPixels) {
+    if (splatPixels * 9.0f > maxPointSize) return false;
+    if (!trailTarget.setActive(true)) return false;
+
+    const std::size_t bytes = pointSplats.size() * sizeof(float);
+    glBuffers.bindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+    // Orphaning: a fresh store every frame lets the driver keep drawing from the previous
+    // one instead of waiting for it before the upload.
+    if (bytes > pointBufferBytes) pointBufferBytes = bytes + bytes / 4;
+    glBuffers.bufferData(GL_ARRAY_BUFFER, (std::ptrdiff_t)pointBufferBytes, nullptr, GL_STREAM_DRAW);
+    glBuffers.bufferSubData(GL_ARRAY_BUFFER, 0, (std::ptrdiff_t)bytes, pointSplats.data());
+
+    const sf::Vector2f center = worldView.getCenter();
+    const sf::Vector2f size = worldView.getSize();
+    pointShader.setUniform("uView", sf::Glsl::Vec4(center.x, center.y, 2.0f / size.x, -2.0f / size.y));
+    pointShader.setUniform("uPointSize", splatPixels);
+    pointShader.setUniform("uIntensity", visualQuality.glowIntensity);
+    sf::Shader::bind(&pointShader);
+
+    const sf::Vector2u targetSize = trailTarget.getSize();
+    glViewport(0, 0, (GLsizei)targetSize.x, (GLsizei)targetSize.y);
+    glEnable(GL_BLEND);
+    glBuffers.blendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ONE, GL_ONE);
+    glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE);
+
+    // SFML leaves its own client arrays enabled; only positions are sourced here.
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)(pointSplats.size() / 3));
+
+    glDisable(GL_POINT_SPRITE);
+    glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    glBuffers.bindBuffer(GL_ARRAY_BUFFER, 0);
+    sf::Shader::bind(nullptr);
+    trailTarget.resetGLStates();
+    return true;
+}
+
+template <int Dim>
+void Renderer::render(sf::RenderWindow& window, const sf::View& worldView, const Particles<Dim>& particles,
+                      const BarnesHutTree<Dim>* tree, float motionMargin) {
+    ensureTargets((int)window.getSize().x, (int)window.getSize().y);
+
+    float worldUnitsPerPixel = worldView.getSize().x / (float)window.getSize().x;
+    const float baseSize = std::clamp(1.4f * worldUnitsPerPixel, 0.9f, 6.0f);
+    if (tree && !particles.mass.empty() && !tree->nodes().empty() && tree->particleOrder().size() == particles.count()) {
+        updateSplatsFromTree(particles, *tree, worldView, worldUnitsPerPixel, baseSize, motionMargin);
+    } else {
+        updateSplats(particles);
+    }
+
+    glowShader.setUniform("uIntensity", visualQuality.glowIntensity);
+
+    trailTarget.setView(trailTarget.getDefaultView());
+    trailTarget.draw(fadeRectangle, sf::BlendAlpha);
+
+    trailTarget.setView(worldView);
+
+    sf::RenderStates glowStates;
+    glowStates.shader = &glowShader;
+    glowStates.blendMode = sf::BlendAdd;
+
+    // Quads span twice the splat size, so the point diameter is 2 * baseSize in pixels.
+    const bool drewPoints = pointSpritesReady() && drawPointSplats(worldView, 2.0f * baseSize / worldUnitsPerPixel);
+    if (!drewPoints) {
+        expandSplatsToQuads(baseSize);
+        trailTarget.draw(particleQuads, glowStates);
+    }
+    trailTarget.display();
+
+    int bloomWidth = (int)bloomTargetA.getSize().x;
+    int bloomHeight = (int)bloomTargetA.getSize().y;
+
+    sf::Sprite downsample(trailTarget.getTexture());
+    downsample.setScale((float)bloomWidth / (float)trailTarget.getSize().x,
+                        (float)bloomHeight / (float)trailTarget.getSize().y);
+
+    bloomTargetA.setView(bloomTargetA.getDefaultView());
+    bloomTargetA.clear(sf::Color::Black);
+    bloomTargetA.draw(downsample, sf::BlendAdd);
+    bloomTargetA.display();
+
+    blurShader.setUniform("uTexture", sf::Shader::CurrentTexture);
+    blurShader.setUniform("uRadius", visualQuality.bloomRadius);
+    blurShader.setUniform("uSigma", visualQuality.bloomSigma);
+
+    blurShader.setUniform("uDirection", sf::Glsl::Vec2(1.0f / (float)bloomWidth, 0.0f));
+    bloomTargetB.setView(bloomTargetB.getDefaultView());
+    bloomTargetB.clear(sf::Color::Black);
+    {
+        sf::RenderStates st;
+        st.shader = &blurShader;
+        bloomTargetB.draw(sf::Sprite(bloomTargetA.getTexture()), st);
+    }
+    bloomTargetB.display();
+
+    blurShader.setUniform("uDirection", sf::Glsl::Vec2(0.0f, 1.0f / (float)bloomHeight));
+    bloomTargetA.setView(bloomTargetA.getDefaultView());
+    bloomTargetA.clear(sf::Color::Black);
+    {
+        sf::RenderStates st;
+        st.shader = &blurShader;
+        bloomTargetA.draw(sf::Sprite(bloomTargetB.getTexture()), st);
+    }
+    bloomTargetA.display();
+
+    window.setView(window.getDefaultView());
+    window.clear(sf::Color::Black);
+
+    sf::Sprite base(trailTarget.getTexture());
+    window.draw(base);
+
+    sf::Sprite bloom(bloomTargetA.getTexture());
+    bloom.setScale((float)window.getSize().x / (float)bloomWidth,
+                   (float)window.getSize().y / (float)bloomHeight);
+    window.draw(bloom, sf::BlendAdd);
+}
+
+template void Renderer::render<2>(sf::RenderWindow&, const sf::View&, const Particles<2>&,
+                                  const BarnesHutTree<2>*, float);
+template void Renderer::render<3>(sf::RenderWindow&, const sf::View&, const Particles<3>&,
+                                  const BarnesHutTree<3>*, float);
@@ -1,39 +1,65 @@
-#pragma once
-#include <SFML/Graphics.hpp>
-#include "particles.h"
-
-struct VisualQuality {
-    float trailFadeAlpha = 18.0f;
-    float glowIntensity = 1.15f;
-    float bloomRadius = 8.0f;
-    float bloomSigma = 5.0f;
-    float bloomDownscale = 0.5f;
-};
-
-class Renderer {
-public:
-    Renderer(int windowWidth, int windowHeight);
-
-    void resize(int windowWidth, int windowHeight);
-    void setQualityPreset(int presetIndex);
-
-    void render(sf::RenderWindow& window, const sf::View& worldView, const Particles& particles);
-
-private:
-    void ensureTargets(int width, int height);
-    void updateParticleQuads(const Particles& particles, float worldUnitsPerPixel);
-
-    sf::RenderTexture trailTarget;
-    sf::RenderTexture bloomTargetA;
-    sf::RenderTexture bloomTargetB;
-
-    sf::Shader glowShader;
-    sf::Shader blurShader;
-
-    sf::VertexArray particleQuads;
-    sf::RectangleShape fadeRectangle;
-
-    VisualQuality visualQuality;
-    int currentWidth = 0;
-    int currentHeight = 0;
-};
+#pragma once
+#include <SFML/Graphics.hpp>
+#include "particles.h"
+#include "barnes_hut.h"
+#include "visual_quality.h"
+
+class Renderer {
+public:
+    Renderer(int windowWidth, int windowHeight);
+    ~Renderer();
+
+    void resize(int windowWidth, int windowHeight);
+    void setQualityPreset(int presetIndex);
+    // Streams one (x, y, code) vertex per splat and expands it to a point sprite on the
+    // GPU. Falls back to CPU-built quads when the context lacks the needed features.
+    void setPointSprites(bool enabled);
+
+    // 3D particles are projected orthographically onto the XY view plane. With a tree,
+    // off-screen nodes are skipped and nodes smaller than a pixel are drawn as a single
+    // splat; motionMargin is how far particles may have moved since the tree was built.
+    template <int Dim>
+    void render(sf::RenderWindow& window, const sf::View& worldView, const Particles<Dim>& particles,
+                const BarnesHutTree<Dim>* tree = nullptr, float motionMargin = 0.0f);
+
+    std::size_t splatCount() const;
+
+private:
+    void ensureTargets(int width, int height);
+    template <int Dim>
+    void updateSplats(const Particles<Dim>& particles);
+    template <int Dim>
+    void updateSplatsFromTree(const Particles<Dim>& particles, const BarnesHutTree<Dim>& tree,
+                              const sf::View& worldView, float worldUnitsPerPixel, float baseSize,
+                              float motionMargin);
+    void addSplat(float x, float y, float code);
+    void expandSplatsToQuads(float baseSize);
+    void writeSplat(std::size_t splat, float x, float y, float size, sf::Color color);
+    bool pointSpritesReady();
+    bool drawPointSplats(const sf::View& worldView, float splatPixels);
+
+    sf::RenderTexture trailTarget;
+    sf::RenderTexture bloomTargetA;
+    sf::RenderTexture bloomTargetB;
+
+    sf::Shader glowShader;
+    sf::Shader blurShader;
+    sf::Shader pointShader;
+
+    // Packed (x, y, code) splats of the current frame; quads are only built from them
+    // on the fallback path.
+    std::vector<float> pointSplats;
+    sf::VertexArray particleQuads;
+    bool pointSpritesEnabled = true;
+    bool pointShaderLoaded = false;
+    int pointSupport = -1;  // -1 until probed with the trail target's context current
+    float maxPointSize = 1.0f;
+    unsigned int pointBuffer = 0;
+    std::size_t pointBufferBytes = 0;
+
+    sf::RectangleShape fadeRectangle;
+
+    VisualQuality visualQuality;
+    int currentWidth = 0;
+    int currentHeight = 0;
+};
@@ -1,42 +1,89 @@
-#pragma once
-
-static const char* kGlowFragmentShader = R"(
-uniform float uIntensity;
-void main() {
-    vec2 uv = gl_TexCoord[0].xy * 2.0 - 1.0;
-    float r2 = dot(uv, uv);
-    float a = exp(-r2 * 2.6) * uIntensity;
-    vec4 c = gl_Color;
-    c.a *= a;
-    gl_FragColor = c;
-}
-)";
-
-static const char* kBlurFragmentShader = R"(
-uniform sampler2D uTexture;
-uniform vec2 uDirection;
-uniform float uRadius;
-uniform float uSigma;
-
-float gaussian(float x, float sigma) {
-    return exp(-(x*x) / (2.0*sigma*sigma));
-}
-
-void main() {
-    vec2 uv = gl_TexCoord[0].xy;
-    vec4 sum = vec4(0.0);
-    float wsum = 0.0;
-
-    float radius = uRadius;
-    float sigma = uSigma;
-
-    for (float i = -radius; i <= radius; i += 1.0) {
-        float w = gaussian(i, sigma);
-        vec2 offset = uDirection * i;
-        sum += texture2D(uTexture, uv + offset) * w;
-        wsum += w;
-    }
-
-    gl_FragColor = sum / wsum;
-}
+#pragma once
+
+static const char* kGlowFragmentShader = R"(
+uniform float uIntensity;
+void main() {
+    vec2 uv = gl_TexCoord[0].xy * 2.0 - 1.0;
+    float r2 = dot(uv, uv);
+    // Vertex alpha carries 16*log2(particles merged into this splat), 0 for a single
+    // particle, so a level-of-detail splat saturates like the splats it replaces.
+    float weight = exp2(gl_Color.a * (255.0 / 16.0));
+    float a = exp(-r2 * 2.6) * uIntensity * weight;
+    gl_FragColor = vec4(gl_Color.rgb, min(a, 1.0));
+}
+)";
+
+// Point-sprite splats. Each vertex is (x, y, code): code packs the splat weight and the
+// particle speed as 2048 * weight + speed (see splatCode in renderer.cpp), and a
+// negative code marks the central body. The colour ramp matches speedToParticleColor.
+static const char* kPointSplatVertexShader = R"(
+#version 120
+uniform vec4 uView;
+uniform float uPointSize;
+varying vec3 vColor;
+varying float vWeight;
+
+vec3 speedRamp(float speed) {
+    float t = clamp(speed / 1200.0, 0.0, 1.0);
+    vec3 cyan = vec3(0.0, 1.0, 1.0);
+    vec3 magenta = vec3(1.0, 0.0, 1.0);
+    if (t < 0.7) return mix(cyan, magenta, t / 0.7);
+    return mix(magenta, vec3(1.0), (t - 0.7) / 0.3);
+}
+
+void main() {
+    float code = gl_Vertex.z;
+    gl_Position = vec4((gl_Vertex.xy - uView.xy) * uView.zw, 0.0, 1.0);
+    if (code < 0.0) {
+        vColor = vec3(1.0);
+        vWeight = 1.0;
+        gl_PointSize = uPointSize * 9.0;
+    } else {
+        float weight = floor(code / 2048.0);
+        vColor = speedRamp(code - weight * 2048.0);
+        vWeight = exp2(weight / 16.0);
+        gl_PointSize = uPointSize;
+    }
+}
+)";
+
+static const char* kPointSplatFragmentShader = R"(
+#version 120
+uniform float uIntensity;
+varying vec3 vColor;
+varying float vWeight;
+void main() {
+    vec2 uv = gl_PointCoord * 2.0 - 1.0;
+    float a = exp(-dot(uv, uv) * 2.6) * uIntensity * vWeight;
+    gl_FragColor = vec4(vColor, min(a, 1.0));
+}
+)";
+
+static const char* kBlurFragmentShader = R"(
+uniform sampler2D uTexture;
+uniform vec2 uDirection;
+uniform float uRadius;
+uniform float uSigma;
+
+float gaussian(float x, float sigma) {
+    return exp(-(x*x) / (2.0*sigma*sigma));
+}
+
+void main() {
+    vec2 uv = gl_TexCoord[0].xy;
+    vec4 sum = vec4(0.0);
+    float wsum = 0.0;
+
+    float radius = uRadius;
+    float sigma = uSigma;
+
+    for (float i = -radius; i <= radius; i += 1.0) {
+        float w = gaussian(i, sigma);
+        vec2 offset = uDirection * i;
+        sum += texture2D(uTexture, uv + offset) * w;
+        wsum += w;
+    }
+
+    gl_FragColor = sum / wsum;
+}
 )";
\ No newline at end of file
@@ -1,9 +1,122 @@
-#pragma once
-
-struct SimulationParams {
-    float gravitationalConstant = 220.0f;
-    float softeningLength = 8.0f;
-    float fixedTimeStep = 1.0f / 60.0f;
-    float barnesHutTheta = 2.00f;
-    float velocityClamp = 2600.0f;
-};
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+enum class OpeningCriterion {
+    Geometric,
+    RelativeAcceleration
+};
+
+enum class ForceSolver {
+    BarnesHut,
+    ParticleMesh,
+    TreePM
+};
+
+// Tree behind the Barnes-Hut walk. Octree cuts every cube into 2^Dim equal children
+// (a quadtree in 2D), which goes deep in dense cores and leaves many empty nodes around
+// them; KdTree is BarnesHutTree::buildBalanced(), median splits with a depth of log2 N.
+enum class TreeType {
+    Octree,
+    KdTree
+};
+
+// Time integrator of stepFixed(). SymplecticEuler kicks with the forces at the start of
+// the step and then drifts. Leapfrog (kick-drift-kick) and ForestRuth (three leapfrog
+// stages, fourth order) end every step with a force evaluation at the new positions and
+// start the next one from it, so they cost one and three evaluations per step.
+enum class Integrator {
+    SymplecticEuler,
+    Leapfrog,
+    ForestRuth
+};
+
+// Storage of the integrated positions and velocities. The tree, the force walk and all
+// readers of particles() work in float either way. Double keeps double copies that
+// the kick and drift advance and round into the float columns, so round-off no longer
+// accumulates in the positions of long runs.
+enum class PositionPrecision {
+    Single,
+    Double
+};
+
+enum class MassAssignment {
+    CloudInCell,
+    TriangularShapedCloud
+};
+
+// Region of interest in the XY plane, e.g. the viewer's visible rectangle. Particles
+// within margin of it open nodes with the strict innerTheta; further out theta ramps back
+// to the global barnesHutTheta over another margin, so accuracy is spent where it is seen.
+struct FocusRegion {
+    bool enabled = false;
+    float minX = 0.0f;
+    float minY = 0.0f;
+    float maxX = 0.0f;
+    float maxY = 0.0f;
+    float margin = 400.0f;
+    float innerTheta = 0.5f;
+
+    // Opening parameter for something spanning [loX, hiX] x [loY, hiY], taken at its
+    // point nearest the region; baseTheta applies far away.
+    float thetaFor(float baseTheta, float loX, float loY, float hiX, float hiY) const {
+        if (!enabled) return baseTheta;
+        const float gapX = std::max(0.0f, std::max(minX - hiX, loX - maxX));
+        const float gapY = std::max(0.0f, std::max(minY - hiY, loY - maxY));
+        const float distance = std::sqrt(gapX * gapX + gapY * gapY);
+        const float t = std::clamp((distance - margin) / std::max(margin, 1.0f), 0.0f, 1.0f);
+        const float strict = std::min(innerTheta, baseTheta);
+        return strict + (baseTheta - strict) * t;
+    }
+};
+
+// Global step size chosen by GravitySimulation::advance() when adaptive:
+//   dt = min(accelerationFactor * sqrt(softening / max|a|), velocityFactor * softening / max|v|,
+//            maxTimeStep), at least minTimeStep.
+// With energyTolerance > 0, dt is further halved whenever the relative energy changes by
+// more than that between two diagnostics measurements, and recovers while it stays well
+// below; this needs diagnosticsInterval > 0.
+struct TimeStepControl {
+    bool adaptive = false;
+    float accelerationFactor = 0.25f;
+    float velocityFactor = 2.0f;
+    float minTimeStep = 1.0e-4f;
+    float maxTimeStep = 0.25f;
+    float energyTolerance = 0.0f;
+};
+
+struct SimulationParams {
+    float gravitationalConstant = 220.0f;
+    float softeningLength = 8.0f;
+    float fixedTimeStep = 1.0f / 60.0f;
+    Integrator integrator = Integrator::SymplecticEuler;
+    PositionPrecision positionPrecision = PositionPrecision::Single;
+    TimeStepControl timeStep;
+    float barnesHutTheta = 2.00f;
+    TreeType treeType = TreeType::Octree;
+    OpeningCriterion openingCriterion = OpeningCriterion::Geometric;
+    float relativeForceAccuracy = 0.05f;
+    float velocityClamp = 2600.0f;
+    int diagnosticsInterval = 0;
+    // Per-particle theta around a region of interest; off by default.
+    FocusRegion focus;
+    // Keeps the pool's workers polling for the whole step instead of parking between passes.
+    bool residentWorkers = false;
+    // Smallest particle range a worker takes in the force and integration passes; below
+    // two of them a pass runs on the calling thread alone.
+    std::size_t particleGrain = 16384;
+    // Most particles in a leaf of the balanced k-d tree.
+    int treeBucketSize = 8;
+
+    // Reuse per-group tree interaction lists across steps (Barnes-Hut solver only). Lists
+    // are built with the opening test tightened by the margin (a fraction of theta) and
+    // re-walked once motion has used it up.
+    bool interactionLists = false;
+    float interactionListMargin = 0.1f;
+
+    ForceSolver forceSolver = ForceSolver::BarnesHut;
+    MassAssignment massAssignment = MassAssignment::CloudInCell;
+    int meshSize = 256;             // cells per axis covering the particles (power of two)
+    float treePmSplitCells = 1.25f; // TreePM split radius r_s in mesh cells
+};
@@ -0,0 +1,319 @@
+#include "software_renderer.h"
+#include <algorithm>
+#include <cmath>
+
+// Rows per band. Small enough to give every worker several bands at 1080p, large
+// enough that a band's three planes stay in L2 while its splats are drawn.
+static constexpr int kBandRows = 16;
+
+// Pixels whose centres fall inside [center - radius, center + radius], clipped to the
+// framebuffer; matches which fragments the GPU rasterizes for a splat quad.
+static bool splatSpan(float center, float radius, int limit, int& first, int& last) {
+    first = std::max(0, (int)std::ceil(center - radius - 0.5f));
+    last = std::min(limit - 1, (int)std::floor(center + radius - 0.5f));
+    return first <= last;
+}
+
+SoftwareRenderer::SoftwareRenderer(ThreadPool& threadPool, int width, int height)
+    : pool(threadPool),
+      frameWidth(std::max(1, width)),
+      frameHeight(std::max(1, height)) {
+    setQualityPreset(2);
+}
+
+int SoftwareRenderer::width() const { return frameWidth; }
+int SoftwareRenderer::height() const { return frameHeight; }
+const std::vector<uint8_t>& SoftwareRenderer::frame() const { return rgb; }
+
+void SoftwareRenderer::setQualityPreset(int presetIndex) {
+    visualQuality = visualQualityPreset(presetIndex);
+
+    bloomWidth = std::max(64, (int)std::round(frameWidth * visualQuality.bloomDownscale));
+    bloomHeight = std::max(64, (int)std::round(frameHeight * visualQuality.bloomDownscale));
+
+    // Same taps as kBlurFragmentShader: integer offsets in [-radius, radius], normalized.
+    const int radius = (int)visualQuality.bloomRadius;
+    const float sigma = visualQuality.bloomSigma;
+    blurWeights.resize((std::size_t)(2 * radius + 1));
+    float weightSum = 0.0f;
+    for (int i = -radius; i <= radius; i++) {
+        float w = std::exp(-(float)(i * i) / (2.0f * sigma * sigma));
+        blurWeights[(std::size_t)(i + radius)] = w;
+        weightSum += w;
+    }
+    for (float& w : blurWeights) w /= weightSum;
+
+    // Nearest-texel lookups, as the GPU path samples its (non-smoothed) render textures.
+    bloomColumnSource.resize((std::size_t)bloomWidth);
+    for (int x = 0; x < bloomWidth; x++) {
+        bloomColumnSource[(std::size_t)x] = std::min(frameWidth - 1, (int)((x + 0.5f) * frameWidth / bloomWidth));
+    }
+    bloomRowSource.resize((std::size_t)bloomHeight);
+    for (int y = 0; y < bloomHeight; y++) {
+        bloomRowSource[(std::size_t)y] = std::min(frameHeight - 1, (int)((y + 0.5f) * frameHeight / bloomHeight));
+    }
+    frameColumnBloom.resize((std::size_t)frameWidth);
+    for (int x = 0; x < frameWidth; x++) {
+        frameColumnBloom[(std::size_t)x] = std::min(bloomWidth - 1, (int)((x + 0.5f) * bloomWidth / frameWidth));
+    }
+    frameRowBloom.resize((std::size_t)frameHeight);
+    for (int y = 0; y < frameHeight; y++) {
+        frameRowBloom[(std::size_t)y] = std::min(bloomHeight - 1, (int)((y + 0.5f) * bloomHeight / frameHeight));
+    }
+
+    const std::size_t framePixels = (std::size_t)frameWidth * (std::size_t)frameHeight;
+    const std::size_t bloomPixels = (std::size_t)bloomWidth * (std::size_t)bloomHeight;
+    for (int c = 0; c < 3; c++) {
+        trail[c].resize(framePixels);
+        bloomA[c].resize(bloomPixels);
+        bloomB[c].resize(bloomPixels);
+    }
+    rgb.resize(framePixels * 3);
+    clear();
+}
+
+void SoftwareRenderer::clear() {
+    for (int c = 0; c < 3; c++) std::fill(trail[c].begin(), trail[c].end(), 0.0f);
+    std::fill(rgb.begin(), rgb.end(), (uint8_t)0);
+}
+
+void SoftwareRenderer::forEachRowBand(int rows, const std::function<void(int, int)>& task) {
+    const int bandCount = (rows + kBandRows - 1) / kBandRows;
+    pool.runTasks((std::size_t)bandCount, [&](std::size_t band) {
+        const int y0 = (int)band * kBandRows;
+        task(y0, std::min(rows, y0 + kBandRows));
+    });
+}
+
+template <int Dim>
+void SoftwareRenderer::projectParticles(const Particles<Dim>& particles, const WorldView& view) {
+    const std::size_t n = particles.count();
+    splatX.resize(n);
+    splatY.resize(n);
+    splatRadius.resize(n);
+    for (int c = 0; c < 3; c++) splatColor[c].resize(n);
+
+    const float scale = (float)frameWidth / view.width;
+    const float left = view.centerX - 0.5f * view.width;
+    const float top = view.centerY - 0.5f * view.height;
+    const float baseSize = std::clamp(1.4f * view.width / (float)frameWidth, 0.9f, 6.0f);
+    const float colorScale = visualQuality.glowIntensity / 255.0f;
+    const float maxX = (float)frameWidth;
+    const float maxY = (float)frameHeight;
+
+    pool.parallelFor(0, n, 16384, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const bool centralBody = (particles.flags[i] & ParticleFlagCentralBody) != 0;
+            const float x = (particles.position[0][i] - left) * scale;
+            const float y = (particles.position[1][i] - top) * scale;
+            float radius = (centralBody ? baseSize * 9.0f : baseSize) * scale;
+            if (x + radius < 0.0f || x - radius > maxX || y + radius < 0.0f || y - radius > maxY) radius = 0.0f;
+            if (particles.flags[i] & ParticleFlagRemoved) radius = 0.0f;
+
+            float v2 = 0.0f;
+            for (int d = 0; d < Dim; d++) v2 += particles.velocity[d][i] * particles.velocity[d][i];
+            ParticleColor color = centralBody ? ParticleColor{ 255, 255, 255 } : speedToParticleColor(std::sqrt(v2));
+
+            splatX[i] = x;
+            splatY[i] = y;
+            splatRadius[i] = radius;
+            splatColor[0][i] = color.r * colorScale;
+            splatColor[1][i] = color.g * colorScale;
+            splatColor[2][i] = color.b * colorScale;
+        }
+    });
+}
+
+// Counting sort of splats into the row bands they touch. Within a band splats keep
+// index order, so every band accumulates in the same order on any thread count.
+void SoftwareRenderer::binSplats() {
+    const int bandCount = (frameHeight + kBandRows - 1) / kBandRows;
+    bandOffsets.assign((std::size_t)bandCount + 1, 0u);
+
+    const std::size_t n = splatRadius.size();
+    for (std::size_t i = 0; i < n; i++) {
+        int first, last;
+        if (splatRadius[i] <= 0.0f || !splatSpan(splatY[i], splatRadius[i], frameHeight, first, last)) continue;
+        for (int band = first / kBandRows; band <= last / kBandRows; band++) bandOffsets[(std::size_t)band + 1]++;
+    }
+    for (int band = 0; band < bandCount; band++) bandOffsets[(std::size_t)band + 1] += bandOffsets[(std::size_t)band];
+
+    bandSplats.resize(bandOffsets.back());
+    std::vector<uint32_t> cursor(bandOffsets.begin(), bandOffsets.end() - 1);
+    for (std::size_t i = 0; i < n; i++) {
+        int first, last;
+        if (splatRadius[i] <= 0.0f || !splatSpan(splatY[i], splatRadius[i], frameHeight, first, last)) continue;
+        for (int band = first / kBandRows; band <= last / kBandRows; band++) {
+            bandSplats[cursor[(std::size_t)band]++] = (uint32_t)i;
+        }
+    }
+}
+
+// Fade, splat and saturate one band. The GPU path keeps its trail in an 8-bit target,
+// so values are clamped to 1 after drawing to get the same saturation.
+void SoftwareRenderer::drawTrailBand(int band) {
+    const int y0 = band * kBandRows;
+    const int y1 = std::min(frameHeight, y0 + kBandRows);
+    const std::size_t rowBegin = (std::size_t)y0 * (std::size_t)frameWidth;
+    const std::size_t rowEnd = (std::size_t)y1 * (std::size_t)frameWidth;
+
+    const float keep = 1.0f - std::clamp(visualQuality.trailFadeAlpha, 1.0f, 255.0f) / 255.0f;
+    for (int c = 0; c < 3; c++) {
+        float* plane = trail[c].data();
+        for (std::size_t p = rowBegin; p < rowEnd; p++) plane[p] *= keep;
+    }
+
+    // exp(-(u^2 + v^2) * 2.6) factors into a row and a column term, so each splat needs
+    // one exp per covered row and column instead of one per pixel.
+    std::vector<float> columnWeight;
+    for (uint32_t k = bandOffsets[(std::size_t)band]; k < bandOffsets[(std::size_t)band + 1]; k++) {
+        const uint32_t i = bandSplats[k];
+        const float sx = splatX[i];
+        const float sy = splatY[i];
+        const float radius = splatRadius[i];
+        const float invRadius = 1.0f / radius;
+
+        int xFirst, xLast, yFirst, yLast;
+        if (!splatSpan(sx, radius, frameWidth, xFirst, xLast)) continue;
+        splatSpan(sy, radius, frameHeight, yFirst, yLast);
+        yFirst = std::max(yFirst, y0);
+        yLast = std::min(yLast, y1 - 1);
+
+        const float r = splatColor[0][i];
+        const float g = splatColor[1][i];
+        const float b = splatColor[2][i];
+
+        columnWeight.resize((std::size_t)(xLast - xFirst + 1));
+        for (int x = xFirst; x <= xLast; x++) {
+            const float u = ((float)x + 0.5f - sx) * invRadius;
+            columnWeight[(std::size_t)(x - xFirst)] = std::exp(-u * u * 2.6f);
+        }
+
+        for (int y = yFirst; y <= yLast; y++) {
+            const float v = ((float)y + 0.5f - sy) * invRadius;
+            const float rowWeight = std::exp(-v * v * 2.6f);
+            const std::size_t offset = (std::size_t)y * (std::size_t)frameWidth + (std::size_t)xFirst;
+            float* outR = trail[0].data() + offset;
+            float* outG = trail[1].data() + offset;
+            float* outB = trail[2].data() + offset;
+            for (int x = 0; x <= xLast - xFirst; x++) {
+                const float a = rowWeight * columnWeight[(std::size_t)x];
+                outR[x] += r * a;
+                outG[x] += g * a;
+                outB[x] += b * a;
+            }
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        float* plane = trail[c].data();
+        for (std::size_t p = rowBegin; p < rowEnd; p++) plane[p] = std::min(plane[p], 1.0f);
+    }
+}
+
+void SoftwareRenderer::downsampleTrail() {
+    forEachRowBand(bloomHeight, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const std::size_t sourceRow = (std::size_t)bloomRowSource[(std::size_t)y] * (std::size_t)frameWidth;
+            const std::size_t row = (std::size_t)y * (std::size_t)bloomWidth;
+            for (int c = 0; c < 3; c++) {
+                const float* source = trail[c].data() + sourceRow;
+                float* out = bloomA[c].data() + row;
+                for (int x = 0; x < bloomWidth; x++) out[x] = source[bloomColumnSource[(std::size_t)x]];
+            }
+        }
+    });
+}
+
+// Tap-outer loops over contiguous rows, so the compiler vectorizes the inner loop
+// across pixels. The horizontal pass reads from an edge-padded copy of each row
+// (clamp-to-edge, like the texture sampler).
+void SoftwareRenderer::blurHorizontal(const Planes& source, Planes& destination) {
+    const int radius = (int)(blurWeights.size() / 2);
+    forEachRowBand(bloomHeight, [&](int y0, int y1) {
+        std::vector<float> padded((std::size_t)(bloomWidth + 2 * radius));
+        for (int y = y0; y < y1; y++) {
+            const std::size_t row = (std::size_t)y * (std::size_t)bloomWidth;
+            for (int c = 0; c < 3; c++) {
+                const float* in = source[c].data() + row;
+                float* out = destination[c].data() + row;
+                std::fill(padded.begin(), padded.begin() + radius, in[0]);
+                std::copy(in, in + bloomWidth, padded.begin() + radius);
+                std::fill(padded.end() - radius, padded.end(), in[bloomWidth - 1]);
+
+                std::fill(out, out + bloomWidth, 0.0f);
+                for (std::size_t k = 0; k < blurWeights.size(); k++) {
+                    const float w = blurWeights[k];
+                    const float* tap = padded.data() + k;
+                    for (int x = 0; x < bloomWidth; x++) out[x] += w * tap[x];
+                }
+            }
+        }
+    });
+}
+
+void SoftwareRenderer::blurVertical(const Planes& source, Planes& destination) {
+    const int radius = (int)(blurWeights.size() / 2);
+    forEachRowBand(bloomHeight, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const std::size_t row = (std::size_t)y * (std::size_t)bloomWidth;
+            for (int c = 0; c < 3; c++) {
+                float* out = destination[c].data() + row;
+                std::fill(out, out + bloomWidth, 0.0f);
+                for (std::size_t k = 0; k < blurWeights.size(); k++) {
+                    const float w = blurWeights[k];
+                    const int sourceY = std::clamp(y + (int)k - radius, 0, bloomHeight - 1);
+                    const float* in = source[c].data() + (std::size_t)sourceY * (std::size_t)bloomWidth;
+                    for (int x = 0; x < bloomWidth; x++) out[x] += w * in[x];
+                }
+            }
+        }
+    });
+}
+
+void SoftwareRenderer::composite() {
+    forEachRowBand(frameHeight, [&](int y0, int y1) {
+        Planes bloomRow;
+        for (int c = 0; c < 3; c++) bloomRow[c].resize((std::size_t)frameWidth);
+
+        for (int y = y0; y < y1; y++) {
+            const std::size_t row = (std::size_t)y * (std::size_t)frameWidth;
+            const std::size_t sourceRow = (std::size_t)frameRowBloom[(std::size_t)y] * (std::size_t)bloomWidth;
+            for (int c = 0; c < 3; c++) {
+                const float* bloom = bloomA[c].data() + sourceRow;
+                float* expanded = bloomRow[c].data();
+                for (int x = 0; x < frameWidth; x++) expanded[x] = bloom[frameColumnBloom[(std::size_t)x]];
+            }
+
+            const float* r = trail[0].data() + row;
+            const float* g = trail[1].data() + row;
+            const float* b = trail[2].data() + row;
+            const float* br = bloomRow[0].data();
+            const float* bg = bloomRow[1].data();
+            const float* bb = bloomRow[2].data();
+            uint8_t* out = rgb.data() + row * 3;
+            for (int x = 0; x < frameWidth; x++) {
+                out[3 * x + 0] = (uint8_t)(std::min(r[x] + br[x], 1.0f) * 255.0f + 0.5f);
+                out[3 * x + 1] = (uint8_t)(std::min(g[x] + bg[x], 1.0f) * 255.0f + 0.5f);
+                out[3 * x + 2] = (uint8_t)(std::min(b[x] + bb[x], 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    });
+}
+
+template <int Dim>
+void SoftwareRenderer::render(const Particles<Dim>& particles, const WorldView& view) {
+    projectParticles(particles, view);
+    binSplats();
+
+    const int bandCount = (frameHeight + kBandRows - 1) / kBandRows;
+    pool.runTasks((std::size_t)bandCount, [&](std::size_t band) { drawTrailBand((int)band); });
+
+    downsampleTrail();
+    blurHorizontal(bloomA, bloomB);
+    blurVertical(bloomB, bloomA);
+    composite();
+}
+
+template void SoftwareRenderer::render<2>(const Particles<2>&, const WorldView&);
+template void SoftwareRenderer::render<3>(const Particles<3>&, const WorldView&);
@@ -0,0 +1,79 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "particles.h"
+#include "thread_pool.h"
+#include "visual_quality.h"
+
+// Visible world rectangle, centred like sf::View (y grows downwards on screen).
+struct WorldView {
+    float centerX = 0.0f;
+    float centerY = 0.0f;
+    float width = 1600.0f;
+    float height = 1000.0f;
+};
+
+// CPU reimplementation of Renderer's pipeline (glow splats, trail fade, downsampled
+// separable blur, additive composite) for machines without a GPU. Colour planes are
+// stored as separate float arrays and processed in horizontal bands of rows spread over
+// the pool; each band owns its rows, so results do not depend on the thread count.
+class SoftwareRenderer {
+public:
+    SoftwareRenderer(ThreadPool& pool, int width, int height);
+
+    void setQualityPreset(int presetIndex);
+    void clear();
+
+    template <int Dim>
+    void render(const Particles<Dim>& particles, const WorldView& view);
+
+    // Last rendered frame, tightly packed 8-bit RGB, top row first.
+    const std::vector<uint8_t>& frame() const;
+    int width() const;
+    int height() const;
+
+private:
+    using Planes = std::array<std::vector<float>, 3>;
+
+    template <int Dim>
+    void projectParticles(const Particles<Dim>& particles, const WorldView& view);
+    void binSplats();
+    void drawTrailBand(int band);
+    void downsampleTrail();
+    void blurHorizontal(const Planes& source, Planes& destination);
+    void blurVertical(const Planes& source, Planes& destination);
+    void composite();
+    void forEachRowBand(int rows, const std::function<void(int, int)>& task);
+
+    ThreadPool& pool;
+
+    int frameWidth;
+    int frameHeight;
+    int bloomWidth = 0;
+    int bloomHeight = 0;
+
+    VisualQuality visualQuality;
+    std::vector<float> blurWeights;
+
+    Planes trail;
+    Planes bloomA;
+    Planes bloomB;
+
+    // Per-particle splats in pixel space; radius 0 marks a culled particle.
+    std::vector<float> splatX;
+    std::vector<float> splatY;
+    std::vector<float> splatRadius;
+    Planes splatColor;
+
+    std::vector<uint32_t> bandOffsets;
+    std::vector<uint32_t> bandSplats;
+
+    std::vector<int> bloomColumnSource;
+    std::vector<int> bloomRowSource;
+    std::vector<int> frameColumnBloom;
+    std::vector<int> frameRowBloom;
+
+    std::vector<uint8_t> rgb;
+};
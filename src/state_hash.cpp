@@ -0,0 +1,160 @@
+#include "state_hash.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <vector>
+
+static constexpr std::size_t kHashBlock = 4096;
+static constexpr int kHashLanes = 8;
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Eight independent 32-bit murmur-style lanes over consecutive words; the inner loop
+// has no cross-lane dependency so the compiler turns it into vector multiplies. A byte
+// count that is not a multiple of four is zero-padded into one last word.
+static uint64_t hashBlock(const unsigned char* data, std::size_t bytes, uint64_t salt) {
+    uint32_t lanes[kHashLanes];
+    for (int k = 0; k < kHashLanes; k++) lanes[k] = (uint32_t)salt ^ (0x9E3779B9u * (uint32_t)(k + 1));
+
+    const std::size_t wordCount = bytes / sizeof(uint32_t);
+    std::size_t i = 0;
+    for (; i + kHashLanes <= wordCount; i += kHashLanes) {
+        uint32_t words[kHashLanes];
+        std::memcpy(words, data + i * sizeof(uint32_t), sizeof(words));
+        for (int k = 0; k < kHashLanes; k++) {
+            uint32_t h = lanes[k] ^ (words[k] * 0xCC9E2D51u);
+            h = (h << 15) | (h >> 17);
+            lanes[k] = h * 0x1B873593u + 0xE6546B64u;
+        }
+    }
+    int k = 0;
+    for (; i < wordCount; i++, k++) {
+        uint32_t word;
+        std::memcpy(&word, data + i * sizeof(uint32_t), sizeof(word));
+        lanes[k] ^= word * 0xCC9E2D51u;
+    }
+    if (const std::size_t tail = bytes % sizeof(uint32_t)) {
+        uint32_t word = 0;
+        std::memcpy(&word, data + wordCount * sizeof(uint32_t), tail);
+        lanes[k] ^= word * 0xCC9E2D51u;
+    }
+
+    uint64_t digest = mix64(salt ^ (uint64_t)bytes);
+    for (int k = 0; k < kHashLanes; k++) digest = mix64(digest ^ lanes[k]);
+    return digest;
+}
+
+template <int Dim>
+uint64_t hashParticleState(const Particles<Dim>& particles, ThreadPool& pool) {
+    const std::size_t n = particles.count();
+
+    // Each column as raw bytes and the size of one element. The IDs and flags are
+    // included so runs that differ only in spawn, despawn or compaction bookkeeping
+    // still hash differently.
+    struct Column {
+        const unsigned char* data;
+        std::size_t elementSize;
+    };
+    Column columns[2 * Dim + 3];
+    int columnCount = 0;
+    for (int d = 0; d < Dim; d++) columns[columnCount++] = { (const unsigned char*)particles.position[d].data(), sizeof(float) };
+    for (int d = 0; d < Dim; d++) columns[columnCount++] = { (const unsigned char*)particles.velocity[d].data(), sizeof(float) };
+    columns[columnCount++] = { (const unsigned char*)particles.mass.data(), sizeof(float) };
+    columns[columnCount++] = { (const unsigned char*)particles.id.data(), sizeof(uint64_t) };
+    columns[columnCount++] = { (const unsigned char*)particles.flags.data(), sizeof(uint8_t) };
+
+    const std::size_t blockCount = (n + kHashBlock - 1) / kHashBlock;
+    std::vector<uint64_t> digests(blockCount * (std::size_t)columnCount);
+
+    // Chunks handed out by the pool are multiples of kHashBlock starting at 0, so each
+    // chunk owns whole blocks.
+    pool.parallelFor(0, n, kHashBlock, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin / kHashBlock; b * kHashBlock < end; b++) {
+            std::size_t first = b * kHashBlock;
+            std::size_t length = std::min(kHashBlock, n - first);
+            for (int c = 0; c < columnCount; c++) {
+                uint64_t salt = ((uint64_t)c << 48) ^ (uint64_t)b;
+                const Column& column = columns[c];
+                digests[b * (std::size_t)columnCount + (std::size_t)c] =
+                    hashBlock(column.data + first * column.elementSize, length * column.elementSize, salt);
+            }
+        }
+    });
+
+    uint64_t hash = mix64(0x6A09E667F3BCC908ull ^ (uint64_t)n ^ ((uint64_t)Dim << 56));
+    for (uint64_t digest : digests) hash = mix64(hash ^ digest);
+    return hash;
+}
+
+StateHashMonitor::~StateHashMonitor() {
+    if (recordFile) std::fclose(recordFile);
+}
+
+bool StateHashMonitor::configure(int intervalSteps, const std::string& recordPath, const std::string& verifyPath) {
+    interval = intervalSteps;
+
+    if (!verifyPath.empty()) {
+        std::FILE* file = std::fopen(verifyPath.c_str(), "r");
+        if (!file) {
+            std::fprintf(stderr, "state hash: cannot open '%s' for verification\n", verifyPath.c_str());
+            return false;
+        }
+        unsigned long long step = 0;
+        unsigned long long hash = 0;
+        while (std::fscanf(file, "%llu %llx", &step, &hash) == 2) {
+            expectedHashes[(uint64_t)step] = (uint64_t)hash;
+        }
+        std::fclose(file);
+    }
+
+    if (!recordPath.empty()) {
+        recordFile = std::fopen(recordPath.c_str(), "w");
+        if (!recordFile) {
+            std::fprintf(stderr, "state hash: cannot open '%s' for writing\n", recordPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StateHashMonitor::enabled() const {
+    return interval > 0;
+}
+
+bool StateHashMonitor::due(uint64_t step) const {
+    return interval > 0 && step % (uint64_t)interval == 0;
+}
+
+bool StateHashMonitor::submit(uint64_t step, uint64_t hash) {
+    if (recordFile) {
+        std::fprintf(recordFile, "%" PRIu64 " %016" PRIx64 "\n", step, hash);
+        std::fflush(recordFile);
+    }
+
+    auto expected = expectedHashes.find(step);
+    if (expected != expectedHashes.end() && expected->second != hash && !hasDiverged) {
+        hasDiverged = true;
+        firstDivergentStep = step;
+        std::fprintf(stderr, "state hash: divergence at step %" PRIu64 " (expected %016" PRIx64 ", got %016" PRIx64 ")\n",
+                     step, expected->second, hash);
+    }
+    return !hasDiverged;
+}
+
+bool StateHashMonitor::diverged() const {
+    return hasDiverged;
+}
+
+uint64_t StateHashMonitor::divergedStep() const {
+    return firstDivergentStep;
+}
+
+template uint64_t hashParticleState<2>(const Particles<2>&, ThreadPool&);
+template uint64_t hashParticleState<3>(const Particles<3>&, ThreadPool&);
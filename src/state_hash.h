@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include "particles.h"
+#include "thread_pool.h"
+
+// 64-bit digest over the raw bits of every Particles column, IDs and flags included. Columns are hashed in
+// fixed-size blocks that are combined in index order, so the value depends only on
+// the particle state, never on the worker count.
+template <int Dim>
+uint64_t hashParticleState(const Particles<Dim>& particles, ThreadPool& pool);
+
+// Writes "<step> <hash>" lines every `interval` steps and/or compares them against a
+// previously recorded log, reporting the first step whose hash differs.
+class StateHashMonitor {
+public:
+    ~StateHashMonitor();
+
+    bool configure(int intervalSteps, const std::string& recordPath, const std::string& verifyPath);
+
+    bool enabled() const;
+    bool due(uint64_t step) const;
+
+    // Returns false once a verified step diverges from the recorded hash.
+    bool submit(uint64_t step, uint64_t hash);
+
+    bool diverged() const;
+    uint64_t divergedStep() const;
+
+private:
+    int interval = 0;
+    std::FILE* recordFile = nullptr;
+    std::map<uint64_t, uint64_t> expectedHashes;
+    bool hasDiverged = false;
+    uint64_t firstDivergentStep = 0;
+};
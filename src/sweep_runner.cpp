@@ -0,0 +1,193 @@
+#include "sweep_runner.h"
+#include "gravity_simulation.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct SweepRun {
+    std::size_t index = 0;
+    int particleCount = 0;
+    uint32_t seed = 0;
+    float theta = 0.0f;
+    float softeningLength = 0.0f;
+};
+
+struct SweepResult {
+    double wallSeconds = 0.0;
+    double finalEnergyDrift = 0.0;
+    double maxAbsEnergyDrift = 0.0;
+    uint64_t finalHash = 0;
+};
+
+struct SweepPlan {
+    unsigned int lanes = 1;
+    unsigned int workersPerRun = 1;
+};
+
+static std::vector<SweepRun> expandGrid(const AppConfig& config) {
+    const SimulationParams defaults;
+    const SweepConfig& sweep = config.sweep;
+
+    std::vector<int> particleCounts = sweep.particleCounts;
+    std::vector<float> thetas = sweep.thetas;
+    std::vector<float> softeningLengths = sweep.softeningLengths;
+    std::vector<uint32_t> seeds = sweep.seeds;
+    if (particleCounts.empty()) particleCounts.push_back(config.particleCount);
+    if (thetas.empty()) thetas.push_back(defaults.barnesHutTheta);
+    if (softeningLengths.empty()) softeningLengths.push_back(defaults.softeningLength);
+    if (seeds.empty()) seeds.push_back(config.deterministicSeed);
+
+    std::vector<SweepRun> runs;
+    for (int particleCount : particleCounts) {
+        for (float theta : thetas) {
+            for (float softeningLength : softeningLengths) {
+                for (uint32_t seed : seeds) {
+                    SweepRun run;
+                    run.index = runs.size();
+                    run.particleCount = particleCount;
+                    run.seed = seed;
+                    run.theta = theta;
+                    run.softeningLength = softeningLength;
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+    return runs;
+}
+
+// parallelFor runs inline below two grains, so a run only benefits from one extra worker
+// per two grains of particles. Runs get just enough workers for their size and the rest
+// of the machine is spent running more of them side by side.
+static SweepPlan planParallelism(unsigned int totalWorkers, std::size_t particleGrain,
+                                 const std::vector<SweepRun>& runs) {
+    int largestRun = 0;
+    for (const SweepRun& run : runs) largestRun = std::max(largestRun, run.particleCount);
+
+    const std::size_t particlesPerWorker = 2 * std::max<std::size_t>(1, particleGrain);
+    unsigned int usefulWorkers = (unsigned int)std::max<std::size_t>(1, (std::size_t)largestRun / particlesPerWorker);
+
+    SweepPlan plan;
+    plan.workersPerRun = std::min(std::max(1u, totalWorkers), usefulWorkers);
+    plan.lanes = std::max(1u, totalWorkers / plan.workersPerRun);
+    plan.lanes = (unsigned int)std::min<std::size_t>(plan.lanes, runs.size());
+    return plan;
+}
+
+template <int Dim>
+static SweepResult executeRun(const AppConfig& config, const SweepRun& run, ThreadPool& pool) {
+    const int steps = std::max(1, config.sweep.steps);
+
+    GravitySimulation<Dim> simulation(pool, run.particleCount, run.seed, config.galaxyPreset);
+    simulation.params().barnesHutTheta = run.theta;
+    simulation.params().softeningLength = run.softeningLength;
+    simulation.params().openingCriterion = config.openingCriterion;
+    simulation.params().forceSolver = config.forceSolver;
+    simulation.params().treeType = config.treeType;
+    simulation.params().integrator = config.integrator;
+    simulation.params().positionPrecision = config.positionPrecision;
+    simulation.params().timeStep = config.timeStep;
+    simulation.params().massAssignment = config.massAssignment;
+    simulation.params().meshSize = config.meshSize;
+    simulation.params().residentWorkers = config.residentWorkers;
+    simulation.params().particleGrain = config.particleGrain;
+    simulation.params().treeBucketSize = config.treeBucketSize;
+    simulation.params().interactionLists = config.interactionLists;
+    simulation.params().interactionListMargin = config.interactionListMargin;
+    simulation.params().diagnosticsInterval = std::max(1, steps / 10);
+
+    SweepResult result;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int step = 0; step < steps; step++) {
+        simulation.advance();
+
+        ConservationDiagnostics diagnostics;
+        if (simulation.takeDiagnostics(diagnostics)) {
+            result.finalEnergyDrift = diagnostics.relativeEnergyDrift;
+            result.maxAbsEnergyDrift = std::max(result.maxAbsEnergyDrift, std::fabs(diagnostics.relativeEnergyDrift));
+        }
+    }
+
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.finalHash = simulation.computeStateHash();
+    return result;
+}
+
+template <int Dim>
+static int runSweepGrid(const AppConfig& config) {
+    const std::vector<SweepRun> runs = expandGrid(config);
+    const SweepPlan plan = planParallelism(config.sweep.workerThreads, config.particleGrain, runs);
+
+    std::FILE* results = std::fopen(config.sweep.resultsPath.c_str(), "w");
+    if (!results) {
+        std::fprintf(stderr, "sweep: cannot open '%s' for writing\n", config.sweep.resultsPath.c_str());
+        return 2;
+    }
+
+    std::printf("sweep: %zu runs, %u concurrent x %u worker(s) each\n", runs.size(), plan.lanes, plan.workersPerRun);
+
+    // One pool schedules whole runs; each lane keeps its own small pool for the
+    // intra-run passes and reuses it for every run it executes.
+    ThreadPool scheduler(plan.lanes);
+    std::vector<std::unique_ptr<ThreadPool>> lanePools;
+    std::vector<ThreadPool*> idleLanePools;
+    for (unsigned int k = 0; k < plan.lanes; k++) {
+        lanePools.push_back(std::make_unique<ThreadPool>(plan.workersPerRun));
+        idleLanePools.push_back(lanePools.back().get());
+    }
+
+    std::mutex laneMutex;
+    std::vector<SweepResult> runResults(runs.size());
+    std::size_t finishedRuns = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    scheduler.runTasks(runs.size(), [&](std::size_t r) {
+        ThreadPool* lanePool = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(laneMutex);
+            lanePool = idleLanePools.back();
+            idleLanePools.pop_back();
+        }
+
+        runResults[r] = executeRun<Dim>(config, runs[r], *lanePool);
+
+        std::lock_guard<std::mutex> lock(laneMutex);
+        idleLanePools.push_back(lanePool);
+        finishedRuns++;
+        std::printf("sweep: %zu/%zu done (run %zu, %.2fs)\n", finishedRuns, runs.size(), r, runResults[r].wallSeconds);
+        std::fflush(stdout);
+    });
+
+    double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::fprintf(results, "run,dimensions,particles,seed,theta,softening,steps,workers,wall_s,steps_per_s,"
+                          "final_energy_drift,max_abs_energy_drift,final_hash\n");
+    double particleSteps = 0.0;
+    for (const SweepRun& run : runs) {
+        const SweepResult& result = runResults[run.index];
+        double stepsPerSecond = (result.wallSeconds > 0.0) ? config.sweep.steps / result.wallSeconds : 0.0;
+        particleSteps += (double)run.particleCount * config.sweep.steps;
+        std::fprintf(results, "%zu,%d,%d,%u,%.4f,%.4f,%d,%u,%.4f,%.2f,%.6e,%.6e,%016" PRIx64 "\n",
+                     run.index, Dim, run.particleCount, run.seed, run.theta, run.softeningLength,
+                     config.sweep.steps, plan.workersPerRun, result.wallSeconds, stepsPerSecond,
+                     result.finalEnergyDrift, result.maxAbsEnergyDrift, result.finalHash);
+    }
+    std::fclose(results);
+
+    std::printf("sweep: finished in %.2fs, %.3e particle-steps/s, results in %s\n",
+                totalSeconds, (totalSeconds > 0.0) ? particleSteps / totalSeconds : 0.0,
+                config.sweep.resultsPath.c_str());
+    return 0;
+}
+
+int runSweep(const AppConfig& config) {
+    if (config.dimensions == 3) return runSweepGrid<3>(config);
+    return runSweepGrid<2>(config);
+}
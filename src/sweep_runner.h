@@ -0,0 +1,7 @@
+#pragma once
+#include "app_config.h"
+
+// Runs every combination in config.sweep as an independent simulation, packing runs
+// onto the machine's cores, and writes one CSV row of summary metrics per run to
+// config.sweep.resultsPath. Returns the process exit code.
+int runSweep(const AppConfig& config);
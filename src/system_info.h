@@ -1,12 +1,14 @@
-#pragma once
-#include <string>
-
-struct SystemInfo {
-    unsigned int detectedHardwareThreads = 1;
-    std::string cpuBrandString;
-    std::string gpuVendorString;
-    std::string gpuRendererString;
-};
-
-SystemInfo detectSystemInfo();
-unsigned int chooseWorkerThreadCount(const SystemInfo& info);
+#pragma once
+#include <string>
+
+struct SystemInfo {
+    unsigned int detectedHardwareThreads = 1;
+    std::string cpuBrandString;
+    std::string gpuVendorString;
+    std::string gpuRendererString;
+};
+
+SystemInfo detectSystemInfo();
+// Fills the GPU strings; needs a current OpenGL context.
+void detectGpuInfo(SystemInfo& info);
+unsigned int chooseWorkerThreadCount(const SystemInfo& info);
@@ -1,93 +1,243 @@
-#include "thread_pool.h"
-#include <algorithm>
-
-ThreadPool::ThreadPool(unsigned int workerCount)
-    : workerTotal(std::max(1u, workerCount)) {
-    workers.reserve(workerTotal);
-    for (unsigned int i = 0; i < workerTotal; i++) {
-        workers.emplace_back([this]() { workerLoop(); });
-    }
-}
-
-ThreadPool::~ThreadPool() {
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        stopRequested = true;
-        jobId++;
-    }
-    startCondition.notify_all();
-    for (auto& t : workers) t.join();
-}
-
-unsigned int ThreadPool::workerCount() const {
-    return workerTotal;
-}
-
-void ThreadPool::parallelFor(std::size_t begin,
-                             std::size_t end,
-                             std::size_t minGrain,
-                             const std::function<void(std::size_t, std::size_t)>& task) {
-    if (end <= begin) return;
-    std::size_t total = end - begin;
-    if (workerTotal == 1 || total <= minGrain * 2) {
-        task(begin, end);
-        return;
-    }
-
-    std::uint64_t thisJob = 0;
-
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        currentTask = task;
-        nextIndex.store(begin, std::memory_order_relaxed);
-        endIndex = end;
-        grainSize = std::max<std::size_t>(minGrain, 256);
-        remainingWorkers.store(workerTotal, std::memory_order_relaxed);
-
-        jobId++;
-        thisJob = jobId;
-    }
-
-    startCondition.notify_all();
-
-    std::unique_lock<std::mutex> lock(mutex);
-    doneCondition.wait(lock, [&]() { return finishedJobId == thisJob; });
-}
-
-void ThreadPool::workerLoop() {
-    std::uint64_t lastSeenJob = 0;
-
-    while (true) {
-        std::function<void(std::size_t, std::size_t)> task;
-        std::size_t localEnd = 0;
-        std::size_t localGrain = 0;
-        std::uint64_t myJob = 0;
-
-        {
-            std::unique_lock<std::mutex> lock(mutex);
-            startCondition.wait(lock, [&]() { return stopRequested || jobId != lastSeenJob; });
-
-            if (stopRequested) return;
-
-            lastSeenJob = jobId;
-            myJob = jobId;
-
-            task = currentTask;
-            localEnd = endIndex;
-            localGrain = grainSize;
-        }
-
-        while (true) {
-            std::size_t start = nextIndex.fetch_add(localGrain, std::memory_order_relaxed);
-            if (start >= localEnd) break;
-            std::size_t stop = std::min(start + localGrain, localEnd);
-            task(start, stop);
-        }
-
-        if (remainingWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-            std::lock_guard<std::mutex> lock(mutex);
-            finishedJobId = myJob;
-            doneCondition.notify_one();
-        }
-    }
-}
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static inline void cpuRelax() {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Backoff for spin waits: exponentially more pause instructions per poll, then yielding
+// the core once the wait is clearly not short, so oversubscribed machines still progress.
+class SpinBackoff {
+public:
+    void pause() {
+        if (step < kPauseSteps) {
+            for (unsigned int i = 0; i < (1u << step); i++) cpuRelax();
+            step++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static constexpr unsigned int kPauseSteps = 7;
+    unsigned int step = 0;
+};
+
+// Adds the lifetime of the scope to a busy-time counter; one update per task range.
+class BusyTimer {
+public:
+    explicit BusyTimer(std::atomic<std::uint64_t>& counter)
+        : counter(counter), start(std::chrono::steady_clock::now()) {}
+    ~BusyTimer() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        counter.fetch_add((std::uint64_t)elapsed.count(), std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t>& counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+ThreadPool::ThreadPool(unsigned int workerCount)
+    : workerTotal(std::max(1u, workerCount)) {
+    // A single-worker pool runs every job inline on the caller, so it needs no thread.
+    if (workerTotal == 1) return;
+
+    workers.reserve(workerTotal);
+    for (unsigned int i = 0; i < workerTotal; i++) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stopRequested.store(true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobId.fetch_add(1);
+    }
+    startCondition.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+unsigned int ThreadPool::workerCount() const {
+    return workerTotal;
+}
+
+double ThreadPool::busySeconds() const {
+    return 1e-9 * (double)busyNanoseconds.load(std::memory_order_relaxed);
+}
+
+ThreadPool::ResidentScope::ResidentScope(ThreadPool& pool, bool enabled)
+    : residentPool(enabled && pool.workerTotal > 1 ? &pool : nullptr) {
+    if (!residentPool) return;
+    residentPool->residentScopes.fetch_add(1);
+    // Parked workers are woken once so they start polling.
+    if (residentPool->parkedWorkers.load() > 0) {
+        std::lock_guard<std::mutex> lock(residentPool->mutex);
+        residentPool->startCondition.notify_all();
+    }
+}
+
+ThreadPool::ResidentScope::~ResidentScope() {
+    if (residentPool) residentPool->residentScopes.fetch_sub(1);
+}
+
+void ThreadPool::parallelFor(std::size_t begin,
+                             std::size_t end,
+                             std::size_t minGrain,
+                             const std::function<void(std::size_t, std::size_t)>& task) {
+    if (end <= begin) return;
+    std::size_t total = end - begin;
+    if (workerTotal == 1 || total <= minGrain * 2) {
+        BusyTimer busy(busyNanoseconds);
+        task(begin, end);
+        return;
+    }
+
+    jobPhases.resize(1);
+    jobPhases[0] = { begin, end, std::max<std::size_t>(minGrain, 256), &task };
+    dispatch(1);
+}
+
+void ThreadPool::runTasks(std::size_t count, const std::function<void(std::size_t)>& task) {
+    if (count == 0) return;
+    if (workerTotal == 1 || count == 1) {
+        BusyTimer busy(busyNanoseconds);
+        for (std::size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    const std::function<void(std::size_t, std::size_t)> rangeTask = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) task(i);
+    };
+    jobPhases.resize(1);
+    jobPhases[0] = { 0, count, 1, &rangeTask };
+    dispatch(1);
+}
+
+void ThreadPool::runPhases(const std::vector<ParallelPhase>& phases) {
+    if (phases.empty()) return;
+    if (workerTotal == 1) {
+        BusyTimer busy(busyNanoseconds);
+        for (const ParallelPhase& phase : phases) {
+            if (phase.end > phase.begin) phase.task(phase.begin, phase.end);
+        }
+        return;
+    }
+
+    jobPhases.resize(phases.size());
+    for (std::size_t p = 0; p < phases.size(); p++) {
+        jobPhases[p] = { phases[p].begin, std::max(phases[p].begin, phases[p].end),
+                         std::max<std::size_t>(phases[p].minGrain, 1), &phases[p].task };
+    }
+    dispatch(phases.size());
+}
+
+void ThreadPool::dispatch(std::size_t phaseCount) {
+    if (phaseNextCapacity < phaseCount) {
+        phaseNext = std::make_unique<std::atomic<std::size_t>[]>(phaseCount);
+        phaseNextCapacity = phaseCount;
+    }
+    for (std::size_t p = 0; p < phaseCount; p++) phaseNext[p].store(jobPhases[p].begin, std::memory_order_relaxed);
+    jobPhaseCount = phaseCount;
+    remainingWorkers.store(workerTotal, std::memory_order_relaxed);
+
+    // Publishing the id releases the job description above. Parked workers re-check it
+    // under the mutex, so they only need a notification when some are actually parked.
+    const std::uint64_t thisJob = jobId.load(std::memory_order_relaxed) + 1;
+    jobId.store(thisJob);
+    if (parkedWorkers.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        startCondition.notify_all();
+    }
+
+    if (residentScopes.load(std::memory_order_relaxed) > 0) {
+        SpinBackoff backoff;
+        while (finishedJobId.load(std::memory_order_acquire) != thisJob) backoff.pause();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    callerParked.store(true);
+    doneCondition.wait(lock, [&]() { return finishedJobId.load() == thisJob; });
+    callerParked.store(false);
+}
+
+bool ThreadPool::waitForJob(std::uint64_t lastSeenJob) {
+    SpinBackoff backoff;
+    while (residentScopes.load(std::memory_order_relaxed) > 0) {
+        if (jobId.load(std::memory_order_acquire) != lastSeenJob) return true;
+        backoff.pause();
+    }
+    return jobId.load(std::memory_order_acquire) != lastSeenJob;
+}
+
+void ThreadPool::runPhase(std::size_t phaseIndex) {
+    BusyTimer busy(busyNanoseconds);
+    const PhaseRef& phase = jobPhases[phaseIndex];
+    std::atomic<std::size_t>& next = phaseNext[phaseIndex];
+    while (true) {
+        std::size_t start = next.fetch_add(phase.grain, std::memory_order_relaxed);
+        if (start >= phase.end) break;
+        std::size_t stop = std::min(start + phase.grain, phase.end);
+        (*phase.task)(start, stop);
+    }
+}
+
+void ThreadPool::arriveAtBarrier(bool& localSense) {
+    localSense = !localSense;
+    if (barrierArrived.fetch_add(1, std::memory_order_acq_rel) == workerTotal - 1) {
+        barrierArrived.store(0, std::memory_order_relaxed);
+        barrierSense.store(localSense, std::memory_order_release);
+        return;
+    }
+    SpinBackoff backoff;
+    while (barrierSense.load(std::memory_order_acquire) != localSense) backoff.pause();
+}
+
+void ThreadPool::workerLoop() {
+    std::uint64_t lastSeenJob = 0;
+    bool barrierLocalSense = false;
+
+    while (true) {
+        if (!waitForJob(lastSeenJob)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            parkedWorkers.fetch_add(1);
+            startCondition.wait(lock, [&]() {
+                return jobId.load() != lastSeenJob || residentScopes.load() > 0;
+            });
+            parkedWorkers.fetch_sub(1);
+            // Woken by a resident scope rather than a job: go back to polling.
+            if (jobId.load() == lastSeenJob) continue;
+        }
+
+        if (stopRequested.load()) return;
+
+        lastSeenJob = jobId.load(std::memory_order_acquire);
+        for (std::size_t p = 0; p < jobPhaseCount; p++) {
+            if (p > 0) arriveAtBarrier(barrierLocalSense);
+            runPhase(p);
+        }
+
+        if (remainingWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            finishedJobId.store(lastSeenJob);
+            if (callerParked.load()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                doneCondition.notify_one();
+            }
+        }
+    }
+}
@@ -1,45 +1,100 @@
-#pragma once
-#include <vector>
-#include <thread>
-#include <functional>
-#include <atomic>
-#include <condition_variable>
-#include <mutex>
-#include <cstddef>
-#include <cstdint>
-
-class ThreadPool {
-public:
-    explicit ThreadPool(unsigned int workerCount);
-    ~ThreadPool();
-
-    unsigned int workerCount() const;
-
-    void parallelFor(std::size_t begin,
-                     std::size_t end,
-                     std::size_t minGrain,
-                     const std::function<void(std::size_t, std::size_t)>& task);
-
-private:
-    void workerLoop();
-
-    unsigned int workerTotal = 1;
-    std::vector<std::thread> workers;
-
-    std::mutex mutex;
-    std::condition_variable startCondition;
-    std::condition_variable doneCondition;
-
-    std::function<void(std::size_t, std::size_t)> currentTask;
-
-    std::atomic<std::size_t> nextIndex{0};
-    std::size_t endIndex = 0;
-    std::size_t grainSize = 1024;
-
-    std::atomic<unsigned int> remainingWorkers{0};
-
-    bool stopRequested = false;
-
-    std::uint64_t jobId = 0;
-    std::uint64_t finishedJobId = 0;
-};
+#pragma once
+#include <vector>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// One data-parallel pass of a fused dispatch (see ThreadPool::runPhases).
+struct ParallelPhase {
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t minGrain = 1;
+    std::function<void(std::size_t, std::size_t)> task;
+};
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int workerCount);
+    ~ThreadPool();
+
+    unsigned int workerCount() const;
+    // Time spent inside tasks since construction, summed over the workers (and the caller
+    // for jobs small enough to run inline). Barrier and polling waits are not included.
+    double busySeconds() const;
+
+    void parallelFor(std::size_t begin,
+                     std::size_t end,
+                     std::size_t minGrain,
+                     const std::function<void(std::size_t, std::size_t)>& task);
+
+    // Runs task(0) .. task(count - 1), handing out one index at a time. Meant for a few
+    // coarse, independent jobs (whole simulations, framebuffer bands) rather than particle ranges.
+    void runTasks(std::size_t count, const std::function<void(std::size_t)>& task);
+
+    // Runs the phases in order on a single wake-up of the workers. A phase starts once
+    // every chunk of the previous one has finished; the workers meet at a spin barrier
+    // in between instead of returning to the caller.
+    void runPhases(const std::vector<ParallelPhase>& phases);
+
+    // While at least one scope is alive, idle workers keep polling for the next dispatch
+    // (spinning, then yielding) instead of parking on the condition variable, and the
+    // caller spins for completion. This removes the wake-up latency between the many
+    // short passes of a step at the cost of keeping the cores busy; workers park again
+    // when the last scope ends.
+    class ResidentScope {
+    public:
+        explicit ResidentScope(ThreadPool& pool, bool enabled = true);
+        ~ResidentScope();
+        ResidentScope(const ResidentScope&) = delete;
+        ResidentScope& operator=(const ResidentScope&) = delete;
+
+    private:
+        ThreadPool* residentPool;
+    };
+
+private:
+    struct PhaseRef {
+        std::size_t begin;
+        std::size_t end;
+        std::size_t grain;
+        const std::function<void(std::size_t, std::size_t)>* task;
+    };
+
+    void dispatch(std::size_t phaseCount);
+    void workerLoop();
+    bool waitForJob(std::uint64_t lastSeenJob);
+    void runPhase(std::size_t phaseIndex);
+    void arriveAtBarrier(bool& localSense);
+
+    unsigned int workerTotal = 1;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+
+    // Job description, written by the caller before jobId is published.
+    std::vector<PhaseRef> jobPhases;
+    std::size_t jobPhaseCount = 0;
+    std::unique_ptr<std::atomic<std::size_t>[]> phaseNext;
+    std::size_t phaseNextCapacity = 0;
+
+    std::atomic<std::uint64_t> jobId{0};
+    std::atomic<std::uint64_t> finishedJobId{0};
+    std::atomic<unsigned int> remainingWorkers{0};
+
+    // Sense-reversing barrier between the phases of one job.
+    std::atomic<unsigned int> barrierArrived{0};
+    std::atomic<bool> barrierSense{false};
+
+    std::atomic<int> residentScopes{0};
+    std::atomic<unsigned int> parkedWorkers{0};
+    std::atomic<bool> callerParked{false};
+    std::atomic<bool> stopRequested{false};
+    std::atomic<std::uint64_t> busyNanoseconds{0};
+};
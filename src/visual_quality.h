@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+// Look of the bloom-and-trails pipeline, shared by the GPU renderer and the CPU
+// software renderer so both produce the same image for the same preset.
+struct VisualQuality {
+    float trailFadeAlpha = 18.0f;
+    float glowIntensity = 1.15f;
+    float bloomRadius = 8.0f;
+    float bloomSigma = 5.0f;
+    float bloomDownscale = 0.5f;
+};
+
+inline VisualQuality visualQualityPreset(int presetIndex) {
+    VisualQuality quality;
+    if (presetIndex <= 1) {
+        quality.trailFadeAlpha = 30.0f;
+        quality.glowIntensity = 0.95f;
+        quality.bloomRadius = 6.0f;
+        quality.bloomSigma = 4.0f;
+        quality.bloomDownscale = 0.5f;
+    } else if (presetIndex == 2) {
+        quality.trailFadeAlpha = 18.0f;
+        quality.glowIntensity = 1.15f;
+        quality.bloomRadius = 8.0f;
+        quality.bloomSigma = 5.0f;
+        quality.bloomDownscale = 0.5f;
+    } else {
+        quality.trailFadeAlpha = 12.0f;
+        quality.glowIntensity = 1.35f;
+        quality.bloomRadius = 10.0f;
+        quality.bloomSigma = 6.0f;
+        quality.bloomDownscale = 0.4f;
+    }
+    return quality;
+}
+
+struct ParticleColor {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+// Cyan -> magenta -> white ramp over particle speed.
+inline ParticleColor speedToParticleColor(float speed) {
+    float t = std::clamp(speed / 1200.0f, 0.0f, 1.0f);
+
+    auto lerp = [](float a, float b, float u) { return a + (b - a) * u; };
+
+    const ParticleColor c1 = { 0, 255, 255 };
+    const ParticleColor c2 = { 255, 0, 255 };
+    const ParticleColor c3 = { 255, 255, 255 };
+
+    ParticleColor out;
+    if (t < 0.7f) {
+        float u = t / 0.7f;
+        out.r = (uint8_t)lerp((float)c1.r, (float)c2.r, u);
+        out.g = (uint8_t)lerp((float)c1.g, (float)c2.g, u);
+        out.b = (uint8_t)lerp((float)c1.b, (float)c2.b, u);
+    } else {
+        float u = (t - 0.7f) / 0.3f;
+        out.r = (uint8_t)lerp((float)c2.r, (float)c3.r, u);
+        out.g = (uint8_t)lerp((float)c2.g, (float)c3.g, u);
+        out.b = (uint8_t)lerp((float)c2.b, (float)c3.b, u);
+    }
+    return out;
+}
@@ -0,0 +1,166 @@
+// Force-solver benchmark: times one force evaluation per solver on fixed initial
+// conditions and measures the acceleration error against direct summation in double
+// precision over a sample of particles. Tree solvers also report the build time, the
+// node count (empty nodes in brackets) and the depth of their tree. Every row ends with
+// the huge pages backing the process while that solver's simulation is alive.
+//
+//   gravity_bench [threads] [sampleCount] [off|transparent|explicit]
+#include "aligned_allocator.h"
+#include "gravity_simulation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+struct Fixture {
+    GalaxyPreset preset;
+    int particleCount;
+};
+
+struct SolverSetup {
+    const char* name;
+    ForceSolver solver;
+    MassAssignment assignment;
+    float theta;
+    TreeType tree;
+};
+
+static const Fixture kFixtures[] = {
+    { GalaxyPreset::Disc, 50000 },
+    { GalaxyPreset::Disc, 150000 },
+    { GalaxyPreset::Merger, 50000 },
+    { GalaxyPreset::Merger, 150000 },
+};
+
+static const SolverSetup kSolvers[] = {
+    { "bh", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 2.0f, TreeType::Octree },
+    { "bh", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 0.7f, TreeType::Octree },
+    { "bh", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 0.4f, TreeType::Octree },
+    { "bh-kd", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 2.0f, TreeType::KdTree },
+    { "bh-kd", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 0.7f, TreeType::KdTree },
+    { "bh-kd", ForceSolver::BarnesHut, MassAssignment::CloudInCell, 0.4f, TreeType::KdTree },
+    { "pm-cic", ForceSolver::ParticleMesh, MassAssignment::CloudInCell, 0.0f, TreeType::Octree },
+    { "pm-tsc", ForceSolver::ParticleMesh, MassAssignment::TriangularShapedCloud, 0.0f, TreeType::Octree },
+    { "treepm-cic", ForceSolver::TreePM, MassAssignment::CloudInCell, 0.7f, TreeType::Octree },
+    { "treepm-cic", ForceSolver::TreePM, MassAssignment::CloudInCell, 0.4f, TreeType::Octree },
+    { "treepm-tsc", ForceSolver::TreePM, MassAssignment::TriangularShapedCloud, 0.4f, TreeType::Octree },
+    { "treepm-kd", ForceSolver::TreePM, MassAssignment::CloudInCell, 0.4f, TreeType::KdTree },
+};
+
+static constexpr int kTimedEvaluations = 5;
+
+template <int Dim>
+static std::vector<std::array<double, Dim>> directAccelerations(const Particles<Dim>& particles,
+                                                                const SimulationParams& params,
+                                                                const std::vector<std::size_t>& sample) {
+    const double G = params.gravitationalConstant;
+    const double eps2 = (double)params.softeningLength * params.softeningLength;
+    std::vector<std::array<double, Dim>> result(sample.size());
+    for (std::size_t s = 0; s < sample.size(); s++) {
+        const std::size_t i = sample[s];
+        std::array<double, Dim> a{};
+        for (std::size_t j = 0; j < particles.count(); j++) {
+            if (j == i) continue;
+            std::array<double, Dim> delta;
+            double r2 = eps2;
+            for (int d = 0; d < Dim; d++) {
+                delta[d] = (double)particles.position[d][j] - particles.position[d][i];
+                r2 += delta[d] * delta[d];
+            }
+            double invR = 1.0 / std::sqrt(r2);
+            double scale = G * particles.mass[j] * invR * invR * invR;
+            for (int d = 0; d < Dim; d++) a[d] += delta[d] * scale;
+        }
+        result[s] = a;
+    }
+    return result;
+}
+
+template <int Dim>
+static void runFixture(const Fixture& fixture, ThreadPool& pool, int sampleCount) {
+    GravitySimulation<Dim> reference(pool, fixture.particleCount, 13371337u, fixture.preset);
+    const Particles<Dim>& particles = reference.particles();
+
+    std::vector<std::size_t> sample;
+    const std::size_t count = particles.count();
+    for (int s = 0; s < sampleCount; s++) sample.push_back((std::size_t)s * count / (std::size_t)sampleCount);
+    const auto exact = directAccelerations<Dim>(particles, reference.params(), sample);
+
+    std::printf("%dD %s N=%d\n", Dim, galaxyPresetName(fixture.preset), fixture.particleCount);
+    for (const SolverSetup& setup : kSolvers) {
+        GravitySimulation<Dim> simulation(pool, fixture.particleCount, 13371337u, fixture.preset);
+        simulation.params().forceSolver = setup.solver;
+        simulation.params().massAssignment = setup.assignment;
+        simulation.params().treeType = setup.tree;
+        if (setup.theta > 0.0f) simulation.params().barnesHutTheta = setup.theta;
+
+        // A zero step evaluates forces without moving anything. The first one also builds
+        // the mesh kernel and is left out of the timing.
+        simulation.stepFixed(0.0);
+        double treeMs = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int e = 0; e < kTimedEvaluations; e++) {
+            simulation.stepFixed(0.0);
+            treeMs += simulation.lastStepStatistics().treeSeconds * 1000.0 / kTimedEvaluations;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() /
+                    kTimedEvaluations;
+
+        const auto& a = simulation.accelerations();
+        std::vector<double> errors;
+        for (std::size_t s = 0; s < sample.size(); s++) {
+            double diff2 = 0.0, norm2 = 0.0;
+            for (int d = 0; d < Dim; d++) {
+                double diff = (double)a[d][sample[s]] - exact[s][d];
+                diff2 += diff * diff;
+                norm2 += exact[s][d] * exact[s][d];
+            }
+            if (norm2 > 0.0) errors.push_back(std::sqrt(diff2 / norm2));
+        }
+        std::sort(errors.begin(), errors.end());
+        double median = errors.empty() ? 0.0 : errors[errors.size() / 2];
+        double p95 = errors.empty() ? 0.0 : errors[errors.size() * 95 / 100];
+
+        char label[32];
+        if (setup.theta > 0.0f) {
+            std::snprintf(label, sizeof(label), "%s theta=%.1f", setup.name, setup.theta);
+        } else {
+            std::snprintf(label, sizeof(label), "%s", setup.name);
+        }
+        std::printf("  %-22s %9.2f ms  median err %.2e  p95 err %.2e", label, ms, median, p95);
+        if (simulation.treeIsCurrent()) {
+            std::size_t empty = 0;
+            for (const auto& node : simulation.tree().nodes()) empty += node.particleCount == 0 ? 1 : 0;
+            std::printf("  tree %7.2f ms  %zu nodes (%zu)  depth %d", treeMs, simulation.tree().nodes().size(), empty,
+                        simulation.tree().depth());
+        }
+        if (kCollectTreeStatistics && simulation.treeIsCurrent()) {
+            // Per particle, from the last timed evaluation.
+            const StepStatistics& step = simulation.lastStepStatistics();
+            const double n = (double)simulation.particles().count();
+            std::printf("  visited %.1f  accepted %.1f  pairs %.1f", (double)step.nodesVisited / n,
+                        (double)step.cellsAccepted / n, (double)step.particleInteractions / n);
+        }
+        const MemoryStatistics memory = memoryStatistics();
+        std::printf("  huge pages %zu\n", memory.explicitHugePages + memory.transparentHugePages);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    int sampleCount = 1000;
+    if (argc > 1) threads = (unsigned int)std::max(1, std::atoi(argv[1]));
+    if (argc > 2) sampleCount = std::max(1, std::atoi(argv[2]));
+    const char* pages = argc > 3 ? argv[3] : "transparent";
+    if (std::strcmp(pages, "off") == 0) setHugePageMode(HugePageMode::Off);
+    if (std::strcmp(pages, "explicit") == 0) setHugePageMode(HugePageMode::Explicit);
+
+    ThreadPool pool(threads);
+    std::printf("threads=%u sample=%d pages=%s\n", threads, sampleCount, pages);
+    for (const Fixture& fixture : kFixtures) runFixture<2>(fixture, pool, sampleCount);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Integrator benchmark: runs the same initial conditions for a fixed span of simulated
+// time with each integrator and step size, and reports force evaluations per simulated
+// second against the worst relative energy error seen along the way. Then it compares
+// the position precisions by running leapfrog forward and back over the same span.
+//
+//   integrator_bench [threads] [particles] [simulatedSeconds]
+#include "gravity_simulation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+struct IntegratorSetup {
+    const char* name;
+    Integrator integrator;
+    bool adaptive;
+    // Fixed step, or accelerationFactor of the adaptive controller (velocityFactor is
+    // kept at eight times that, the ratio of the defaults).
+    float value;
+};
+
+static const IntegratorSetup kSetups[] = {
+    { "euler", Integrator::SymplecticEuler, false, 1.0f / 60.0f },
+    { "euler", Integrator::SymplecticEuler, false, 1.0f / 240.0f },
+    { "euler", Integrator::SymplecticEuler, false, 1.0f / 960.0f },
+    { "leapfrog", Integrator::Leapfrog, false, 1.0f / 60.0f },
+    { "leapfrog", Integrator::Leapfrog, false, 1.0f / 240.0f },
+    { "leapfrog", Integrator::Leapfrog, false, 1.0f / 960.0f },
+    { "forest-ruth", Integrator::ForestRuth, false, 1.0f / 60.0f },
+    { "forest-ruth", Integrator::ForestRuth, false, 1.0f / 120.0f },
+    { "forest-ruth", Integrator::ForestRuth, false, 1.0f / 240.0f },
+    { "leapfrog adaptive", Integrator::Leapfrog, true, 1.0f },
+    { "leapfrog adaptive", Integrator::Leapfrog, true, 0.5f },
+    { "leapfrog adaptive", Integrator::Leapfrog, true, 0.25f },
+    { "forest-ruth adaptive", Integrator::ForestRuth, true, 1.0f },
+    { "forest-ruth adaptive", Integrator::ForestRuth, true, 0.5f },
+    { "forest-ruth adaptive", Integrator::ForestRuth, true, 0.25f },
+};
+
+template <int Dim>
+static void runSetup(const IntegratorSetup& setup, ThreadPool& pool, int particleCount, double duration) {
+    GravitySimulation<Dim> simulation(pool, particleCount, 13371337u, GalaxyPreset::Disc);
+    SimulationParams& params = simulation.params();
+    params.integrator = setup.integrator;
+    // Accurate forces and no velocity clamp, so the energy error is the integrator's.
+    params.barnesHutTheta = 0.3f;
+    params.velocityClamp = 1.0e9f;
+    params.diagnosticsInterval = 1;
+    params.timeStep.adaptive = setup.adaptive;
+    if (setup.adaptive) {
+        params.timeStep.accelerationFactor = setup.value;
+        params.timeStep.velocityFactor = 8.0f * setup.value;
+    } else {
+        params.fixedTimeStep = setup.value;
+    }
+
+    const uint64_t evaluationsBefore = simulation.forceEvaluationCount();
+    double worstDrift = 0.0;
+    while (simulation.simulationTime() < duration) {
+        simulation.advance();
+        ConservationDiagnostics diagnostics;
+        if (simulation.takeDiagnostics(diagnostics)) worstDrift = std::max(worstDrift, std::fabs(diagnostics.relativeEnergyDrift));
+    }
+    const uint64_t evaluations = simulation.forceEvaluationCount() - evaluationsBefore;
+
+    char label[48];
+    if (setup.adaptive) {
+        std::snprintf(label, sizeof(label), "%s eta=%.2f", setup.name, setup.value);
+    } else {
+        std::snprintf(label, sizeof(label), "%s dt=1/%.0f", setup.name, 1.0f / setup.value);
+    }
+    std::printf("  %-30s %6llu steps %7.1f evals/s  max |dE/E| %.2e\n", label,
+                (unsigned long long)simulation.stepCount(), (double)evaluations / simulation.simulationTime(),
+                worstDrift);
+}
+
+// Leapfrog is time-reversible: stepping back by the same steps returns to the initial
+// positions up to round-off, which the chaotic dynamics then amplify. The distance left
+// over, against the RMS radius of the disc, compares the precisions' round-off.
+template <int Dim>
+static void runPrecision(PositionPrecision precision, const char* name, ThreadPool& pool, int particleCount,
+                         double duration) {
+    GravitySimulation<Dim> simulation(pool, particleCount, 13371337u, GalaxyPreset::Disc);
+    SimulationParams& params = simulation.params();
+    params.integrator = Integrator::Leapfrog;
+    params.positionPrecision = precision;
+    params.barnesHutTheta = 0.3f;
+    params.velocityClamp = 1.0e9f;
+    const double dt = 1.0 / 240.0;
+    const int steps = (int)std::ceil(duration / dt);
+
+    const Particles<Dim> initial = simulation.particles();
+    const auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) simulation.stepFixed(dt);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+    for (int s = 0; s < steps; s++) simulation.stepFixed(-dt);
+
+    const Particles<Dim>& returned = simulation.particles();
+    const std::size_t n = initial.count();
+    std::array<double, Dim> center{};
+    for (std::size_t i = 0; i < n; i++) {
+        for (int d = 0; d < Dim; d++) center[d] += initial.position[d][i] / (double)n;
+    }
+    double error2 = 0.0, radius2 = 0.0;
+    for (std::size_t i = 0; i < n; i++) {
+        for (int d = 0; d < Dim; d++) {
+            const double offset = (double)returned.position[d][i] - initial.position[d][i];
+            const double radius = (double)initial.position[d][i] - center[d];
+            error2 += offset * offset;
+            radius2 += radius * radius;
+        }
+    }
+    std::printf("  %-8s %6d steps each way %8.2f ms/step  return error %.2e of the RMS radius\n", name, steps, ms,
+                radius2 > 0.0 ? std::sqrt(error2 / radius2) : 0.0);
+}
+
+int main(int argc, char** argv) {
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    int particleCount = 2000;
+    double duration = 1.0;
+    if (argc > 1) threads = (unsigned int)std::max(1, std::atoi(argv[1]));
+    if (argc > 2) particleCount = std::max(1, std::atoi(argv[2]));
+    if (argc > 3) duration = std::max(0.01, std::atof(argv[3]));
+
+    ThreadPool pool(threads);
+    std::printf("threads=%u 2D disc N=%d over %.2f simulated s\n", threads, particleCount, duration);
+    for (const IntegratorSetup& setup : kSetups) runSetup<2>(setup, pool, particleCount, duration);
+    std::printf("leapfrog dt=1/240 forward and back\n");
+    runPrecision<2>(PositionPrecision::Single, "single", pool, particleCount, duration);
+    runPrecision<2>(PositionPrecision::Double, "double", pool, particleCount, duration);
+    return 0;
+}